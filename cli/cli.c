@@ -11,6 +11,12 @@
 #include "helper.h"
 #include "socket_helper.h"       /* writenstr()                       */
 #include "../sr_base_internal.h" /* struct sr_instance                */
+#include "../sr_router.h"        /* router_lookup_interface_via_name() */
+#include "../sr_rtable.h"        /* rtable_route_add()                */
+#include "../sr_arp.h"           /* arp_cache_static_entry_add()      */
+#include "../sr_arena.h"         /* sr_arena_get_stats()              */
+#include "../sr_rxbuf.h"         /* sr_rxbuf_get_stats()              */
+#include "../sr_workers.h"       /* sr_workers_get_stats()            */
 
 /* temporary */
 #include "cli_stubs.h"
@@ -44,6 +50,7 @@ struct sr_instance* my_get_sr() {
         sr->interface_subsystem = NULL;
 
         sr->topo_id = 0;
+        sr->workers = NULL;
         strncpy( sr->vhost, "cli", SR_NAMELEN );
         strncpy( sr->user, "cli mode (no client)", SR_NAMELEN );
         if( gethostname(sr->lhost,  SR_NAMELEN) == -1 )
@@ -256,6 +263,72 @@ void cli_show_ospf_topo() {
     cli_send_str( "not yet implemented: show PWOSPF topology of SR (e.g., for each router, show its ID, last pwospf seq #, and a list of all its links (e.g., router ID + subnet))\n" );
 }
 
+void cli_show_stats() {
+    cli_send_str( "Packet Buffer Arena:\n" );
+    cli_show_stats_arena();
+    cli_send_str( "Receive Buffers:\n" );
+    cli_show_stats_rxbuf();
+    cli_send_str( "Forwarding Workers:\n" );
+    cli_show_stats_workers();
+}
+
+void cli_show_stats_arena() {
+    size_t size, used;
+    int hugetlb;
+    char buf[128];
+
+    sr_arena_get_stats( &size, &used, &hugetlb );
+    if( ! size ) {
+        cli_send_str( "  not mapped, buffers come from malloc\n" );
+        return;
+    }
+
+    snprintf( buf, sizeof(buf), "  %lu of %lu KB carved, on %s pages\n",
+              (unsigned long)(used >> 10), (unsigned long)(size >> 10),
+              hugetlb ? "huge" : "normal" );
+    cli_send_str( buf );
+}
+
+void cli_show_stats_rxbuf() {
+    struct sr_rxbuf_class_stats stats[SR_RXBUF_NUM_CLASSES];
+    unsigned long malloced;
+    char buf[128];
+    int i;
+
+    sr_rxbuf_get_stats( stats, &malloced );
+
+    cli_send_str( "  Size        Allocs   Exhausted\n" );
+    for( i = 0; i < SR_RXBUF_NUM_CLASSES; i++ ) {
+        snprintf( buf, sizeof(buf), "  %6u %12lu %11lu\n",
+                  stats[i].size, stats[i].allocs, stats[i].exhausted );
+        cli_send_str( buf );
+    }
+
+    snprintf( buf, sizeof(buf), "  malloc'd outside the pools: %lu\n", malloced );
+    cli_send_str( buf );
+}
+
+void cli_show_stats_workers() {
+    struct sr_worker_stats stats;
+    struct sr_workers* pool;
+    char buf[128];
+    unsigned i;
+
+    pool = SR->workers;
+    if( ! pool ) {
+        cli_send_str( "  none, frames are forwarded on the packet thread\n" );
+        return;
+    }
+
+    cli_send_str( "  Worker      Packets           Bytes     Sleeps      Drops\n" );
+    for( i = 0; i < pool->num; i++ ) {
+        sr_workers_get_stats( pool, i, &stats );
+        snprintf( buf, sizeof(buf), "  %6u %12lu %15lu %10lu %10lu\n", i,
+                  stats.packets, stats.bytes, stats.sleeps, stats.drops );
+        cli_send_str( buf );
+    }
+}
+
 #ifndef _VNS_MODE_
 void cli_send_no_vns_str() {
 #ifdef _CPUMODE_
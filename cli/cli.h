@@ -119,6 +119,11 @@ void cli_show_ospf();
 void cli_show_ospf_neighbors();
 void cli_show_ospf_topo();
 
+void cli_show_stats();
+void cli_show_stats_arena();
+void cli_show_stats_rxbuf();
+void cli_show_stats_workers();
+
 #ifndef _VNS_MODE_
     void cli_send_no_vns_str();
 #   define cli_show_vns        cli_send_no_vns_str
@@ -40,12 +40,13 @@ HELP_ACTION );
 
         case HELP_SHOW:
             return cli_send_multi_help( fd, "\
-show [hw | ip | opt | ospf | vns]: display information about the router's current state\n",
-5,
+show [hw | ip | opt | ospf | stats | vns]: display information about the router's current state\n",
+6,
 HELP_SHOW_HW,
 HELP_SHOW_IP,
 HELP_SHOW_OPT,
 HELP_SHOW_OSPF,
+HELP_SHOW_STATS,
 HELP_SHOW_VNS );
 
           case HELP_SHOW_HW:
@@ -120,6 +121,26 @@ show ospf neigh: displays information about each interface's neighbors\n" );
                 return 0==writenstr( fd, "\
 show ospf topo: displays the current dynamically computed network topology\n" );
 
+          case HELP_SHOW_STATS:
+              return cli_send_multi_help( fd, "\
+show stats [arena | rxbuf | workers]: display the packet path's counters\n",
+3,
+HELP_SHOW_STATS_ARENA,
+HELP_SHOW_STATS_RXBUF,
+HELP_SHOW_STATS_WORKERS );
+
+            case HELP_SHOW_STATS_ARENA:
+                return 0==writenstr( fd, "\
+show stats arena: displays how much of the packet buffer arena is carved\n" );
+
+            case HELP_SHOW_STATS_RXBUF:
+                return 0==writenstr( fd, "\
+show stats <rxbuf | buffers>: displays how each receive buffer pool is used\n" );
+
+            case HELP_SHOW_STATS_WORKERS:
+                return 0==writenstr( fd, "\
+show stats workers: displays what each forwarding worker has handled and dropped\n" );
+
           case HELP_SHOW_VNS:
               return cli_send_multi_help( fd, "\
 show vns [lhost, topo[logy], user, vhost]: display information about \n\
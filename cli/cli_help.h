@@ -26,6 +26,10 @@ typedef enum cli_help_t {
       HELP_SHOW_OSPF,
        HELP_SHOW_OSPF_NEIGHBORS,
        HELP_SHOW_OSPF_TOPOLOGY,
+      HELP_SHOW_STATS,
+       HELP_SHOW_STATS_ARENA,
+       HELP_SHOW_STATS_RXBUF,
+       HELP_SHOW_STATS_WORKERS,
       HELP_SHOW_VNS,
         HELP_SHOW_VNS_LHOST,
         HELP_SHOW_VNS_TOPOLOGY,
@@ -92,6 +92,7 @@ static void run_command();
 %token  T_ADD T_DEL T_UP T_DOWN T_PURGE T_STATIC T_DYNAMIC T_ABOUT
 %token  T_PING T_TRACE T_HELP T_EXIT T_SHUTDOWN T_FLOOD
 %token  T_SET T_UNSET T_OPTION T_VERBOSE T_DATE
+%token  T_STATS T_WORKERS T_RXBUF T_ARENA
 
 /* Terminals which evaluate to some attribute value */
 %token   <intVal>       TAV_INT
@@ -121,6 +122,7 @@ ShowType : /* empty: show all */                  { SETC_FUNC0(cli_show_all); }
          | T_OSPF ShowTypeOSPF
          | T_VNS ShowTypeVNS
          | T_OPTION ShowTypeOption
+         | T_STATS ShowTypeStats
          | HelpOrQ                                { HELP(HELP_SHOW); }
          ;
 
@@ -174,6 +176,16 @@ ShowTypeVNS : /* empty: show all */               { SETC_FUNC0(cli_show_vns); }
             | WrongOrQ                            { HELP(HELP_SHOW_VNS); }
             ;
 
+ShowTypeStats : /* empty: show all */             { SETC_FUNC0(cli_show_stats); }
+              | T_ARENA                           { SETC_FUNC0(cli_show_stats_arena); }
+              | T_ARENA TMIorQ                    { HELP(HELP_SHOW_STATS_ARENA); }
+              | T_RXBUF                           { SETC_FUNC0(cli_show_stats_rxbuf); }
+              | T_RXBUF TMIorQ                    { HELP(HELP_SHOW_STATS_RXBUF); }
+              | T_WORKERS                         { SETC_FUNC0(cli_show_stats_workers); }
+              | T_WORKERS TMIorQ                  { HELP(HELP_SHOW_STATS_WORKERS); }
+              | WrongOrQ                          { HELP(HELP_SHOW_STATS); }
+              ;
+
 ManipCommand : T_IP ManipTypeIP
              ;
 
@@ -305,6 +317,10 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_SHOW T_OSPF                { HELP(HELP_SHOW_OSPF); }
            | HelpOrQ T_SHOW T_OSPF T_NEIGHBORS    { HELP(HELP_SHOW_OSPF_NEIGHBORS); }
            | HelpOrQ T_SHOW T_OSPF T_TOPOLOGY     { HELP(HELP_SHOW_OSPF_TOPOLOGY); }
+           | HelpOrQ T_SHOW T_STATS               { HELP(HELP_SHOW_STATS); }
+           | HelpOrQ T_SHOW T_STATS T_ARENA       { HELP(HELP_SHOW_STATS_ARENA); }
+           | HelpOrQ T_SHOW T_STATS T_RXBUF       { HELP(HELP_SHOW_STATS_RXBUF); }
+           | HelpOrQ T_SHOW T_STATS T_WORKERS     { HELP(HELP_SHOW_STATS_WORKERS); }
            | HelpOrQ T_SHOW T_VNS                 { HELP(HELP_SHOW_VNS); }
            | HelpOrQ T_SHOW T_VNS T_LHOST         { HELP(HELP_SHOW_VNS_LHOST); }
            | HelpOrQ T_SHOW T_VNS T_TOPOLOGY      { HELP(HELP_SHOW_VNS_TOPOLOGY); }
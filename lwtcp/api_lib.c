@@ -40,6 +40,7 @@
 #include "lwip/api.h"
 #include "lwip/api_msg.h"
 #include "lwip/memp.h"
+#include "lwip/conf.h"
 
 #include "lwip/debug.h"
 
@@ -216,6 +217,8 @@ netconn *netconn_new(enum netconn_type t)
   conn->recvmbox = SYS_MBOX_NULL;
   conn->acceptmbox = SYS_MBOX_NULL;
   conn->sem = SYS_SEM_NULL;
+  conn->recvpend = NULL;
+  conn->recvfin = 0;
   conn->state = NETCONN_NONE;
   return conn;
 }
@@ -360,7 +363,9 @@ netconn_connect(struct netconn *conn, struct ip_addr *addr,
 
 
   if(conn->recvmbox == SYS_MBOX_NULL) {
-    if((conn->recvmbox = sys_mbox_new()) == SYS_MBOX_NULL) {
+    conn->recvmbox = conn->type == NETCONN_TCP ?
+      sys_mbox_new_sized(NETCONN_RECVMBOX_SIZE) : sys_mbox_new();
+    if(conn->recvmbox == SYS_MBOX_NULL) {
       return ERR_MEM;
     }
   }
@@ -388,7 +393,7 @@ netconn_listen(struct netconn *conn)
   }
 
   if(conn->acceptmbox == SYS_MBOX_NULL) {
-    conn->acceptmbox = sys_mbox_new();
+    conn->acceptmbox = sys_mbox_new_sized(NETCONN_ACCEPTMBOX_SIZE);
     if(conn->acceptmbox == SYS_MBOX_NULL) {
       return ERR_MEM;
     }
@@ -595,9 +600,10 @@ netconn_write(struct netconn *conn, void *dataptr, uint16_t size, uint8_t copy)
   }
  ret:
   memp_freep(MEMP_API_MSG, msg);
+  /* Done waiting, lets poll_tcp() stop the connection's poll timer. */
+  conn->state = NETCONN_NONE;
 	// Only run the following if there is a major sending error
 	if (big_trouble) {
-	  conn->state = NETCONN_NONE;
 	  if(conn->sem != SYS_SEM_NULL) {
 	    sys_sem_free(conn->sem);
 	    conn->sem = SYS_SEM_NULL;
@@ -37,11 +37,57 @@
 #include "lwip/arch.h"
 #include "lwip/api_msg.h"
 #include "lwip/memp.h"
+#include "lwip/conf.h"
 #include "lwip/sys.h"
 #include "lwip/tcpip.h"
 
 #include "lwip/transport_subsys.h"
 
+/*-----------------------------------------------------------------------------------*/
+/* recv_flush():
+ *
+ * Moves what recv_post() held back into the recvmbox as far as there is
+ * room, data first.  Called whenever the reader may have made room.
+ */
+/*-----------------------------------------------------------------------------------*/
+static void
+recv_flush(struct netconn *conn)
+{
+  if(conn->recvpend != NULL &&
+     sys_mbox_trypost(conn->recvmbox, conn->recvpend) == ERR_OK) {
+    conn->recvpend = NULL;
+  }
+  if(conn->recvpend == NULL && conn->recvfin &&
+     sys_mbox_trypost(conn->recvmbox, NULL) == ERR_OK) {
+    conn->recvfin = 0;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* recv_post():
+ *
+ * Hands a segment (NULL for the end of the stream) to the reader.  The
+ * transport thread must not wait on a reader that has stopped reading,
+ * so whatever finds the recvmbox full is chained onto conn->recvpend
+ * instead.  That is bounded by the window: nothing in it has been
+ * passed to tcp_recved() yet.
+ */
+/*-----------------------------------------------------------------------------------*/
+static void
+recv_post(struct netconn *conn, struct pbuf *p)
+{
+  recv_flush(conn);
+  if(conn->recvpend == NULL && !conn->recvfin &&
+     sys_mbox_trypost(conn->recvmbox, p) == ERR_OK) {
+    return;
+  }
+  if(p == NULL) {
+    conn->recvfin = 1;
+  } else if(conn->recvpend == NULL) {
+    conn->recvpend = p;
+  } else {
+    pbuf_chain(conn->recvpend, p);
+  }
+}
 /*-----------------------------------------------------------------------------------*/
 static err_t
 recv_tcp(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
@@ -57,7 +103,7 @@ recv_tcp(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
   
   if(conn->recvmbox != SYS_MBOX_NULL) {
     conn->err = err;
-    sys_mbox_post(conn->recvmbox, p);
+    recv_post(conn, p);
   }  
   return ERR_OK;
 }
@@ -88,7 +134,11 @@ recv_udp(void *arg, struct udp_pcb *pcb, struct pbuf *p,
       buf->fromport = port;
     }
     
-    sys_mbox_post(conn->recvmbox, buf);
+    if(sys_mbox_trypost(conn->recvmbox, buf) != ERR_OK) {
+      /* Reader is behind, drop the datagram like a full socket buffer. */
+      pbuf_free(p);
+      memp_freep(MEMP_NETBUF, buf);
+    }
   }
 }
 /*-----------------------------------------------------------------------------------*/
@@ -98,9 +148,14 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
   struct netconn *conn;
 
   conn = arg;
-  if(conn != NULL &&
-     (conn->state == NETCONN_WRITE || conn->state == NETCONN_CLOSE) &&
-     conn->sem != SYS_SEM_NULL) {
+  if(conn == NULL ||
+     (conn->state != NETCONN_WRITE && conn->state != NETCONN_CLOSE)) {
+    /* Nobody is waiting, stop polling (and the timer with it) until the
+       next write or close. */
+    tcp_poll(pcb, NULL, 0);
+    return ERR_OK;
+  }
+  if(conn->sem != SYS_SEM_NULL) {
     sys_sem_signal(conn->sem);
   }
   return ERR_OK;
@@ -130,7 +185,7 @@ err_tcp(void *arg, err_t err)
   
   conn->err = err;
   if(conn->recvmbox != SYS_MBOX_NULL) {
-    sys_mbox_post(conn->recvmbox, NULL);
+    recv_post(conn, NULL);
   }
   if(conn->mbox != SYS_MBOX_NULL) {
     sys_mbox_post(conn->mbox, NULL);
@@ -152,7 +207,6 @@ setup_tcp(struct netconn *conn)
   tcp_arg(pcb, conn);
   tcp_recv(pcb, recv_tcp);
   tcp_sent(pcb, sent_tcp);
-  tcp_poll(pcb, poll_tcp, 4);
   tcp_err(pcb, err_tcp);
 }
 /*-----------------------------------------------------------------------------------*/
@@ -174,8 +228,10 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
   }
   newconn->type = NETCONN_TCP;
   newconn->pcb.tcp = newpcb;
+  newconn->recvpend = NULL;
+  newconn->recvfin = 0;
   setup_tcp(newconn);
-  newconn->recvmbox = sys_mbox_new();
+  newconn->recvmbox = sys_mbox_new_sized(NETCONN_RECVMBOX_SIZE);
   if(newconn->recvmbox == SYS_MBOX_NULL) {
     memp_free(MEMP_NETCONN, newconn);
     return ERR_MEM;
@@ -195,7 +251,17 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
   }
   newconn->acceptmbox = SYS_MBOX_NULL;
   newconn->err = err;
-  sys_mbox_post(*mbox, newconn);
+  if(sys_mbox_trypost(*mbox, newconn) != ERR_OK) {
+    /* Backlog full: returning an error makes tcp_input() abort the
+       connection, which must no longer call back into newconn. */
+    tcp_arg(newpcb, NULL);
+    tcp_err(newpcb, NULL);
+    sys_sem_free(newconn->sem);
+    sys_mbox_free(newconn->recvmbox);
+    sys_mbox_free(newconn->mbox);
+    memp_free(MEMP_NETCONN, newconn);
+    return ERR_MEM;
+  }
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -234,6 +300,12 @@ do_delconn(struct api_msg_msg *msg)
     break;
     }
   }
+  /* Held back for a reader that will never come now. */
+  if(msg->conn->recvpend != NULL) {
+    pbuf_free(msg->conn->recvpend);
+    msg->conn->recvpend = NULL;
+  }
+  msg->conn->recvfin = 0;
   if(msg->conn->mbox != SYS_MBOX_NULL) {
     sys_mbox_post(msg->conn->mbox, NULL);
   }
@@ -382,7 +454,7 @@ do_listen(struct api_msg_msg *msg)
 	msg->conn->err = ERR_MEM;
       } else {
 	if(msg->conn->acceptmbox == SYS_MBOX_NULL) {
-	  msg->conn->acceptmbox = sys_mbox_new();
+	  msg->conn->acceptmbox = sys_mbox_new_sized(NETCONN_ACCEPTMBOX_SIZE);
 	  if(msg->conn->acceptmbox == SYS_MBOX_NULL) {
 	    msg->conn->err = ERR_MEM;
 	    break;
@@ -442,6 +514,9 @@ do_recv(struct api_msg_msg *msg)
       tcp_recved(msg->conn->pcb.tcp, msg->msg.len);
     }
   }
+  if(msg->conn->type == NETCONN_TCP && msg->conn->recvmbox != SYS_MBOX_NULL) {
+    recv_flush(msg->conn);
+  }
   sys_mbox_post(msg->conn->mbox, NULL);
 }
 /*-----------------------------------------------------------------------------------*/
@@ -459,6 +534,8 @@ do_write(struct api_msg_msg *msg)
       msg->conn->err = ERR_VAL;
       break;
     case NETCONN_TCP:      
+      /* Poll while the writer may be waiting for send buffer. */
+      tcp_poll(msg->conn->pcb.tcp, poll_tcp, 4);
       err = tcp_write(msg->conn->pcb.tcp, msg->msg.w.dataptr,
                       msg->msg.w.len, msg->msg.w.copy);
       /* This is the Nagle algorithm: inhibit the sending of new TCP
@@ -491,6 +568,8 @@ do_close(struct api_msg_msg *msg)
       if(msg->conn->pcb.tcp->state == LISTEN) {
 	err = tcp_close(msg->conn->pcb.tcp);
       } else {
+	/* Poll in case the close has to be retried for lack of memory. */
+	tcp_poll(msg->conn->pcb.tcp, poll_tcp, 4);
 	err = tcp_close(msg->conn->pcb.tcp);
       }
       msg->conn->err = err;      
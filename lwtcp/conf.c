@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2001, Swedish Institute of Computer Science.
+ * All rights reserved. 
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution. 
+ * 3. Neither the name of the Institute nor the names of its contributors 
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE 
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS 
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) 
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY 
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE. 
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ */
+
+/*-----------------------------------------------------------------------------------*/
+/* conf.c
+ *
+ * Sizes of the heap, the pools and the TCP buffers chosen at startup,
+ * see lwip/conf.h.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+#include "lwip/debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+
+#include "lwip/opt.h"
+#include "lwip/conf.h"
+
+#define LWIP_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+struct lwip_conf lwip_conf = {
+  MEM_SIZE,
+  {
+    MEMP_NUM_PBUF,
+    MEMP_NUM_UDP_PCB,
+    MEMP_NUM_TCP_PCB,
+    MEMP_NUM_TCP_PCB_LISTEN,
+    MEMP_NUM_TCP_SEG,
+    MEMP_NUM_NETBUF,
+    MEMP_NUM_NETCONN,
+    MEMP_NUM_API_MSG,
+    MEMP_NUM_TCPIP_MSG,
+    MEMP_NUM_SYS_TIMEOUT
+  },
+  PBUF_POOL_SIZE,
+  TCP_SND_BUF,
+  TCP_SND_QUEUELEN,
+  TCP_WND,
+  0,
+  NULL
+};
+
+struct conf_opt {
+  const char *name;
+  size_t off;       /* in struct lwip_conf */
+  uint8_t width;    /* bytes */
+  uint32_t min, max;
+};
+
+#define CONF_OPT(name, field, min, max) \
+  { name, offsetof(struct lwip_conf, field), \
+    sizeof(((struct lwip_conf *)0)->field), min, max }
+
+static const struct conf_opt conf_opts[] = {
+  CONF_OPT("mem_size",         mem_size,                     16 * MEM_SPAN_SIZE, 0x7fffffff),
+  CONF_OPT("pbufs",            memp_num[MEMP_PBUF],          1, 0xffff),
+  CONF_OPT("udp_pcbs",         memp_num[MEMP_UDP_PCB],       0, 0xffff),
+  CONF_OPT("tcp_pcbs",         memp_num[MEMP_TCP_PCB],       1, 0xffff),
+  CONF_OPT("tcp_listen_pcbs",  memp_num[MEMP_TCP_PCB_LISTEN], 1, 0xffff),
+  CONF_OPT("tcp_segs",         memp_num[MEMP_TCP_SEG],       1, 0xffff),
+  CONF_OPT("netbufs",          memp_num[MEMP_NETBUF],        1, 0xffff),
+  CONF_OPT("netconns",         memp_num[MEMP_NETCONN],       1, 0xffff),
+  CONF_OPT("api_msgs",         memp_num[MEMP_API_MSG],       1, 0xffff),
+  CONF_OPT("tcp_msgs",         memp_num[MEMP_TCP_MSG],       1, 0xffff),
+  CONF_OPT("timeouts",         memp_num[MEMP_SYS_TIMEOUT],   16, 0xffff),
+  CONF_OPT("pbuf_pool",        pbuf_pool_size,               1, 0xffff),
+  CONF_OPT("tcp_snd_buf",      tcp_snd_buf,                  TCP_MSS, 0xffff),
+  CONF_OPT("tcp_snd_queuelen", tcp_snd_queuelen,             2, 0xffff),
+  CONF_OPT("tcp_wnd",          tcp_wnd,                      TCP_MSS, 0xffff),
+  CONF_OPT("hugepages",        hugepages,                    0, 1),
+  { NULL, 0, 0, 0, 0 }
+};
+
+/* Set along with tcp_snd_buf unless given on its own. */
+static int queuelen_set = 0;
+
+/*-----------------------------------------------------------------------------------*/
+static int
+conf_value(const char *s, uint32_t *v)
+{
+  unsigned long long n;
+  char *end;
+
+  n = strtoull(s, &end, 0);
+  if(end == s) {
+    return -1;
+  }
+  switch(*end) {
+  case 'k': case 'K': n <<= 10; ++end; break;
+  case 'm': case 'M': n <<= 20; ++end; break;
+  case 'g': case 'G': n <<= 30; ++end; break;
+  }
+  while(isspace((unsigned char)*end)) {
+    ++end;
+  }
+  if(*end != '\0' || n > 0xffffffffULL) {
+    return -1;
+  }
+  *v = (uint32_t)n;
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+conf_set(const char *name, size_t len, const char *value)
+{
+  const struct conf_opt *o;
+  uint8_t *field;
+  uint32_t v;
+
+  for(o = conf_opts; o->name != NULL; ++o) {
+    if(strlen(o->name) == len && strncmp(o->name, name, len) == 0) {
+      break;
+    }
+  }
+  if(o->name == NULL) {
+    fprintf(stderr, "lwip: unknown size %.*s\n", (int)len, name);
+    return -1;
+  }
+  if(conf_value(value, &v) != 0 || v < o->min || v > o->max) {
+    fprintf(stderr, "lwip: bad value for %s: %s (%lu..%lu)\n", o->name,
+            value, (unsigned long)o->min, (unsigned long)o->max);
+    return -1;
+  }
+
+  field = (uint8_t *)&lwip_conf + o->off;
+  switch(o->width) {
+  case 1: *(uint8_t *)field = v; break;
+  case 2: *(uint16_t *)field = v; break;
+  case 4: *(uint32_t *)field = v; break;
+  }
+
+  if(o->off == offsetof(struct lwip_conf, tcp_snd_queuelen)) {
+    queuelen_set = 1;
+  } else if(o->off == offsetof(struct lwip_conf, tcp_snd_buf) && !queuelen_set) {
+    v = 4 * v / TCP_MSS;
+    lwip_conf.tcp_snd_queuelen = v > 0xffff ? 0xffff : v;
+  }
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+int
+lwip_conf_set(const char *opt)
+{
+  const char *eq;
+
+  eq = strchr(opt, '=');
+  if(eq == NULL) {
+    fprintf(stderr, "lwip: expected name=value, got %s\n", opt);
+    return -1;
+  }
+  return conf_set(opt, eq - opt, eq + 1);
+}
+/*-----------------------------------------------------------------------------------*/
+int
+lwip_conf_read(const char *file)
+{
+  FILE *fp;
+  char line[256], *s, *name, *c;
+  size_t len;
+  int lineno, ret;
+
+  if((fp = fopen(file, "r")) == NULL) {
+    perror(file);
+    return -1;
+  }
+
+  ret = 0;
+  for(lineno = 1; ret == 0 && fgets(line, sizeof(line), fp) != NULL; ++lineno) {
+    if((c = strchr(line, '#')) != NULL) {
+      *c = '\0';
+    }
+    for(s = line; isspace((unsigned char)*s); ++s);
+    if(*s == '\0') {
+      continue;
+    }
+    name = s;
+    for(; *s != '\0' && *s != '=' && !isspace((unsigned char)*s); ++s);
+    len = s - name;
+    for(; isspace((unsigned char)*s) || *s == '='; ++s);
+    if(conf_set(name, len, s) != 0) {
+      fprintf(stderr, "lwip: %s:%d: bad line\n", file, lineno);
+      ret = -1;
+    }
+  }
+  fclose(fp);
+  return ret;
+}
+/*-----------------------------------------------------------------------------------*/
+void *
+lwip_conf_map(size_t size)
+{
+  void *p;
+
+#ifdef MAP_HUGETLB
+  if(lwip_conf.hugepages) {
+    p = mmap(NULL, (size + LWIP_HUGEPAGE_SIZE - 1) & ~(size_t)(LWIP_HUGEPAGE_SIZE - 1),
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+             -1, 0);
+    if(p != MAP_FAILED) {
+      return p;
+    }
+    fprintf(stderr, "lwip: no hugepages for %lu bytes, using normal pages\n",
+            (unsigned long)size);
+  }
+#endif /* MAP_HUGETLB */
+
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+           -1, 0);
+  if(p == MAP_FAILED) {
+    perror("lwip: mmap");
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if(lwip_conf.hugepages) {
+    /* At least let the kernel back it with transparent hugepages. */
+    madvise(p, size, MADV_HUGEPAGE);
+  }
+#endif /* MADV_HUGEPAGE */
+  return p;
+}
+/*-----------------------------------------------------------------------------------*/
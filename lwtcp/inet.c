@@ -42,6 +42,8 @@
  */
 /*-----------------------------------------------------------------------------------*/
 
+#include <string.h>
+
 #include "lwip/debug.h"
 
 #include "lwip/arch.h"
@@ -56,27 +58,270 @@
  * Sums up all 16 bit words in a memory portion. Also includes any odd byte.
  * This function is used by the other checksum functions.
  *
- * For now, this is not optimized. Must be optimized for the particular processor
- * arcitecture on which it is to run. Preferebly coded in assembler.
+ * Since the one's complement sum does not care how the words are grouped, the
+ * kernels below add whole 32 bit words into 64 bit accumulators and only fold
+ * down to 16 bits at the end.  On x86 an SSE2 or AVX2 kernel is picked the first
+ * time chksum() runs, according to what the CPU supports.  All of them return
+ * the sum folded to 16 bits.
  */
 /*-----------------------------------------------------------------------------------*/
-static uint32_t 
-chksum(void *dataptr, int len)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INET_CHKSUM_X86
+#include <immintrin.h>
+#endif
+
+static uint32_t
+chksum_fold(uint64_t acc)
 {
-    uint32_t  acc;
-    uint16_t* short_ptr = (uint16_t*)dataptr;
+  acc = (acc & 0xffffffff) + (acc >> 32);
+  acc = (acc & 0xffffffff) + (acc >> 32);
+  acc = (acc & 0xffff) + (acc >> 16);
+  acc = (acc & 0xffff) + (acc >> 16);
+  return (uint32_t)acc;
+}
+/*-----------------------------------------------------------------------------------*/
+/* chksum_tail:
+ *
+ * Adds the remaining len bytes at ptr to acc, eight bytes at a time and then the
+ * leftover words and odd byte.
+ */
+/*-----------------------------------------------------------------------------------*/
+static uint32_t
+chksum_tail(uint64_t acc, const uint8_t *ptr, int len)
+{
+  uint64_t w;
+  uint16_t s;
 
-    for(acc = 0; len > 1; len -= 2) {
-        acc += *short_ptr++;
-    }
+  for(; len >= 8; len -= 8, ptr += 8) {
+    memcpy(&w, ptr, 8);
+    acc += (w & 0xffffffff) + (w >> 32);
+  }
+  for(; len > 1; len -= 2, ptr += 2) {
+    memcpy(&s, ptr, 2);
+    acc += s;
+  }
 
-    /* add up any odd byte */
-    if(len == 1) {
-        acc += htons((uint16_t)((*(uint8_t *)short_ptr) & 0xff) << 8);
-        DEBUGF(INET_DEBUG, ("inet: chksum: odd byte %d\n", *(uint8_t *)dataptr));
-    }
+  /* add up any odd byte */
+  if(len == 1) {
+    acc += htons((uint16_t)(*ptr & 0xff) << 8);
+    DEBUGF(INET_DEBUG, ("inet: chksum: odd byte %d\n", *ptr));
+  }
+
+  return chksum_fold(acc);
+}
+/*-----------------------------------------------------------------------------------*/
+static uint32_t
+chksum_generic(void *dataptr, int len)
+{
+  const uint8_t *ptr = (const uint8_t *)dataptr;
+  uint64_t acc0, acc1, w0, w1;
+
+  acc0 = acc1 = 0;
+  for(; len >= 16; len -= 16, ptr += 16) {
+    memcpy(&w0, ptr, 8);
+    memcpy(&w1, ptr + 8, 8);
+    acc0 += (w0 & 0xffffffff) + (w0 >> 32);
+    acc1 += (w1 & 0xffffffff) + (w1 >> 32);
+  }
+
+  return chksum_tail(acc0 + acc1, ptr, len);
+}
+/*-----------------------------------------------------------------------------------*/
+/* chksum_copy_*:
+ *
+ * Same as the chksum kernels, but also copy the len bytes at src to dst on the way,
+ * so the data is only pulled through the cache once.
+ */
+/*-----------------------------------------------------------------------------------*/
+static uint32_t
+chksum_copy_generic(void *dst, const void *src, int len)
+{
+  const uint8_t *from = (const uint8_t *)src;
+  uint8_t *to = (uint8_t *)dst;
+  uint64_t acc0, acc1, w0, w1;
+
+  acc0 = acc1 = 0;
+  for(; len >= 16; len -= 16, from += 16, to += 16) {
+    memcpy(&w0, from, 8);
+    memcpy(&w1, from + 8, 8);
+    memcpy(to, &w0, 8);
+    memcpy(to + 8, &w1, 8);
+    acc0 += (w0 & 0xffffffff) + (w0 >> 32);
+    acc1 += (w1 & 0xffffffff) + (w1 >> 32);
+  }
+  memcpy(to, from, len);
+
+  return chksum_tail(acc0 + acc1, from, len);
+}
+/*-----------------------------------------------------------------------------------*/
+#ifdef INET_CHKSUM_X86
+__attribute__ ((target ("sse2")))
+static uint32_t
+chksum_sse2(void *dataptr, int len)
+{
+  const uint8_t *ptr = (const uint8_t *)dataptr;
+  __m128i zero, acc0, acc1, v;
+  uint64_t lanes[2];
+
+  zero = acc0 = acc1 = _mm_setzero_si128();
+  for(; len >= 32; len -= 32, ptr += 32) {
+    v = _mm_loadu_si128((const __m128i *)ptr);
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+    v = _mm_loadu_si128((const __m128i *)(ptr + 16));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+  }
+  _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+
+  return chksum_tail((uint64_t)chksum_fold(lanes[0]) + chksum_fold(lanes[1]),
+                     ptr, len);
+}
+/*-----------------------------------------------------------------------------------*/
+__attribute__ ((target ("sse2")))
+static uint32_t
+chksum_copy_sse2(void *dst, const void *src, int len)
+{
+  const uint8_t *from = (const uint8_t *)src;
+  uint8_t *to = (uint8_t *)dst;
+  __m128i zero, acc0, acc1, v;
+  uint64_t lanes[2];
 
-    return acc;
+  zero = acc0 = acc1 = _mm_setzero_si128();
+  for(; len >= 16; len -= 16, from += 16, to += 16) {
+    v = _mm_loadu_si128((const __m128i *)from);
+    _mm_storeu_si128((__m128i *)to, v);
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+  }
+  _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+  memcpy(to, from, len);
+
+  return chksum_tail((uint64_t)chksum_fold(lanes[0]) + chksum_fold(lanes[1]),
+                     from, len);
+}
+/*-----------------------------------------------------------------------------------*/
+__attribute__ ((target ("avx2")))
+static uint32_t
+chksum_avx2(void *dataptr, int len)
+{
+  const uint8_t *ptr = (const uint8_t *)dataptr;
+  __m256i zero, acc0, acc1, v;
+  uint64_t lanes[4];
+
+  zero = acc0 = acc1 = _mm256_setzero_si256();
+  for(; len >= 64; len -= 64, ptr += 64) {
+    v = _mm256_loadu_si256((const __m256i *)ptr);
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+    v = _mm256_loadu_si256((const __m256i *)(ptr + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+
+  return chksum_tail((uint64_t)chksum_fold(lanes[0]) + chksum_fold(lanes[1]) +
+                     chksum_fold(lanes[2]) + chksum_fold(lanes[3]), ptr, len);
+}
+/*-----------------------------------------------------------------------------------*/
+__attribute__ ((target ("avx2")))
+static uint32_t
+chksum_copy_avx2(void *dst, const void *src, int len)
+{
+  const uint8_t *from = (const uint8_t *)src;
+  uint8_t *to = (uint8_t *)dst;
+  __m256i zero, acc0, acc1, v;
+  uint64_t lanes[4];
+
+  zero = acc0 = acc1 = _mm256_setzero_si256();
+  for(; len >= 32; len -= 32, from += 32, to += 32) {
+    v = _mm256_loadu_si256((const __m256i *)from);
+    _mm256_storeu_si256((__m256i *)to, v);
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+  memcpy(to, from, len);
+
+  return chksum_tail((uint64_t)chksum_fold(lanes[0]) + chksum_fold(lanes[1]) +
+                     chksum_fold(lanes[2]) + chksum_fold(lanes[3]), from, len);
+}
+#endif /* INET_CHKSUM_X86 */
+/*-----------------------------------------------------------------------------------*/
+static uint32_t chksum_select(void *dataptr, int len);
+static uint32_t chksum_copy_select(void *dst, const void *src, int len);
+
+/* racing first calls all pick the same kernels, so plain stores will do */
+static uint32_t (*chksum_impl)(void *dataptr, int len) = chksum_select;
+static uint32_t (*chksum_copy_impl)(void *dst, const void *src, int len) =
+  chksum_copy_select;
+
+static void
+chksum_pick(void)
+{
+  uint32_t (*impl)(void *, int) = chksum_generic;
+  uint32_t (*copy_impl)(void *, const void *, int) = chksum_copy_generic;
+
+#ifdef INET_CHKSUM_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    impl = chksum_avx2;
+    copy_impl = chksum_copy_avx2;
+  } else if(__builtin_cpu_supports("sse2")) {
+    impl = chksum_sse2;
+    copy_impl = chksum_copy_sse2;
+  }
+#endif /* INET_CHKSUM_X86 */
+
+  __atomic_store_n(&chksum_impl, impl, __ATOMIC_RELAXED);
+  __atomic_store_n(&chksum_copy_impl, copy_impl, __ATOMIC_RELAXED);
+}
+
+static uint32_t
+chksum_select(void *dataptr, int len)
+{
+  chksum_pick();
+  return chksum_impl(dataptr, len);
+}
+
+static uint32_t
+chksum_copy_select(void *dst, const void *src, int len)
+{
+  chksum_pick();
+  return chksum_copy_impl(dst, src, len);
+}
+/*-----------------------------------------------------------------------------------*/
+static uint32_t
+chksum(void *dataptr, int len)
+{
+  return __atomic_load_n(&chksum_impl, __ATOMIC_RELAXED)(dataptr, len);
+}
+/*-----------------------------------------------------------------------------------*/
+/* chksum_pbuf_one:
+ *
+ * chksum() of a single pbuf, reusing the sum left in it by inet_chksum_copy() for
+ * the tail it covers when there is one.
+ */
+/*-----------------------------------------------------------------------------------*/
+static uint32_t
+chksum_pbuf_one(struct pbuf *q)
+{
+  uint32_t acc;
+  uint16_t head;
+
+  if(q->chksum_len == 0 || q->chksum_len > q->len) {
+    return chksum(q->payload, q->len);
+  }
+
+  head = q->len - q->chksum_len;
+  acc = chksum(q->payload, head);
+  if(head % 2 != 0) {
+    /* the stored sum was taken with the other byte pairing */
+    acc += ((q->chksum & 0xff) << 8) | ((q->chksum & 0xff00) >> 8);
+  } else {
+    acc += q->chksum;
+  }
+  return acc;
 }
 /*-----------------------------------------------------------------------------------*/
 /* inet_chksum_pseudo:
@@ -96,7 +341,7 @@ inet_chksum_pseudo(struct pbuf *p,
   acc = 0;
   swapped = 0;
   for(q = p; q != NULL; q = q->next) {    
-    acc += chksum(q->payload, q->len);
+    acc += chksum_pbuf_one(q);
     while(acc >> 16) {
       acc = (acc & 0xffff) + (acc >> 16);
     }
@@ -140,6 +385,38 @@ inet_chksum(void *dataptr, uint16_t len)
   return ~(acc & 0xffff);
 }
 /*-----------------------------------------------------------------------------------*/
+/* inet_chksum_adjust:
+ *
+ * Updates the Internet checksum sum of some data after one 16 bit word of the data
+ * changed from old_word to new_word, without touching the rest of the data
+ * (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')).  All three are taken as they sit in
+ * memory, i.e. in network byte order.
+ */
+/*-----------------------------------------------------------------------------------*/
+uint16_t
+inet_chksum_adjust(uint16_t sum, uint16_t old_word, uint16_t new_word)
+{
+  uint32_t acc;
+
+  acc = (uint32_t)(uint16_t)~sum + (uint16_t)~old_word + new_word;
+  while(acc >> 16) {
+    acc = (acc & 0xffff) + (acc >> 16);
+  }
+  return ~(acc & 0xffff);
+}
+/*-----------------------------------------------------------------------------------*/
+/* inet_chksum_copy:
+ *
+ * Copies len bytes from src to dst and returns their 16 bit one's complement sum,
+ * folded but not inverted, ready to be left in a pbuf's chksum field.
+ */
+/*-----------------------------------------------------------------------------------*/
+uint16_t
+inet_chksum_copy(void *dst, const void *src, uint16_t len)
+{
+  return (uint16_t)__atomic_load_n(&chksum_copy_impl, __ATOMIC_RELAXED)(dst, src, len);
+}
+/*-----------------------------------------------------------------------------------*/
 uint16_t
 inet_chksum_pbuf(struct pbuf *p)
 {
@@ -150,13 +427,13 @@ inet_chksum_pbuf(struct pbuf *p)
   acc = 0;
   swapped = 0;
   for(q = p; q != NULL; q = q->next) {
-    acc += chksum(q->payload, q->len);
+    acc += chksum_pbuf_one(q);
     while(acc >> 16) {
       acc = (acc & 0xffff) + (acc >> 16);
     }    
     if(q->len % 2 != 0) {
       swapped = 1 - swapped;
-      acc = (acc & 0xff << 8) | (acc & 0xff00 >> 8);
+      acc = ((acc & 0xff) << 8) | ((acc & 0xff00) >> 8);
     }
   }
  
@@ -84,6 +84,10 @@ struct netconn {
   sys_mbox_t recvmbox;
   sys_mbox_t acceptmbox;
   sys_sem_t sem;
+  /* Data (chained) and end of stream the full recvmbox had no room for,
+     touched by the transport thread only. */
+  struct pbuf *recvpend;
+  uint8_t recvfin;
 };
 
 /* Network buffer functions: */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2001, Swedish Institute of Computer Science.
+ * All rights reserved. 
+ *
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in the 
+ *    documentation and/or other materials provided with the distribution. 
+ * 3. Neither the name of the Institute nor the names of its contributors 
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE 
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS 
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) 
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY 
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE. 
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ */
+#ifndef __LWIP_CONF_H__
+#define __LWIP_CONF_H__
+
+#include <stddef.h>
+
+#include "lwip/arch.h"
+#include "lwip/memp.h"
+
+/* Sizes of the heap and of the pools, and the TCP buffer sizes, fixed
+   at startup.  They default to the values in lwipopts.h and may be
+   changed with lwip_conf_set() or lwip_conf_read() before mem_init(),
+   memp_init() and pbuf_init() are called; the memory for the heap and
+   the pools is then mapped once, on hugepages if asked to. */
+struct lwip_conf {
+  uint32_t mem_size;             /* MEM_SIZE */
+  uint16_t memp_num[MEMP_MAX];   /* MEMP_NUM_... */
+  uint16_t pbuf_pool_size;       /* PBUF_POOL_SIZE */
+  uint16_t tcp_snd_buf;          /* TCP_SND_BUF */
+  uint16_t tcp_snd_queuelen;     /* TCP_SND_QUEUELEN */
+  uint16_t tcp_wnd;              /* TCP_WND */
+  uint8_t hugepages;             /* map on hugepages if there are any */
+
+  /* Where pbuf_init() takes the pool from, e.g. a packet buffer arena
+     the pool should share.  lwip_conf_map() if NULL or out of room. */
+  void *(*pbuf_pool_alloc)(size_t size);
+};
+
+extern struct lwip_conf lwip_conf;
+
+/* Set one size from "name=value" (e.g. "tcp_pcbs=400", "mem_size=64M").
+   Returns 0, or -1 if the name is unknown or the value out of range. */
+int lwip_conf_set(const char *opt);
+
+/* Set the sizes in a file, one "name=value" or "name value" a line,
+   # starts a comment.  Returns 0, or -1 on the first bad line. */
+int lwip_conf_read(const char *file);
+
+/* Zeroed memory for the heap or a pool, never given back. */
+void *lwip_conf_map(size_t size);
+
+#endif /* __LWIP_CONF_H__ */
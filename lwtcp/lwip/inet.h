@@ -43,6 +43,8 @@
 
 uint16_t inet_chksum(void *dataptr, uint16_t len);
 uint16_t inet_chksum_pbuf(struct pbuf *p);
+uint16_t inet_chksum_copy(void *dst, const void *src, uint16_t len);
+uint16_t inet_chksum_adjust(uint16_t sum, uint16_t old_word, uint16_t new_word);
 uint16_t inet_chksum_pseudo(struct pbuf *p,
 			 struct ip_addr *src, struct ip_addr *dest,
 			 uint8_t proto, uint16_t proto_len);
@@ -36,6 +36,9 @@
 #define __LWIPOPTS_H__
 
 /* ---------- Memory options ---------- */
+/* MEM_SIZE, the MEMP_NUM_ sizes, PBUF_POOL_SIZE, TCP_SND_BUF,
+   TCP_SND_QUEUELEN and TCP_WND are only defaults, they can be changed
+   at startup (see lwip/conf.h). */
 /* MEM_ALIGNMENT: should be set to the alignment of the CPU for which
    lwIP is compiled. 4 byte alignment -> define MEM_ALIGNMENT to 4, 2
    byte alignment -> define MEM_ALIGNMENT to 2. */
@@ -45,6 +48,16 @@
 a lot of data that needs to be copied, this should be set high. */
 #define MEM_SIZE                5120000 
 
+/* MEM_SPAN_SIZE: the heap is handed out to the size classes in spans
+   of this many bytes, a power of two.  Larger requests take runs of
+   whole spans. */
+#define MEM_SPAN_SIZE           32768
+
+/* MEM_CACHE_SIZE: the number of free blocks of each size class a
+   thread keeps for itself before giving some back to the heap.  0
+   turns the per-thread caches off. */
+#define MEM_CACHE_SIZE          32
+
 /* MEMP_NUM_PBUF: the number of memp struct pbufs. If the application
    sends a lot of data out of ROM (or other static memory), this
    should be set high. */
@@ -63,7 +76,10 @@ a lot of data that needs to be copied, this should be set high. */
 #define MEMP_NUM_TCP_SEG        8
 /* MEMP_NUM_SYS_TIMEOUT: the number of simulateously active
    timeouts. */
-#define MEMP_NUM_SYS_TIMEOUT    3
+#define MEMP_NUM_SYS_TIMEOUT    1024
+/* MEMP_MAGAZINE_SIZE: the most free elements of a pool each thread
+   keeps for itself, see memp.c. */
+#define MEMP_MAGAZINE_SIZE      16
 
 
 /* The following four are used only with the sequential API and can be
@@ -156,6 +172,26 @@ a lot of data that needs to be copied, this should be set high. */
 #define UDP_TTL                 255
 
 
+/* ---------- Mailbox options ---------- */
+/* SYS_MBOX_SIZE: messages a mailbox holds unless sized otherwise. */
+#define SYS_MBOX_SIZE           128
+
+/* TRANSPORT_MBOX_SIZE: messages waiting for the transport thread.
+   Incoming segments that find it full are dropped (and counted in
+   stats.sys.mbox.drop), API calls wait for room. */
+#define TRANSPORT_MBOX_SIZE     256
+
+/* NETCONN_RECVMBOX_SIZE: segments waiting for a netconn_recv(), about
+   a window of full sized ones plus the FIN and an error.  Segments that
+   find it full are chained together until the reader makes room (see
+   recv_post() in api_msg.c), so small ones cost no extra slots. */
+#define NETCONN_RECVMBOX_SIZE   (lwip_conf.tcp_wnd / TCP_MSS + 4)
+
+/* NETCONN_ACCEPTMBOX_SIZE: established connections waiting for a
+   netconn_accept().  Connections past that are reset. */
+#define NETCONN_ACCEPTMBOX_SIZE 16
+
+
 /* ---------- Statistics options ---------- */
 #define STATS
 
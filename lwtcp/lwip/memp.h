@@ -59,6 +59,8 @@ typedef enum {
 
 void memp_init(void);
 
+/* Any thread may call these, each allocates from a magazine of its own
+   (see memp.c).  The p variants are kept as aliases. */
 void *memp_malloc(memp_t type);
 void *memp_mallocp(memp_t type);
 void *memp_malloc2(memp_t type);
@@ -71,6 +71,18 @@
 #define MEM_ALIGNMENT           1
 #endif
 
+#ifndef MEM_SPAN_SIZE
+#define MEM_SPAN_SIZE           32768
+#endif
+
+#ifndef MEM_CACHE_SIZE
+#define MEM_CACHE_SIZE          32
+#endif
+
+#ifndef MEMP_MAGAZINE_SIZE
+#define MEMP_MAGAZINE_SIZE      16
+#endif
+
 #ifndef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE          16
 #endif
@@ -91,6 +103,22 @@
 #define LWIP_TCP                1
 #endif
 
+#ifndef SYS_MBOX_SIZE
+#define SYS_MBOX_SIZE           128
+#endif
+
+#ifndef TRANSPORT_MBOX_SIZE
+#define TRANSPORT_MBOX_SIZE     SYS_MBOX_SIZE
+#endif
+
+#ifndef NETCONN_RECVMBOX_SIZE
+#define NETCONN_RECVMBOX_SIZE   (lwip_conf.tcp_wnd / TCP_MSS + 4)
+#endif
+
+#ifndef NETCONN_ACCEPTMBOX_SIZE
+#define NETCONN_ACCEPTMBOX_SIZE 16
+#endif
+
 #endif /* __LWIP_OPT_H__ */
 
 
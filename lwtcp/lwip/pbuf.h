@@ -53,7 +53,8 @@ typedef enum {
 typedef enum {
   PBUF_RAM,
   PBUF_ROM,
-  PBUF_POOL
+  PBUF_POOL,
+  PBUF_REF
 } pbuf_flag;
 
 /* Definitions for the pbuf flag field (these are not the flags that
@@ -62,6 +63,8 @@ typedef enum {
 #define PBUF_FLAG_ROM   0x01    /* Flags that pbuf data is stored in ROM. */
 #define PBUF_FLAG_POOL  0x02    /* Flags that the pbuf comes from the
 				   pbuf pool. */
+#define PBUF_FLAG_REF   0x03    /* Flags that pbuf data is borrowed and
+				   handed back through ->ref_free. */
 
 struct pbuf {
   struct pbuf *next;
@@ -74,6 +77,17 @@ struct pbuf {
   uint16_t tot_len;
   /* Length of this buffer. */
   uint16_t len;  
+
+  /* If non-zero, chksum holds the (folded, not inverted) Internet
+     checksum sum of the last chksum_len bytes of this buffer, worked
+     out while the data was copied in.  Cleared whenever the buffer is
+     allocated or shrunk; whoever writes into that region clears it. */
+  uint16_t chksum_len;
+  uint16_t chksum;
+
+  /* PBUF_REF only: called with ref_arg when the pbuf is freed. */
+  void (*ref_free)(void *arg);
+  void *ref_arg;
   
 };
 
@@ -84,6 +98,11 @@ struct pbuf {
    parameter specifies the size of the data allocated to those.  */
 void pbuf_init(void);
 
+/* pbuf_pool_memsize():
+
+   Bytes of memory pbuf_init() will take for the pool. */
+size_t pbuf_pool_memsize(void);
+
 /* pbuf_alloc():
    
    Allocates a pbuf at protocol layer l. The actual memory allocated
@@ -104,6 +123,16 @@ void pbuf_init(void);
                 the pbuf pool that is allocated during pbuf_init().  */
 struct pbuf *pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag);
 
+/* pbuf_alloc_ref():
+
+   Allocates a PBUF_REF pbuf whose payload is the size bytes at
+   payload, which are not copied.  The memory stays the caller's;
+   free_fn(arg) is called once the pbuf is freed, from whichever
+   thread frees it, to say lwIP is done with it.  Like ROM pbufs, no
+   header can be prepended in front of the payload.  */
+struct pbuf *pbuf_alloc_ref(void *payload, uint16_t size,
+			    void (*free_fn)(void *arg), void *arg);
+
 /* pbuf_realloc():
 
    Shrinks the pbuf to the size given by the size parameter. 
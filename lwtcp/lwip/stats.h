@@ -83,9 +83,18 @@ struct stats_syselem {
   uint16_t err;
 };
 
+struct stats_sysmbox {
+  uint16_t used;
+  uint16_t max;
+  uint16_t err;
+  uint16_t hwm;    /* most messages ever waiting in one mailbox */
+  uint32_t drop;   /* sys_mbox_trypost() found it full */
+  uint32_t block;  /* sys_mbox_post() had to wait for room */
+};
+
 struct stats_sys {
   struct stats_syselem sem;
-  struct stats_syselem mbox;
+  struct stats_sysmbox mbox;
 };
 
 struct stats_ {
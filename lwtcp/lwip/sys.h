@@ -36,6 +36,7 @@
 #define __LWIP_SYS_H__
 
 #include "lwip/arch.h"
+#include "lwip/err.h"
 
 #define SYS_MBOX_NULL NULL
 #define SYS_SEM_NULL  NULL
@@ -51,15 +52,33 @@ typedef struct sys_thread * sys_thread_t;
 
 typedef void (* sys_timeout_handler)(void *arg);
 
+/* Each thread keeps its timeouts in a hierarchical timing wheel (G.
+   Varghese and T. Lauck): SYS_WHEEL_LEVELS wheels of SYS_WHEEL_SLOTS
+   lists, level l holding the timeouts due within 64^(l+1) ms sorted by
+   bits 6l.. of their due time.  Adding and cancelling a timeout are
+   O(1); a timeout moves down one level whenever the wheel below it goes
+   round, and those further out than the top level can reach are simply
+   put back until they are in range. */
+#define SYS_WHEEL_BITS   6
+#define SYS_WHEEL_SLOTS  (1 << SYS_WHEEL_BITS)
+#define SYS_WHEEL_MASK   (SYS_WHEEL_SLOTS - 1)
+#define SYS_WHEEL_LEVELS 4   /* reach: 2^24 ms, ~4.6 hours */
+
 struct sys_timeout {
   struct sys_timeout *next;
-  uint16_t time;
+  struct sys_timeout **pprev;  /* what points at us, for cancelling */
+  uint32_t due;                /* sys_now() at which to run */
+  uint8_t level, slot;
   sys_timeout_handler h;
   void *arg;
 };
 
 struct sys_timeouts {
-  struct sys_timeout *next;
+  uint32_t now;    /* wheel time, everything due before it has run */
+  uint32_t count;
+  int running;     /* in wheel_run(), don't go round again */
+  uint64_t pending[SYS_WHEEL_LEVELS];  /* bit per non-empty slot */
+  struct sys_timeout *slots[SYS_WHEEL_LEVELS][SYS_WHEEL_SLOTS];
 };
 
 /* sys_init() must be called before anthing else. */
@@ -74,10 +93,19 @@ void sys_thread_init();
  * be called. The handler will be passed the "arg" argument when
  * called.
  *
+ * Returns a handle for sys_untimeout(), or NULL if out of memory.  The
+ * timeout belongs to the calling thread and runs there, only that
+ * thread may cancel it and only until it has run.
+ *
  */
-void sys_timeout(uint16_t msecs, sys_timeout_handler h, void *arg);
+struct sys_timeout *sys_timeout(uint32_t msecs, sys_timeout_handler h, void *arg);
+void sys_untimeout(struct sys_timeout *timeout);
 struct sys_timeouts *sys_arch_timeouts(void);
 
+/* Set up and tear down a thread's wheel, for sys_arch. */
+void sys_timeouts_init(struct sys_timeouts *timeouts);
+void sys_timeouts_free(struct sys_timeouts *timeouts);
+
 /* Semaphore functions. */
 sys_sem_t sys_sem_new(uint8_t count);
 void sys_sem_signal(sys_sem_t sem);
@@ -86,9 +114,14 @@ void sys_sem_free(sys_sem_t sem);
 
 void sys_sem_wait(sys_sem_t sem);
 
-/* Mailbox functions. */
+/* Mailbox functions.  sys_mbox_new() holds SYS_MBOX_SIZE messages,
+   sys_mbox_new_sized() size (rounded up to a power of two).  When the
+   mailbox is full sys_mbox_post() waits for room, sys_mbox_trypost()
+   returns ERR_MEM and the caller keeps msg. */
 sys_mbox_t sys_mbox_new(void);
+sys_mbox_t sys_mbox_new_sized(uint32_t size);
 void sys_mbox_post(sys_mbox_t mbox, void *msg);
+err_t sys_mbox_trypost(sys_mbox_t mbox, void *msg);
 uint16_t sys_arch_mbox_fetch(sys_mbox_t mbox, void **msg, uint16_t timeout);
 void sys_mbox_free(sys_mbox_t mbox);
 
@@ -99,7 +132,7 @@ void sys_thread_new(void (* thread)(void *arg), void *arg);
 
 /* The following functions are used only in Unix code, and
    can be omitted when porting the stack. */
-/* Returns the current time in microseconds. */
+/* Returns the current time in milliseconds, from a monotonic clock. */
 unsigned long sys_now(void);
 
 #endif /* __LWIP_SYS_H__ */
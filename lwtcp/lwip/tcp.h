@@ -54,9 +54,6 @@ struct tcp_pcb;
 /* Lower layer interface to TCP: */
 void             tcp_init    (void);  /* Must be called first to
 					 initialize TCP. */
-void             tcp_tmr     (void);  /* Must be called every
-					 TCP_TMR_INTERVAL
-					 ms. (Typically 100 ms). */
 /* Application program's interface: */
 struct tcp_pcb * tcp_new     (void);
 
@@ -91,10 +88,10 @@ err_t            tcp_close   (struct tcp_pcb *pcb);
 err_t            tcp_write   (struct tcp_pcb *pcb, const void *dataptr, uint16_t len,
 			      uint8_t copy);
 
-/* It is also possible to call these two functions at the right
-   intervals (instead of calling tcp_tmr()). */
-void             tcp_slowtmr (void);
-void             tcp_fasttmr (void);
+/* TCP keeps its timers with sys_timeout() per PCB, in the thread that
+   runs TCP (tcp_init() and everything after must happen there). */
+void             tcp_timers_update(struct tcp_pcb *pcb);
+void             tcp_timers_stop(struct tcp_pcb *pcb);
 
 
 /* Only used by IP to pass a TCP segment to TCP: */
@@ -120,9 +117,6 @@ err_t            tcp_output  (struct tcp_pcb *pcb);
 /* Length of the TCP header, excluding options. */
 #define TCP_HLEN 20
 
-#define TCP_TMR_INTERVAL       100  /* The TCP timer interval in
-				       milliseconds. */
-
 #define TCP_FAST_INTERVAL      200  /* the fine grained timeout in
 				       milliseconds */
 #define TCP_SLOW_INTERVAL      500  /* the coarse grained timeout in
@@ -191,7 +185,10 @@ struct tcp_pcb {
   uint16_t rcv_wnd;   /* receiver window */
 
   /* Timers */
-  uint16_t tmr;
+  uint32_t tmr;
+  struct sys_timeout *slowtmr, *fasttmr; /* running timers, or NULL */
+  uint32_t slowdue;   /* tick slowtmr is due at */
+  uint32_t slowlast;  /* tick slowtmr last ran at */
 
   /* Retransmission timer. */
   uint8_t rtime;
@@ -207,7 +204,7 @@ struct tcp_pcb {
 #define TF_GOT_FIN   0x20   /* Connection was closed by the remote end. */
   
   /* RTT estimation variables. */
-  uint16_t rttest; /* RTT estimate in 500ms ticks */
+  uint32_t rttest; /* RTT estimate in 500ms ticks */
   uint32_t rtseq;  /* sequence number being timed */
   int32_t sa, sv;
 
@@ -230,7 +227,7 @@ struct tcp_pcb {
     snd_lbb;      
 
   uint16_t snd_buf;   /* Avaliable buffer space for sending. */
-  uint8_t snd_queuelen;
+  uint16_t snd_queuelen;
 
   /* Function to be called when more send buffer space is avaliable. */
   err_t (* sent)(void *arg, struct tcp_pcb *pcb, uint16_t space);
@@ -315,7 +312,8 @@ void tcp_rst(uint32_t seqno, uint32_t ackno,
 
 uint32_t tcp_next_iss(void);
 
-extern uint32_t tcp_ticks;
+/* The coarse timer's clock, ticking every TCP_SLOW_INTERVAL ms. */
+#define tcp_ticks ((uint32_t)(sys_now() / TCP_SLOW_INTERVAL))
 
 #if TCP_DEBUG || TCP_INPUT_DEBUG || TCP_OUTPUT_DEBUG
 void tcp_debug_print(struct tcp_hdr *tcphdr);
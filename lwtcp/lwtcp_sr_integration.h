@@ -17,6 +17,7 @@
 #include "lwip/transport_subsys.h"
 
 uint32_t /*nbo*/ ip_route(struct ip_addr *dest);
+void sr_transport_input(uint8_t* packet /* borrowed */);
 err_t sr_lwip_output(struct pbuf *p,struct ip_addr *src, struct ip_addr *dst, uint8_t proto );
 
 #endif  /* LWTCP_SR_INTEGRATION_H */
@@ -38,17 +38,31 @@
  *
  * Memory manager.
  *
+ * The heap is cut into spans of MEM_SPAN_SIZE bytes.  A request of up
+ * to a quarter span is rounded up to one of the size classes (16 byte
+ * steps up to 128, then four steps per power of two) and served from
+ * a span given over to that class, so neither allocating nor freeing
+ * searches and nothing has to be coalesced: the span a block lies in
+ * tells its class.  Larger requests take runs of whole spans.
+ *
+ * Every thread keeps up to MEM_CACHE_SIZE free blocks of each class
+ * for itself and only takes the heap lock to move half that many at
+ * once between its cache and the spans.
+ *
  */
 /*-----------------------------------------------------------------------------------*/
 #include "lwip/debug.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "lwip/arch.h"
 #include "lwip/opt.h"
 #include "lwip/def.h"
 #include "lwip/mem.h"
+#include "lwip/conf.h"
 
 #include "lwip/sys.h"
 
@@ -62,25 +76,51 @@ struct mem_reclaim_ {
 };
 #endif /* MEM_RECLAIM */
 
-struct mem {
-  mem_size_t next, prev;
-  uint8_t used;
-#if MEM_ALIGNMENT == 2
-  uint8_t dummy;
-#endif /* MEM_ALIGNEMNT == 2 */
+#define MEM_GRAIN       16
+#define MEM_SMALL_MAX   (MEM_SPAN_SIZE / 4)
+#define MEM_CLASSES_MAX 64
+#define MEM_BATCH       (MEM_CACHE_SIZE > 1 ? MEM_CACHE_SIZE / 2 : 1)
+
+/* mem_span.cls of spans that don't belong to a size class */
+#define MEM_SPAN_FREE   0xff
+#define MEM_SPAN_LARGE  0xfe  /* first span of a large block */
+#define MEM_SPAN_TAIL   0xfd  /* rest of a large block */
+
+struct mem_block {
+  struct mem_block *next;
 };
 
-static struct mem *ram_end;
-static uint8_t ram[MEM_ALIGN_SIZE(MEM_SIZE + sizeof(struct mem))];
+struct mem_span {
+  struct mem_span *next, *prev;  /* spans of the class with free blocks */
+  struct mem_block *free;
+  uint32_t used;     /* blocks out, thread caches included */
+  uint32_t carved;   /* blocks handed out at least once */
+  uint32_t run;      /* spans in a large block */
+  uint8_t cls;
+};
 
-#define MIN_SIZE 12
-#define SIZEOF_STRUCT_MEM MEM_ALIGN_SIZE(sizeof(struct mem))
-/*#define SIZEOF_STRUCT_MEM (sizeof(struct mem) + \
-                          (((sizeof(struct mem) % MEM_ALIGNMENT) == 0)? 0 : \
-                          (4 - (sizeof(struct mem) % MEM_ALIGNMENT))))*/
+struct mem_class {
+  mem_size_t size;
+  uint32_t per_span;
+  struct mem_span *partial;
+};
+
+struct mem_cache {
+  struct mem_block *free[MEM_CLASSES_MAX];
+  uint16_t n[MEM_CLASSES_MAX];
+  int registered;
+};
 
+/* -- mapped by mem_init(), lwip_conf.mem_size of heap -- */
+static uint8_t *ram;
+static uint8_t *ram_end;
+static struct mem_span *spans;
+static uint64_t *spanmap;   /* bit set: span is free */
+static uint32_t nspans;
 
-static struct mem *lfree;   /* pointer to the lowest free block */
+static struct mem_class classes[MEM_CLASSES_MAX];
+static uint8_t nclasses;
+static uint8_t class_of[MEM_SMALL_MAX / MEM_GRAIN + 1];  /* by grains */
 
 #if MEM_RECLAIM
 static struct mem_reclaim_ *mrlist;
@@ -88,68 +128,279 @@ static struct mem_reclaim_ *mrlist;
 
 static sys_sem_t mem_sem;
 
+#if MEM_CACHE_SIZE
+static __thread struct mem_cache cache;
+static pthread_key_t cache_key;   /* flushes the cache of an exiting thread */
+#endif /* MEM_CACHE_SIZE */
+
+#define SPAN_OF(p) (&spans[((uint8_t *)(p) - ram) / MEM_SPAN_SIZE])
+#define SPAN_ISFREE(i) (spanmap[(i) / 64] & (1ULL << ((i) % 64)))
+
 /*-----------------------------------------------------------------------------------*/
-static void
-plug_holes(struct mem *mem)
+/* Takes n free spans in a row off the span map, -1 if there aren't any. */
+static int
+span_get(uint32_t n)
 {
-  struct mem *nmem;
-  struct mem *pmem;
-
-  ASSERT("plug_holes: mem >= ram", (uint8_t *)mem >= ram);
-  ASSERT("plug_holes: mem < ram_end", (uint8_t *)mem < (uint8_t *)ram_end);
-  ASSERT("plug_holes: mem->used == 0", mem->used == 0);
-  
-  /* plug hole forward */
-  ASSERT("plug_holes: mem->next <= MEM_SIZE", mem->next <= MEM_SIZE);
-  
-  nmem = (struct mem *)&ram[mem->next];
-  if(mem != nmem && nmem->used == 0 && (uint8_t *)nmem != (uint8_t *)ram_end) {
-    if(lfree == nmem) {
-      lfree = mem;
+  uint32_t i, j, w;
+
+  if(n == 1) {
+    for(w = 0; w < (nspans + 63) / 64; w++) {
+      if(spanmap[w] != 0) {
+        i = w * 64 + __builtin_ctzll(spanmap[w]);
+        spanmap[w] &= spanmap[w] - 1;
+        return i;
+      }
     }
-    mem->next = nmem->next;
-    ((struct mem *)&ram[nmem->next])->prev = (uint8_t *)mem - ram;
+    return -1;
   }
 
-  /* plug hole backward */
-  pmem = (struct mem *)&ram[mem->prev];
-  if(pmem != mem && pmem->used == 0) {
-    if(lfree == mem) {
-      lfree = pmem;
+  for(i = 0; i + n <= nspans; i = j + 1) {
+    for(j = i; j < i + n && SPAN_ISFREE(j); j++);
+    if(j == i + n) {
+      for(j = i; j < i + n; j++) {
+        spanmap[j / 64] &= ~(1ULL << (j % 64));
+        spans[j].cls = MEM_SPAN_TAIL;
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+span_put(uint32_t i, uint32_t n)
+{
+  for(; n > 0; i++, n--) {
+    spans[i].cls = MEM_SPAN_FREE;
+    spanmap[i / 64] |= 1ULL << (i % 64);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+span_link(struct mem_class *c, struct mem_span *s)
+{
+  s->prev = NULL;
+  s->next = c->partial;
+  if(c->partial != NULL) {
+    c->partial->prev = s;
+  }
+  c->partial = s;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+span_unlink(struct mem_class *c, struct mem_span *s)
+{
+  if(s->prev != NULL) {
+    s->prev->next = s->next;
+  } else {
+    c->partial = s->next;
+  }
+  if(s->next != NULL) {
+    s->next->prev = s->prev;
+  }
+  s->next = s->prev = NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Takes a block of class cls from its spans, with mem_sem held. */
+static struct mem_block *
+slab_get(uint8_t cls)
+{
+  struct mem_class *c;
+  struct mem_span *s;
+  struct mem_block *b;
+  int i;
+
+  c = &classes[cls];
+  s = c->partial;
+  if(s == NULL) {
+    if((i = span_get(1)) < 0) {
+      return NULL;
     }
-    pmem->next = mem->next;
-    ((struct mem *)&ram[mem->next])->prev = (uint8_t *)pmem - ram;
+    s = &spans[i];
+    s->cls = cls;
+    s->free = NULL;
+    s->used = s->carved = 0;
+    s->run = 1;
+    span_link(c, s);
+  }
+
+  if(s->free != NULL) {
+    b = s->free;
+    s->free = b->next;
+  } else {
+    b = (struct mem_block *)&ram[(s - spans) * MEM_SPAN_SIZE +
+                                 s->carved * c->size];
+    ++s->carved;
   }
+  ++s->used;
+  if(s->free == NULL && s->carved == c->per_span) {
+    span_unlink(c, s);
+  }
+  return b;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Gives a block back to its span, with mem_sem held.  A span left
+   with no block out goes back to the span map unless it is the only
+   one its class has room in. */
+static void
+slab_put(struct mem_block *b)
+{
+  struct mem_class *c;
+  struct mem_span *s;
 
+  s = SPAN_OF(b);
+  c = &classes[s->cls];
+  if(s->free == NULL && s->carved == c->per_span) {
+    span_link(c, s);
+  }
+  b->next = s->free;
+  s->free = b;
+  --s->used;
+  if(s->used == 0 && (s->prev != NULL || s->next != NULL)) {
+    span_unlink(c, s);
+    span_put(s - spans, 1);
+  }
 }
 /*-----------------------------------------------------------------------------------*/
+#if MEM_CACHE_SIZE
+/* Gives n blocks of class cls from a thread cache back to the spans. */
+static void
+cache_drain(struct mem_cache *mc, uint8_t cls, uint16_t n)
+{
+  struct mem_block *b;
+
+  if(n > mc->n[cls]) {
+    n = mc->n[cls];
+  }
+  if(n == 0) {
+    return;
+  }
+  sys_arch_sem_wait(mem_sem, 0);
+#ifdef MEM_STATS
+  stats.mem.used -= n * classes[cls].size;
+#endif /* MEM_STATS */
+  mc->n[cls] -= n;
+  for(; n > 0; n--) {
+    b = mc->free[cls];
+    mc->free[cls] = b->next;
+    slab_put(b);
+  }
+  sys_sem_signal(mem_sem);
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+cache_flush(void *arg)
+{
+  struct mem_cache *mc;
+  uint8_t cls;
+
+  mc = (struct mem_cache *)arg;
+  for(cls = 0; cls < nclasses; cls++) {
+    cache_drain(mc, cls, mc->n[cls]);
+  }
+  /* Register again if the thread frees anything after this. */
+  mc->registered = 0;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+cache_register(void)
+{
+  /* Have the cache flushed when the thread exits. */
+  pthread_setspecific(cache_key, &cache);
+  cache.registered = 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Takes a block of class cls for the thread's empty cache, and a batch
+   more to keep in it. */
+static struct mem_block *
+cache_fill(uint8_t cls)
+{
+  struct mem_block *b, *more;
+  uint16_t n;
+
+  if(!cache.registered) {
+    cache_register();
+  }
+
+  sys_arch_sem_wait(mem_sem, 0);
+  b = slab_get(cls);
+  if(b == NULL) {
+    DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n",
+                       (int)classes[cls].size));
+#ifdef MEM_STATS
+    ++stats.mem.err;
+#endif /* MEM_STATS */
+    sys_sem_signal(mem_sem);
+    return NULL;
+  }
+  for(n = 1; n < MEM_BATCH && (more = slab_get(cls)) != NULL; n++) {
+    more->next = cache.free[cls];
+    cache.free[cls] = more;
+  }
+  cache.n[cls] += n - 1;
+#ifdef MEM_STATS
+  stats.mem.used += n * classes[cls].size;
+  if(stats.mem.max < stats.mem.used) {
+    stats.mem.max = stats.mem.used;
+  }
+#endif /* MEM_STATS */
+  sys_sem_signal(mem_sem);
+  return b;
+}
+#endif /* MEM_CACHE_SIZE */
+/*-----------------------------------------------------------------------------------*/
 void
 mem_init(void)
 {
-  struct mem *mem;
-
-  bzero(ram, MEM_SIZE);
-  mem = (struct mem *)ram;
-  mem->next = MEM_SIZE;
-  mem->prev = 0;
-  mem->used = 0;
-  ram_end = (struct mem *)&ram[MEM_SIZE];
-  ram_end->used = 1;
-  ram_end->next = MEM_SIZE;
-  ram_end->prev = MEM_SIZE;
-
-  fflush(stdout);
+  mem_size_t size, step, g;
+  uint8_t cls;
+
+  /* 16 byte steps up to 128, then four per power of two. */
+  nclasses = 0;
+  for(size = MEM_GRAIN; size <= MEM_SMALL_MAX; size += step) {
+    ASSERT("mem_init: too many size classes", nclasses < MEM_CLASSES_MAX);
+    classes[nclasses].size = size;
+    classes[nclasses].per_span = MEM_SPAN_SIZE / size;
+    classes[nclasses].partial = NULL;
+    ++nclasses;
+    for(step = 1; step * 2 <= size; step *= 2);
+    step = size < 128 ? MEM_GRAIN : step / 4;
+  }
+  for(g = 0, cls = 0; g <= MEM_SMALL_MAX / MEM_GRAIN; g++) {
+    while(classes[cls].size < g * MEM_GRAIN) {
+      ++cls;
+    }
+    class_of[g] = cls;
+  }
+
+  /* The heap, then the spans and the span map. */
+  nspans = lwip_conf.mem_size / MEM_SPAN_SIZE;
+  ram = (uint8_t *)lwip_conf_map((size_t)nspans * MEM_SPAN_SIZE +
+                                 nspans * sizeof(struct mem_span) +
+                                 (nspans + 63) / 64 * sizeof(uint64_t));
+  if(ram == NULL) {
+    fprintf(stderr, "mem_init: could not map %lu bytes of heap\n",
+            (unsigned long)lwip_conf.mem_size);
+    abort();
+  }
+  ram_end = ram + (size_t)nspans * MEM_SPAN_SIZE;
+  spans = (struct mem_span *)ram_end;
+  spanmap = (uint64_t *)(spans + nspans);
+  span_put(0, nspans);
+
   mem_sem = sys_sem_new(1);
   assert(mem_sem);
 
-  lfree = (struct mem *)ram;
+#if MEM_CACHE_SIZE
+  pthread_key_create(&cache_key, cache_flush);
+#endif /* MEM_CACHE_SIZE */
 
 #if MEM_RECLAIM
   mrlist = NULL;
 #endif /* MEM_RECLAIM */
   
 #ifdef MEM_STATS
-  stats.mem.avail = (uint16_t)MEM_SIZE;
+  stats.mem.avail = (uint16_t)lwip_conf.mem_size;
 #endif /* MEM_STATS */
 }
 /*-----------------------------------------------------------------------------------*/
@@ -166,6 +417,10 @@ mem_reclaim(unsigned int size)
     DEBUGF(MEM_DEBUG, ("mem_malloc: calling reclaimer\n"));
     rec += mr->f(mr->arg, size);
   }
+#if MEM_CACHE_SIZE
+  /* What was freed may sit in this thread's cache, in the wrong class. */
+  cache_flush(&cache);
+#endif /* MEM_CACHE_SIZE */
 #ifdef MEM_STATS
   stats.mem.reclaimed += rec;
 #endif /* MEM_STATS */
@@ -186,121 +441,136 @@ mem_malloc2(mem_size_t size)
   return mem;
 }
 /*-----------------------------------------------------------------------------------*/
-void *
-mem_malloc(mem_size_t size)
+static void *
+mem_malloc_large(mem_size_t size)
 {
-  mem_size_t ptr, ptr2;
-  struct mem *mem, *mem2;
+  uint32_t n;
+  int i;
 
-  if(size == 0) {
+  if(size > (size_t)(ram_end - ram)) {
     return NULL;
   }
+  n = (size + MEM_SPAN_SIZE - 1) / MEM_SPAN_SIZE;
 
-  /* Expand the size of the allocated memory region so that we can
-     adjust for alignment. */
-  if((size % MEM_ALIGNMENT) != 0) {
-    size += MEM_ALIGNMENT - ((size + SIZEOF_STRUCT_MEM) % MEM_ALIGNMENT);
-  }
-  
-  if(size > MEM_SIZE) {
+  sys_arch_sem_wait(mem_sem, 0);
+  if((i = span_get(n)) < 0) {
+    DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
+#ifdef MEM_STATS
+    ++stats.mem.err;
+#endif /* MEM_STATS */
+    sys_sem_signal(mem_sem);
     return NULL;
   }
-  
-  sys_sem_wait(mem_sem);
-
-  for(ptr = (uint8_t *)lfree - ram; ptr < MEM_SIZE; ptr = ((struct mem *)&ram[ptr])->next) {
-    mem = (struct mem *)&ram[ptr];
-    if(!mem->used &&
-       mem->next - (ptr + SIZEOF_STRUCT_MEM) >= size + SIZEOF_STRUCT_MEM) {
-      ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
-      mem2 = (struct mem *)&ram[ptr2];
-
-      mem2->prev = ptr;      
-      mem2->next = mem->next;
-      mem->next = ptr2;      
-      if(mem2->next != MEM_SIZE) {
-        ((struct mem *)&ram[mem2->next])->prev = ptr2;
-      }
-      
-      mem2->used = 0;      
-      mem->used = 1;
+  spans[i].cls = MEM_SPAN_LARGE;
+  spans[i].run = n;
 #ifdef MEM_STATS
-      stats.mem.used += size;
-      /*      if(stats.mem.max < stats.mem.used) {
-        stats.mem.max = stats.mem.used;
-	} */
-      if(stats.mem.max < ptr2) {
-        stats.mem.max = ptr2;
-      }      
-#ifdef MEM_PERF
-      mem_perf_output();
-#endif /* MEM_PERF */  
+  stats.mem.used += n * MEM_SPAN_SIZE;
+  if(stats.mem.max < stats.mem.used) {
+    stats.mem.max = stats.mem.used;
+  }
 #endif /* MEM_STATS */
+  sys_sem_signal(mem_sem);
+  return &ram[i * MEM_SPAN_SIZE];
+}
+/*-----------------------------------------------------------------------------------*/
+void *
+mem_malloc(mem_size_t size)
+{
+  struct mem_block *b;
+  uint8_t cls;
 
-      if(mem == lfree) {
-	/* Find next free block after mem */
-        while(lfree->used && lfree != ram_end) {
-	  lfree = (struct mem *)&ram[lfree->next];
-        }
-        ASSERT("mem_malloc: !lfree->used", !lfree->used);
-      }
-      sys_sem_signal(mem_sem);
-      ASSERT("mem_malloc: allocated memory not above ram_end.",
-	     (uint32_t)mem + SIZEOF_STRUCT_MEM + size <= (uint32_t)ram_end);
-      ASSERT("mem_malloc: allocated memory properly aligned.",
-	     (unsigned long)((uint8_t *)mem + SIZEOF_STRUCT_MEM) % MEM_ALIGNMENT == 0);
-      return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
-    }    
-  }
-  DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
+  if(size == 0) {
+    return NULL;
+  }
+  if(size > MEM_SMALL_MAX) {
+    return mem_malloc_large(size);
+  }
+  cls = class_of[(size + MEM_GRAIN - 1) / MEM_GRAIN];
+
+#if MEM_CACHE_SIZE
+  b = cache.free[cls];
+  if(b != NULL) {
+    cache.free[cls] = b->next;
+    --cache.n[cls];
+    return b;
+  }
+  b = cache_fill(cls);
+#else
+  sys_arch_sem_wait(mem_sem, 0);
+  b = slab_get(cls);
 #ifdef MEM_STATS
-  ++stats.mem.err;
-#endif /* MEM_STATS */  
+  if(b == NULL) {
+    ++stats.mem.err;
+  } else {
+    stats.mem.used += classes[cls].size;
+    if(stats.mem.max < stats.mem.used) {
+      stats.mem.max = stats.mem.used;
+    }
+  }
+#endif /* MEM_STATS */
   sys_sem_signal(mem_sem);
-  return NULL;
+#endif /* MEM_CACHE_SIZE */
+
+  ASSERT("mem_malloc: allocated memory properly aligned.",
+         (unsigned long)b % MEM_ALIGNMENT == 0);
+  return b;
 }
 /*-----------------------------------------------------------------------------------*/
 void
 mem_free(void *rmem)
 {
-  struct mem *mem;
+  struct mem_span *s;
+  struct mem_block *b;
+  uint8_t cls;
 
   if(rmem == NULL) {
     return;
   }
-  
-  sys_sem_wait(mem_sem);
 
-  ASSERT("mem_free: legal memory", (uint8_t *)rmem >= (uint8_t *)ram &&
-	 (uint8_t *)rmem < (uint8_t *)ram_end);
-  
+  ASSERT("mem_free: legal memory", (uint8_t *)rmem >= ram &&
+	 (uint8_t *)rmem < ram_end);
   
-  if((uint8_t *)rmem < (uint8_t *)ram || (uint8_t *)rmem >= (uint8_t *)ram_end) {
+  if((uint8_t *)rmem < ram || (uint8_t *)rmem >= ram_end) {
     DEBUGF(MEM_DEBUG, ("mem_free: illegal memory\n"));
 #ifdef MEM_STATS
     ++stats.mem.err;
 #endif /* MEM_STATS */
     return;
   }
-  mem = (struct mem *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
+  s = SPAN_OF(rmem);
+  cls = s->cls;
 
-  ASSERT("mem_free: mem->used", mem->used);
-  
-  mem->used = 0;
+  if(cls == MEM_SPAN_LARGE) {
+    ASSERT("mem_free: start of the block",
+           ((uint8_t *)rmem - ram) % MEM_SPAN_SIZE == 0);
+    sys_arch_sem_wait(mem_sem, 0);
+#ifdef MEM_STATS
+    stats.mem.used -= s->run * MEM_SPAN_SIZE;
+#endif /* MEM_STATS */
+    span_put(s - spans, s->run);
+    sys_sem_signal(mem_sem);
+    return;
+  }
+  ASSERT("mem_free: mem->used", cls < nclasses);
 
-  if(mem < lfree) {
-    lfree = mem;
+  b = (struct mem_block *)rmem;
+#if MEM_CACHE_SIZE
+  if(!cache.registered) {
+    cache_register();
   }
-  
+  b->next = cache.free[cls];
+  cache.free[cls] = b;
+  if(++cache.n[cls] > MEM_CACHE_SIZE) {
+    cache_drain(&cache, cls, MEM_BATCH);
+  }
+#else
+  sys_arch_sem_wait(mem_sem, 0);
 #ifdef MEM_STATS
-  stats.mem.used -= mem->next - ((uint8_t *)mem - ram) - SIZEOF_STRUCT_MEM;
-#ifdef MEM_PERF
-  mem_perf_output();
-#endif /* MEM_PERF */
-  
+  stats.mem.used -= classes[cls].size;
 #endif /* MEM_STATS */
-  plug_holes(mem);
+  slab_put(b);
   sys_sem_signal(mem_sem);
+#endif /* MEM_CACHE_SIZE */
 }
 /*-----------------------------------------------------------------------------------*/
 void *
@@ -316,48 +586,39 @@ mem_reallocm(void *rmem, mem_size_t newsize)
   return nmem;
 }
 /*-----------------------------------------------------------------------------------*/
+/* Shrinks a block in place.  A block of a size class keeps its size,
+   a large one gives back the spans past newsize. */
 void *
 mem_realloc(void *rmem, mem_size_t newsize)
 {
-  mem_size_t size;
-  mem_size_t ptr, ptr2;
-  struct mem *mem, *mem2;
+  struct mem_span *s;
+  uint32_t n;
   
-  sys_sem_wait(mem_sem);
+  ASSERT("mem_realloc: legal memory", (uint8_t *)rmem >= ram &&
+	 (uint8_t *)rmem < ram_end);
   
-  ASSERT("mem_realloc: legal memory", (uint8_t *)rmem >= (uint8_t *)ram &&
-	 (uint8_t *)rmem < (uint8_t *)ram_end);
-  
-  if((uint8_t *)rmem < (uint8_t *)ram || (uint8_t *)rmem >= (uint8_t *)ram_end) {
+  if((uint8_t *)rmem < ram || (uint8_t *)rmem >= ram_end) {
     DEBUGF(MEM_DEBUG, ("mem_free: illegal memory\n"));
     return rmem;
   }
-  mem = (struct mem *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
-
-  ptr = (uint8_t *)mem - ram;
+  s = SPAN_OF(rmem);
+  if(s->cls != MEM_SPAN_LARGE) {
+    return rmem;
+  }
 
-  size = mem->next - ptr - SIZEOF_STRUCT_MEM;
+  n = (newsize + MEM_SPAN_SIZE - 1) / MEM_SPAN_SIZE;
+  if(n == 0) {
+    n = 1;
+  }
+  if(n < s->run) {
+    sys_arch_sem_wait(mem_sem, 0);
 #ifdef MEM_STATS
-  stats.mem.used -= (size - newsize);
-#ifdef MEM_PERF
-  mem_perf_output();
-#endif /* MEM_PERF */ 
+    stats.mem.used -= (s->run - n) * MEM_SPAN_SIZE;
 #endif /* MEM_STATS */
-  
-  if(newsize + SIZEOF_STRUCT_MEM + MIN_SIZE < size) {
-    ptr2 = ptr + SIZEOF_STRUCT_MEM + newsize;
-    mem2 = (struct mem *)&ram[ptr2];
-    mem2->used = 0;
-    mem2->next = mem->next;
-    mem2->prev = ptr;
-    mem->next = ptr2;
-    if(mem2->next != MEM_SIZE) {
-      ((struct mem *)&ram[mem2->next])->prev = ptr2;
-    }
-
-    plug_holes(mem2);
+    span_put(s - spans + n, s->run - n);
+    s->run = n;
+    sys_sem_signal(mem_sem);
   }
-  sys_sem_signal(mem_sem);  
   return rmem;
 }
 /*-----------------------------------------------------------------------------------*/
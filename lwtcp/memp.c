@@ -33,9 +33,14 @@
  * $Id: memp.c 301 2005-04-06 17:03:23Z casado $
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
 #include "lwip/lwipopts.h"
 
 #include "lwip/memp.h"
+#include "lwip/conf.h"
 
 #include "lwip/pbuf.h"
 #include "lwip/udp.h"
@@ -51,9 +56,27 @@ struct memp {
   struct memp *next;
 };
 
+/* Every thread keeps a magazine of free elements of each pool and only
+   takes the pools' lock to refill it or to give back half of it at
+   once.  A magazine holds at most an eighth of its pool (and no more
+   than MEMP_MAGAZINE_SIZE).  Nothing takes elements back from another
+   thread's magazine, so pools of fewer than MEMP_MAGAZINE_MIN_NUM
+   elements (api messages, netbufs, ..), where a few idle magazines
+   would empty the pool, have none and always take the lock. */
+#define MEMP_MAGAZINE_SHARE   8
+#define MEMP_MAGAZINE_MIN_NUM 64
 
+struct memp_magazine {
+  struct memp *top[MEMP_MAX];
+  uint16_t n[MEMP_MAX];
+  int registered;
+};
 
 static struct memp *memp_tab[MEMP_MAX];
+static uint16_t memp_cap[MEMP_MAX];    /* magazine size of each pool */
+
+static __thread struct memp_magazine magazine;
+static pthread_key_t magazine_key;     /* empties it when the thread exits */
 
 static const uint16_t memp_sizes[MEMP_MAX] = {
   sizeof(struct pbuf),
@@ -68,49 +91,8 @@ static const uint16_t memp_sizes[MEMP_MAX] = {
   sizeof(struct sys_timeout)
 };
 
-static const uint16_t memp_num[MEMP_MAX] = {
-  MEMP_NUM_PBUF,
-  MEMP_NUM_UDP_PCB,
-  MEMP_NUM_TCP_PCB,
-  MEMP_NUM_TCP_PCB_LISTEN,
-  MEMP_NUM_TCP_SEG,
-  MEMP_NUM_NETBUF,
-  MEMP_NUM_NETCONN,
-  MEMP_NUM_API_MSG,
-  MEMP_NUM_TCPIP_MSG,
-  MEMP_NUM_SYS_TIMEOUT
-};
-
-static uint8_t memp_memory[(MEMP_NUM_PBUF *
-			 MEM_ALIGN_SIZE(sizeof(struct pbuf) +
-					sizeof(struct memp)) +
-			MEMP_NUM_UDP_PCB *
-			 MEM_ALIGN_SIZE(sizeof(struct udp_pcb) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCP_PCB *
-			 MEM_ALIGN_SIZE(sizeof(struct tcp_pcb) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCP_PCB_LISTEN *
-			 MEM_ALIGN_SIZE(sizeof(struct tcp_pcb_listen) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCP_SEG *
-			 MEM_ALIGN_SIZE(sizeof(struct tcp_seg) +
-					sizeof(struct memp)) +
-			MEMP_NUM_NETBUF *
-			 MEM_ALIGN_SIZE(sizeof(struct netbuf) +
-					sizeof(struct memp)) +
-			MEMP_NUM_NETCONN *
-			 MEM_ALIGN_SIZE(sizeof(struct netconn) +
-					sizeof(struct memp)) +
-			MEMP_NUM_API_MSG *
-			 MEM_ALIGN_SIZE(sizeof(struct api_msg) +
-					sizeof(struct memp)) +
-			MEMP_NUM_TCPIP_MSG *
-			 MEM_ALIGN_SIZE(sizeof(struct tcpip_msg) +
-					sizeof(struct memp)) +
-			MEMP_NUM_SYS_TIMEOUT *
-			 MEM_ALIGN_SIZE(sizeof(struct sys_timeout) +
-					sizeof(struct memp)))];
+/* The pools one after the other, mapped by memp_init(). */
+static uint8_t *memp_memory;
 
 #if MEMP_RECLAIM
 struct memp_reclaim_ {
@@ -126,6 +108,8 @@ static uint8_t memp_reclaim(memp_t type);
 
 /*-----------------------------------------------------------------------------------*/
 static sys_sem_t mutex;
+
+static void magazine_flush(void *arg);
 /*-----------------------------------------------------------------------------------*/
 #ifdef LWIP_DEBUG
 static int
@@ -156,6 +140,10 @@ memp_init(void)
     struct memp *m, *memp;
     uint16_t i, j;
     uint16_t size;
+    const uint16_t *memp_num;
+    size_t total;
+
+    memp_num = lwip_conf.memp_num;
 
 #ifdef MEMP_STATS
     for(i = 0; i < MEMP_MAX; ++i) {
@@ -165,6 +153,17 @@ memp_init(void)
     }
 #endif /* MEMP_STATS */
 
+    total = 0;
+    for(i = 0; i < MEMP_MAX; ++i) {
+        total += (size_t)memp_num[i] *
+                 MEM_ALIGN_SIZE(memp_sizes[i] + sizeof(struct memp));
+    }
+    if((memp_memory = (uint8_t *)lwip_conf_map(total)) == NULL) {
+        fprintf(stderr, "memp_init: could not map %lu bytes of pools\n",
+                (unsigned long)total);
+        abort();
+    }
+
     memp = (struct memp *)&memp_memory[0];
     for(i = 0; i < MEMP_MAX; ++i) {
         size = MEM_ALIGN_SIZE(memp_sizes[i] + sizeof(struct memp));
@@ -182,9 +181,19 @@ memp_init(void)
         } else {
             memp_tab[i] = NULL;
         }
+
+        if(memp_num[i] < MEMP_MAGAZINE_MIN_NUM) {
+            memp_cap[i] = 0;
+        } else {
+            memp_cap[i] = memp_num[i] / MEMP_MAGAZINE_SHARE;
+        }
+        if(memp_cap[i] > MEMP_MAGAZINE_SIZE) {
+            memp_cap[i] = MEMP_MAGAZINE_SIZE;
+        }
     }
 
     mutex = sys_sem_new(1);
+    pthread_key_create(&magazine_key, magazine_flush);
 
 #if MEMP_RECLAIM
     for(i = 0; i < MEMP_MAX; ++i) {
@@ -194,46 +203,118 @@ memp_init(void)
 
 }
 /*-----------------------------------------------------------------------------------*/
-void *
-memp_malloc(memp_t type)
+/* Takes up to n elements off pool type onto a list, with mutex held. */
+static struct memp *
+memp_get(memp_t type, uint16_t *n)
 {
-    struct memp *memp;
-
-    ASSERT("memp_malloc: type < MEMP_MAX", type < MEMP_MAX);
+    struct memp *list, *memp;
+    uint16_t i;
 
-    memp = memp_tab[type];
+    list = NULL;
+    for(i = 0; i < *n && (memp = memp_tab[type]) != NULL; ++i) {
+        memp_tab[type] = memp->next;
+        memp->next = list;
+        list = memp;
+    }
+    *n = i;
 
-    if(memp != NULL) 
-    {    
-        memp_tab[type] = memp->next;    
-        memp->next = NULL;
 #ifdef MEMP_STATS
-        ++stats.memp[type].used;
-        if(stats.memp[type].used > stats.memp[type].max) {
-            stats.memp[type].max = stats.memp[type].used;
-        }
+    if(i == 0) {
+        ++stats.memp[type].err;
+    }
+    stats.memp[type].used += i;
+    if(stats.memp[type].used > stats.memp[type].max) {
+        stats.memp[type].max = stats.memp[type].used;
+    }
 #endif /* MEMP_STATS */
-        ASSERT("memp_malloc: memp properly aligned",
-                ((uint32_t)MEM_ALIGN((uint8_t *)memp + sizeof(struct memp)) % MEM_ALIGNMENT) == 0);
+    return list;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Gives n elements of a list back to pool type, with mutex held. */
+static struct memp *
+memp_put(memp_t type, struct memp *list, uint16_t n)
+{
+    struct memp *memp;
+    uint16_t i;
 
-        return MEM_ALIGN((uint8_t *)memp + sizeof(struct memp));
-    } else {
-        DEBUGF(MEMP_DEBUG, ("memp_malloc: out of memory in pool %d\n", type));
+    for(i = 0; i < n; ++i) {
+        memp = list;
+        list = memp->next;
+        memp->next = memp_tab[type];
+        memp_tab[type] = memp;
+    }
 #ifdef MEMP_STATS
-        ++stats.memp[type].err;
+    stats.memp[type].used -= n;
 #endif /* MEMP_STATS */
-        return NULL;
+
+    ASSERT("memp sanity", memp_sanity());
+    return list;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+magazine_register(void)
+{
+    /* Have the magazine emptied when the thread exits. */
+    pthread_setspecific(magazine_key, &magazine);
+    magazine.registered = 1;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+magazine_flush(void *arg)
+{
+    struct memp_magazine *mag;
+    uint16_t i;
+
+    mag = (struct memp_magazine *)arg;
+    sys_arch_sem_wait(mutex, 0);
+    for(i = 0; i < MEMP_MAX; ++i) {
+        mag->top[i] = memp_put(i, mag->top[i], mag->n[i]);
+        mag->n[i] = 0;
+    }
+    sys_sem_signal(mutex);
+    mag->registered = 0;
+}
+/*-----------------------------------------------------------------------------------*/
+void *
+memp_malloc(memp_t type)
+{
+    struct memp *memp;
+    uint16_t n;
+
+    ASSERT("memp_malloc: type < MEMP_MAX", type < MEMP_MAX);
+
+    memp = magazine.top[type];
+    if(memp != NULL) {
+        magazine.top[type] = memp->next;
+        --magazine.n[type];
+    } else {
+        if(memp_cap[type] > 0 && !magazine.registered) {
+            magazine_register();
+        }
+        /* One for the caller, the rest to half fill the magazine. */
+        n = memp_cap[type] / 2 + 1;
+        sys_arch_sem_wait(mutex, 0);
+        memp = memp_get(type, &n);
+        sys_sem_signal(mutex);
+        if(memp == NULL) {
+            DEBUGF(MEMP_DEBUG, ("memp_malloc: out of memory in pool %d\n", type));
+            return NULL;
+        }
+        magazine.top[type] = memp->next;
+        magazine.n[type] = n - 1;
     }
+    memp->next = NULL;
+
+    ASSERT("memp_malloc: memp properly aligned",
+           ((uint32_t)MEM_ALIGN((uint8_t *)memp + sizeof(struct memp)) % MEM_ALIGNMENT) == 0);
+
+    return MEM_ALIGN((uint8_t *)memp + sizeof(struct memp));
 }
 /*-----------------------------------------------------------------------------------*/
 void *
 memp_mallocp(memp_t type)
 {
-  void *mem;
-  sys_sem_wait(mutex);
-  mem = memp_malloc(type);
-  sys_sem_signal(mutex);
-  return mem;
+  return memp_malloc(type);
 }
 /*-----------------------------------------------------------------------------------*/
 void *
@@ -277,29 +358,31 @@ void
 memp_free(memp_t type, void *mem)
 {
   struct memp *memp;
+  uint16_t n;
 
   if(mem == NULL) {
     return;
   }
   memp = (struct memp *)((uint8_t *)mem - sizeof(struct memp));
 
-#ifdef MEMP_STATS
-  stats.memp[type].used--; 
-#endif /* MEMP_STATS */
-  
-  memp->next = memp_tab[type]; 
-  memp_tab[type] = memp;
-
-  ASSERT("memp sanity", memp_sanity());
-  return;
+  if(memp_cap[type] > 0 && !magazine.registered) {
+    magazine_register();
+  }
+  memp->next = magazine.top[type];
+  magazine.top[type] = memp;
+  if(++magazine.n[type] > memp_cap[type]) {
+    n = magazine.n[type] - memp_cap[type] / 2;
+    sys_arch_sem_wait(mutex, 0);
+    magazine.top[type] = memp_put(type, magazine.top[type], n);
+    sys_sem_signal(mutex);
+    magazine.n[type] -= n;
+  }
 }
 /*-----------------------------------------------------------------------------------*/
 void 
 memp_freep(memp_t type, void *mem)
 {
-  sys_sem_wait(mutex);
   memp_free(type, mem);
-  sys_sem_signal(mutex);
 }
 /*-----------------------------------------------------------------------------------*/
 #if MEMP_RECLAIM
@@ -49,10 +49,11 @@
 #include "lwip/mem.h"
 #include "lwip/memp.h"
 #include "lwip/pbuf.h"
+#include "lwip/conf.h"
 
 #include "lwip/sys.h"
 
-static uint8_t pbuf_pool_memory[(PBUF_POOL_SIZE * MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE + sizeof(struct pbuf)))];
+static uint8_t *pbuf_pool_memory;   /* lwip_conf.pbuf_pool_size buffers */
 static volatile uint8_t pbuf_pool_free_lock, pbuf_pool_alloc_lock;
 static sys_sem_t pbuf_pool_free_sem;
 static struct pbuf *pbuf_pool = NULL;
@@ -76,21 +77,30 @@ void
 pbuf_init(void)
 {
   struct pbuf *p, *q;
-  uint8_t i;
+  uint16_t i;
 
+  pbuf_pool_memory = NULL;
+  if(lwip_conf.pbuf_pool_alloc != NULL) {
+    pbuf_pool_memory = (uint8_t *)lwip_conf.pbuf_pool_alloc(pbuf_pool_memsize());
+  }
+  if(pbuf_pool_memory == NULL) {
+    pbuf_pool_memory = (uint8_t *)lwip_conf_map(pbuf_pool_memsize());
+  }
+  ASSERT("pbuf_init: pool mapped", pbuf_pool_memory != NULL);
   pbuf_pool = (struct pbuf *)&pbuf_pool_memory[0];
   ASSERT("pbuf_init: pool aligned", (long)pbuf_pool % MEM_ALIGNMENT == 0);
    
 #ifdef PBUF_STATS
-  stats.pbuf.avail = PBUF_POOL_SIZE;
+  stats.pbuf.avail = lwip_conf.pbuf_pool_size;
 #endif /* PBUF_STATS */
   
   /* Set up ->next pointers to link the pbufs of the pool together. */
-  p = pbuf_pool;
+  p = q = pbuf_pool;
   
-  for(i = 0; i < PBUF_POOL_SIZE; ++i) {
+  for(i = 0; i < lwip_conf.pbuf_pool_size; ++i) {
     p->next = (struct pbuf *)((uint8_t *)p + PBUF_POOL_BUFSIZE + sizeof(struct pbuf));
     p->len = p->tot_len = PBUF_POOL_BUFSIZE;
+    p->chksum_len = 0;
     p->payload = MEM_ALIGN((void *)((uint8_t *)p + sizeof(struct pbuf)));
     q = p;
     p = p->next;
@@ -106,6 +116,13 @@ pbuf_init(void)
   
 }
 /*-----------------------------------------------------------------------------------*/
+size_t
+pbuf_pool_memsize(void)
+{
+  return (size_t)lwip_conf.pbuf_pool_size *
+    MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE + sizeof(struct pbuf));
+}
+/*-----------------------------------------------------------------------------------*/
 /* The following two functions are only called from pbuf_alloc(). */
 /*-----------------------------------------------------------------------------------*/
 static struct pbuf *
@@ -240,6 +257,7 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 		  p->len = size > PBUF_POOL_BUFSIZE - offset? PBUF_POOL_BUFSIZE - offset: size;
 
 		  p->flags = PBUF_FLAG_POOL;
+		  p->chksum_len = 0;
 
 		  /* Allocate the tail of the pbuf chain. */
 		  r = p;
@@ -258,6 +276,7 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 			  r->next = q;
 			  q->len = rsize > PBUF_POOL_BUFSIZE? PBUF_POOL_BUFSIZE: rsize;
 			  q->flags = PBUF_FLAG_POOL;
+			  q->chksum_len = 0;
 			  q->payload = (void *)((uint8_t *)q + sizeof(struct pbuf));
 			  r = q;
 			  q->ref = 1;
@@ -280,6 +299,7 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 		  p->len = p->tot_len = size;
 		  p->next = NULL;
 		  p->flags = PBUF_FLAG_RAM;
+		  p->chksum_len = 0;
 
 		  ASSERT("pbuf_alloc: pbuf->payload properly aligned",
 				  ((uint32_t)p->payload % MEM_ALIGNMENT) == 0);
@@ -295,6 +315,7 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
 		  p->len = p->tot_len = size;
 		  p->next = NULL;
 		  p->flags = PBUF_FLAG_ROM;
+		  p->chksum_len = 0;
 		  break;
 	  default:
 		  ASSERT("pbuf_alloc: erroneous flag", 0);
@@ -304,6 +325,32 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
   return p;
 }
 /*-----------------------------------------------------------------------------------*/
+/* pbuf_alloc_ref():
+ *
+ * Wraps memory owned by someone else in a pbuf without copying it, see pbuf.h.
+ */
+/*-----------------------------------------------------------------------------------*/
+struct pbuf *
+pbuf_alloc_ref(void *payload, uint16_t size,
+	       void (*free_fn)(void *arg), void *arg)
+{
+  struct pbuf *p;
+
+  p = (struct pbuf*)memp_mallocp(MEMP_PBUF);
+  if(p == NULL) {
+    return NULL;
+  }
+  p->payload = payload;
+  p->len = p->tot_len = size;
+  p->next = NULL;
+  p->flags = PBUF_FLAG_REF;
+  p->chksum_len = 0;
+  p->ref_free = free_fn;
+  p->ref_arg = arg;
+  p->ref = 1;
+  return p;
+}
+/*-----------------------------------------------------------------------------------*/
 /* pbuf_refresh():
  *
  * Moves free buffers from the pbuf_pool_free_cache to the pbuf_pool
@@ -365,6 +412,7 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
 
   ASSERT("pbuf_realloc: sane p->flags", p->flags == PBUF_FLAG_POOL ||
          p->flags == PBUF_FLAG_ROM ||
+         p->flags == PBUF_FLAG_REF ||
          p->flags == PBUF_FLAG_RAM);
 
   
@@ -383,6 +431,7 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
     }
     /* Adjust the length of the pbuf that will be halved. */
     q->len = rsize;
+    q->chksum_len = 0;
 
     /* And deallocate any left over pbufs. */
     r = q->next;
@@ -398,7 +447,9 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
     }
     break;
   case PBUF_FLAG_ROM:    
+  case PBUF_FLAG_REF:
     p->len = size;
+    p->chksum_len = 0;
     break;
   case PBUF_FLAG_RAM:
     /* First, step over the pbufs that should still be in the chain. */
@@ -414,6 +465,7 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
     }
     
     q->len = rsize;
+    q->chksum_len = 0;
     
     /* And deallocate any left over pbufs. */
     r = q->next;
@@ -446,8 +498,14 @@ pbuf_header(struct pbuf *p, int16_t header_size)
   p->payload = (uint8_t *)p->payload - header_size/sizeof(uint8_t);
 
   DEBUGF(PBUF_DEBUG, ("pbuf_header: old %p new %p (%d)\n", payload, p->payload, header_size));
-  
-  if((uint8_t *)p->payload < (uint8_t *)p + sizeof(struct pbuf)) {
+
+  /* A borrowed payload can be trimmed but there is no room in front of it. */
+  if(p->flags == PBUF_FLAG_REF) {
+    if(header_size > 0) {
+      p->payload = payload;
+      return -1;
+    }
+  } else if((uint8_t *)p->payload < (uint8_t *)p + sizeof(struct pbuf)) {
     DEBUGF(PBUF_DEBUG, ("pbuf_header: failed %p %p\n",
 			(uint8_t *)p->payload,
 			(uint8_t *)p + sizeof(struct pbuf)));
@@ -479,6 +537,7 @@ pbuf_free(struct pbuf *p)
 
   ASSERT("pbuf_free: sane flags", p->flags == PBUF_FLAG_POOL ||
          p->flags == PBUF_FLAG_ROM ||
+         p->flags == PBUF_FLAG_REF ||
          p->flags == PBUF_FLAG_RAM);
   
   ASSERT("pbuf_free: p->ref > 0", p->ref > 0);
@@ -503,6 +562,10 @@ pbuf_free(struct pbuf *p)
       } else if(p->flags == PBUF_FLAG_ROM) {
 	q = p->next;
 	memp_freep(MEMP_PBUF, p);
+      } else if(p->flags == PBUF_FLAG_REF) {
+	q = p->next;
+	p->ref_free(p->ref_arg);
+	memp_freep(MEMP_PBUF, p);
       } else {
 	q = p->next;
 	mem_free(p);
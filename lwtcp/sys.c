@@ -36,158 +36,298 @@
 #include "lwip/debug.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "lwip/sys.h"
 #include "lwip/opt.h"
 #include "lwip/def.h"
 #include "lwip/memp.h"
 
+static void wheel_add(struct sys_timeouts *timeouts, struct sys_timeout *timeout);
+static void wheel_del(struct sys_timeouts *timeouts, struct sys_timeout *timeout);
+static uint32_t wheel_next(struct sys_timeouts *timeouts);
+static void wheel_move(struct sys_timeouts *timeouts, uint32_t now);
+static void wheel_run(struct sys_timeouts *timeouts);
+static uint16_t wheel_wait(struct sys_timeouts *timeouts);
+
 /*-----------------------------------------------------------------------------------*/
 void
 sys_mbox_fetch(sys_mbox_t mbox, void **msg)
 {
-  uint16_t time;
   struct sys_timeouts *timeouts;
-  struct sys_timeout *tmptimeout;
-  sys_timeout_handler h;
-  void *arg;
+  uint16_t wait;
 
-    
- again:
+  /* Handlers run from here, one that blocks (if only on the memp lock)
+     just waits, the wheel is not run again underneath it. */
   timeouts = sys_arch_timeouts();
-    
-  if(timeouts->next == NULL) {
-    sys_arch_mbox_fetch(mbox, msg, 0);
-  } else {
-    if(timeouts->next->time > 0) {
-      time = sys_arch_mbox_fetch(mbox, msg, timeouts->next->time);
-    } else {
-      time = 0;
+  for(;;) {
+    if(timeouts->count == 0 || timeouts->running) {
+      sys_arch_mbox_fetch(mbox, msg, 0);
+      return;
     }
-
-    if(time == 0) {
-      /* If time == 0, a timeout occured before a message could be
-	 fetched. We should now call the timeout handler and
-	 deallocate the memory allocated for the timeout. */
-      tmptimeout = timeouts->next;
-      timeouts->next = tmptimeout->next;
-      h = tmptimeout->h;
-      arg = tmptimeout->arg;
-      memp_free(MEMP_SYS_TIMEOUT, tmptimeout);
-      h(arg);
-      
-      /* We try again to fetch a message from the mbox. */
-      goto again;
-    } else {
-      /* If time > 0, a message was received before the timeout
-	 occured. The time variable is set to the number of
-	 microseconds we waited for the message. */
-      if(time <= timeouts->next->time) {
-	timeouts->next->time -= time;
-      } else {
-	timeouts->next->time = 0;
-      }
+    /* A timeout is due in wait ms (0: now), run whatever is due unless
+       a message arrives first. */
+    wait = wheel_wait(timeouts);
+    if(wait != 0 && sys_arch_mbox_fetch(mbox, msg, wait) != 0) {
+      return;
     }
-    
+    wheel_run(timeouts);
   }
 }
 /*-----------------------------------------------------------------------------------*/
 void
 sys_sem_wait(sys_sem_t sem)
 {
-  uint16_t time;
   struct sys_timeouts *timeouts;
-  struct sys_timeout *tmptimeout;
-  sys_timeout_handler h;
-  void *arg;
+  uint16_t wait;
 
   assert(sem);
   
-  /*  while(sys_arch_sem_wait(sem, 1000) == 0);
-      return;*/
-
- again:
-  
   timeouts = sys_arch_timeouts();
-  
-  if(timeouts->next == NULL) {
-    sys_arch_sem_wait(sem, 0);
-  } else {
-    if(timeouts->next->time > 0) {
-      time = sys_arch_sem_wait(sem, timeouts->next->time);
-    } else {
-      time = 0;
+  for(;;) {
+    if(timeouts->count == 0 || timeouts->running) {
+      sys_arch_sem_wait(sem, 0);
+      return;
     }
-
-    if(time == 0) {
-      /* If time == 0, a timeout occured before a message could be
-	 fetched. We should now call the timeout handler and
-	 deallocate the memory allocated for the timeout. */
-      tmptimeout = timeouts->next;
-      timeouts->next = tmptimeout->next;
-      h = tmptimeout->h;
-      arg = tmptimeout->arg;
-      memp_free(MEMP_SYS_TIMEOUT, tmptimeout);
-      h(arg);
-	    
-      
-      /* We try again to fetch a message from the mbox. */
-      goto again;
-    } else {
-      /* If time > 0, a message was received before the timeout
-	 occured. The time variable is set to the number of
-	 microseconds we waited for the message. */
-      if(time <= timeouts->next->time) {
-	timeouts->next->time -= time;
-      } else {
-	timeouts->next->time = 0;
-      }
+    wait = wheel_wait(timeouts);
+    if(wait != 0 && sys_arch_sem_wait(sem, wait) != 0) {
+      return;
     }
-    
+    wheel_run(timeouts);
   }
 }
 /*-----------------------------------------------------------------------------------*/
-void
-sys_timeout(uint16_t msecs, sys_timeout_handler h, void *arg)
+struct sys_timeout *
+sys_timeout(uint32_t msecs, sys_timeout_handler h, void *arg)
 {
   struct sys_timeouts *timeouts;
-  struct sys_timeout *timeout, *t;
+  struct sys_timeout *timeout;
 
-  timeout = (struct sys_timeout*)memp_malloc(MEMP_SYS_TIMEOUT);
+  timeout = (struct sys_timeout*)memp_mallocp(MEMP_SYS_TIMEOUT);
   if(timeout == NULL) {
-    return;
+    return NULL;
   }
-  timeout->next = NULL;
   timeout->h = h;
   timeout->arg = arg;
-  timeout->time = msecs;
   
   timeouts = sys_arch_timeouts();
-  
-  if(timeouts->next == NULL) {
-    timeouts->next = timeout;
+
+  /* An idle wheel is not kept up to date, catch up first. */
+  if(timeouts->count == 0) {
+    timeouts->now = sys_now();
+  }
+  timeout->due = sys_now() + msecs;
+  wheel_add(timeouts, timeout);
+  timeouts->count++;
+  return timeout;
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_untimeout(struct sys_timeout *timeout)
+{
+  struct sys_timeouts *timeouts;
+
+  if(timeout == NULL) {
     return;
-  }  
-  
-  if(timeouts->next->time > msecs) {
-    timeouts->next->time -= msecs;
-    timeout->next = timeouts->next;
-    timeouts->next = timeout;
-  } else {
-    for(t = timeouts->next; t != NULL; t = t->next) {
-      timeout->time -= t->time;
-      if(t->next == NULL ||
-	 t->next->time > timeout->time) {
-	if(t->next != NULL) {
-	  t->next->time -= timeout->time;
-	}
-	timeout->next = t->next;
-	t->next = timeout;
-	break;
+  }
+  timeouts = sys_arch_timeouts();
+  wheel_del(timeouts, timeout);
+  timeouts->count--;
+  memp_freep(MEMP_SYS_TIMEOUT, timeout);
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_timeouts_init(struct sys_timeouts *timeouts)
+{
+  memset(timeouts, 0, sizeof(struct sys_timeouts));
+  timeouts->now = sys_now();
+}
+/*-----------------------------------------------------------------------------------*/
+void
+sys_timeouts_free(struct sys_timeouts *timeouts)
+{
+  struct sys_timeout *timeout;
+  int l, i;
+
+  for(l = 0; l < SYS_WHEEL_LEVELS; ++l) {
+    for(i = 0; i < SYS_WHEEL_SLOTS; ++i) {
+      while((timeout = timeouts->slots[l][i]) != NULL) {
+        wheel_del(timeouts, timeout);
+        memp_freep(MEMP_SYS_TIMEOUT, timeout);
       }
     }
   }
-  
+  timeouts->count = 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/* File timeout in the lowest level whose wheel reaches its due time
+   from timeouts->now, in the slot for the bits of due at that level. */
+static void
+wheel_add(struct sys_timeouts *timeouts, struct sys_timeout *timeout)
+{
+  struct sys_timeout **head;
+  int32_t delta;
+  uint32_t due;
+  int l;
+
+  delta = (int32_t)(timeout->due - timeouts->now);
+  if(delta < 0) {
+    delta = 0;
+  }
+  if(delta >= 1 << (SYS_WHEEL_BITS * SYS_WHEEL_LEVELS)) {
+    /* Out of reach, park it at the far end of the top level. */
+    delta = (1 << (SYS_WHEEL_BITS * SYS_WHEEL_LEVELS)) - 1;
+  }
+  due = timeouts->now + delta;
+
+  for(l = 0; l < SYS_WHEEL_LEVELS - 1; ++l) {
+    if(delta < 1 << (SYS_WHEEL_BITS * (l + 1))) {
+      break;
+    }
+  }
+  timeout->level = l;
+  timeout->slot = (due >> (SYS_WHEEL_BITS * l)) & SYS_WHEEL_MASK;
+
+  head = &timeouts->slots[l][timeout->slot];
+  timeout->next = *head;
+  timeout->pprev = head;
+  if(*head != NULL) {
+    (*head)->pprev = &timeout->next;
+  }
+  *head = timeout;
+  timeouts->pending[l] |= (uint64_t)1 << timeout->slot;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+wheel_del(struct sys_timeouts *timeouts, struct sys_timeout *timeout)
+{
+  *timeout->pprev = timeout->next;
+  if(timeout->next != NULL) {
+    timeout->next->pprev = timeout->pprev;
+  }
+  if(timeouts->slots[timeout->level][timeout->slot] == NULL) {
+    timeouts->pending[timeout->level] &= ~((uint64_t)1 << timeout->slot);
+  }
 }
 /*-----------------------------------------------------------------------------------*/
+/* Wheel time of the next thing to do: run the first non-empty slot of
+   level 0 or, further out, move a slot of a higher level down.  Slots
+   at or behind the current one at some level come round only once the
+   level above moves on, so they make the answer that boundary. */
+static uint32_t
+wheel_next(struct sys_timeouts *timeouts)
+{
+  uint64_t bits;
+  uint32_t block;
+  int l, shift, idx;
 
+  idx = timeouts->now & SYS_WHEEL_MASK;
+  bits = timeouts->pending[0] >> idx;
+  if(bits != 0) {
+    return timeouts->now + __builtin_ctzll(bits);
+  }
+
+  for(l = 1; l < SYS_WHEEL_LEVELS; ++l) {
+    shift = SYS_WHEEL_BITS * l;
+    block = timeouts->now >> shift;
+    if(timeouts->pending[l - 1] != 0) {
+      return (block + 1) << shift;
+    }
+    idx = block & SYS_WHEEL_MASK;
+    bits = idx == SYS_WHEEL_MASK ? 0 : timeouts->pending[l] >> (idx + 1);
+    if(bits != 0) {
+      return (block + 1 + __builtin_ctzll(bits)) << shift;
+    }
+  }
+  return ((timeouts->now >> (SYS_WHEEL_BITS * SYS_WHEEL_LEVELS)) + 1)
+    << (SYS_WHEEL_BITS * SYS_WHEEL_LEVELS);
+}
+/*-----------------------------------------------------------------------------------*/
+/* ms until wheel_next(), 0 if that is now.  Waits are capped, an early
+   wakeup costs nothing but another look. */
+static uint16_t
+wheel_wait(struct sys_timeouts *timeouts)
+{
+  int32_t wait;
+
+  wait = (int32_t)(wheel_next(timeouts) - sys_now());
+  if(wait <= 0) {
+    return 0;
+  }
+  return wait > 0xffff ? 0xffff : wait;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Set the wheel time to now, which wheel_next() said nothing comes
+   before.  When that is where a lower wheel goes round, the next slot
+   of the level above moves down. */
+static void
+wheel_move(struct sys_timeouts *timeouts, uint32_t now)
+{
+  struct sys_timeout *timeout, *list;
+  int l, idx;
+
+  if(now == timeouts->now) {
+    return;
+  }
+  timeouts->now = now;
+  for(l = 1; l < SYS_WHEEL_LEVELS; ++l) {
+    if((now & ((1 << (SYS_WHEEL_BITS * l)) - 1)) != 0) {
+      break;
+    }
+    idx = (now >> (SYS_WHEEL_BITS * l)) & SYS_WHEEL_MASK;
+    list = timeouts->slots[l][idx];
+    timeouts->slots[l][idx] = NULL;
+    timeouts->pending[l] &= ~((uint64_t)1 << idx);
+    while((timeout = list) != NULL) {
+      list = timeout->next;
+      wheel_add(timeouts, timeout);
+    }
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Bring the wheel up to sys_now(), running every timeout due by then.
+   Handlers may add and cancel timeouts, including ones in the slot
+   being run. */
+static void
+wheel_run(struct sys_timeouts *timeouts)
+{
+  struct sys_timeout *timeout;
+  sys_timeout_handler h;
+  uint32_t end, next;
+  void *arg;
+  int idx;
+
+  timeouts->running = 1;
+  end = sys_now() + 1;
+  while(timeouts->count != 0 && (int32_t)(end - timeouts->now) > 0) {
+    /* Skip ahead to the next slot with work, never past end. */
+    next = wheel_next(timeouts);
+    if((int32_t)(next - end) >= 0) {
+      wheel_move(timeouts, end);
+      break;
+    }
+    wheel_move(timeouts, next);
+
+    idx = timeouts->now & SYS_WHEEL_MASK;
+    while((timeout = timeouts->slots[0][idx]) != NULL) {
+      wheel_del(timeouts, timeout);
+      timeouts->count--;
+      if((int32_t)(timeout->due - timeouts->now) > 0) {
+        /* Was out of reach when added, not due yet. */
+        timeouts->count++;
+        wheel_add(timeouts, timeout);
+        continue;
+      }
+      h = timeout->h;
+      arg = timeout->arg;
+      memp_freep(MEMP_SYS_TIMEOUT, timeout);
+      h(arg);
+    }
+    wheel_move(timeouts, timeouts->now + 1);
+  }
+  if(timeouts->count == 0) {
+    timeouts->now = end;
+  }
+  timeouts->running = 0;
+}
+/*-----------------------------------------------------------------------------------*/
@@ -45,6 +45,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif /* _LINUX_ */
 
 #include "lwip/sys.h"
 #include "lwip/opt.h"
@@ -52,20 +59,41 @@
 
 #define UMAX(a, b)      ((a) > (b) ? (a) : (b))
 
-static struct sys_thread *threads = NULL;
+/* The sys_thread of the calling thread, set when it starts. */
+static __thread struct sys_thread *current = NULL;
+
+/* Mailboxes are bounded rings of message slots (D. Vyukov's bounded
+   queue): posting and fetching claim a slot with one compare and swap on
+   tail or head and hand it over through the slot's sequence number, so
+   neither side takes a lock.  A thread that finds its mailbox empty
+   sleeps on the wake word (a futex on linux, a condition variable
+   elsewhere); posters only make a system call when someone is asleep.
+
+   Each mailbox has its own capacity.  When it is full sys_mbox_post()
+   sleeps on the room word until a fetch frees a slot, while
+   sys_mbox_trypost() gives up and counts a drop. */
+
+#define SYS_MBOX_ALIGN 64  /* cache line */
 
-struct sys_mbox_msg {
-  struct sys_mbox_msg *next;
+struct sys_mbox_slot {
+  uint32_t seq;   /* == position + 1 once msg is there */
   void *msg;
 };
 
-#define SYS_MBOX_SIZE 100
-
 struct sys_mbox {
-  uint16_t first, last;
-  void *msgs[SYS_MBOX_SIZE];
-  struct sys_sem *mail;
-  struct sys_sem *mutex;
+  uint32_t tail __attribute__ ((aligned (SYS_MBOX_ALIGN))); /* posters */
+  uint32_t head __attribute__ ((aligned (SYS_MBOX_ALIGN))); /* fetchers */
+  uint32_t wake __attribute__ ((aligned (SYS_MBOX_ALIGN))); /* bumped per wakeup */
+  uint32_t sleepers;
+  uint32_t room;        /* bumped when a fetch frees a slot for a waiter */
+  uint32_t waiters;     /* posters asleep on room */
+  uint32_t mask;        /* capacity - 1, capacity a power of two */
+  uint32_t hwm;         /* most messages ever waiting */
+#ifndef _LINUX_
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif /* _LINUX_ */
+  struct sys_mbox_slot slots[];
 };
 
 struct sys_sem {
@@ -75,7 +103,6 @@ struct sys_sem {
 };
 
 struct sys_thread {
-  struct sys_thread *next;
   struct sys_timeouts timeouts;
   pthread_t pthread;
 };
@@ -88,24 +115,24 @@ static void sys_sem_free_(struct sys_sem *sem);
 
 static uint16_t cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, uint16_t timeout);
 
+static int mbox_trypost(struct sys_mbox *mbox, void *msg);
+static int mbox_tryfetch(struct sys_mbox *mbox, void **msg);
+static void mbox_sleep(struct sys_mbox *mbox, uint32_t *word, uint32_t val,
+                       unsigned long ms);
+static void mbox_wakeup(struct sys_mbox *mbox, uint32_t *word);
+static void mbox_hwm(struct sys_mbox *mbox, uint32_t n);
+static unsigned long mono_ms(void);
+
 /*-----------------------------------------------------------------------------------*/
 static struct sys_thread *
 current_thread(void)
 {
-  struct sys_thread *st;
-  pthread_t pt;
-  pt = pthread_self();
-  /*  DEBUGF("sys: current_thread: pt %d\n", pt);*/
-  for(st = threads; st != NULL; st = st->next) {
-    /*    DEBUGF("sys: current_thread: st->pthread %d\n", st->pthread);*/
-    if(pthread_equal(st->pthread, pt)) {
-      return st;
-    }
+  if(current != NULL) {
+    return current;
   }
   printf("sys: current_thread: could not find current thread!\n");
-  printf("This is due to a race condition in the LinuxThreads\n");
-  printf("pthreads implementation. Start the program again.\n");
-  
+  printf("Threads that use lwip must be started with sys_thread_new()\n");
+  printf("(or call sys_thread_init() first).\n");
 
   abort();
 }
@@ -120,22 +147,30 @@ static void *
 thread_start(void *arg)
 {
   struct thread_start_param *tp = arg;
-  tp->thread->pthread = pthread_self();
+  struct sys_thread *thread = tp->thread;
+
+  thread->pthread = pthread_self();
+  current = thread;
   tp->function(tp->arg);
   free(tp);
+
+  /* Nothing else knows about the thread, don't leak it (and whatever
+     timeouts it left behind) when e.g. a cli client goes away. */
+  sys_timeouts_free(&thread->timeouts);
+  current = NULL;
+  free(thread);
   return NULL;
 }
 
-/* add the main thread to the threads list .mc */
+/* set up the main thread .mc */
 void sys_thread_init()
 {
   struct sys_thread *thread;
 
   thread = malloc(sizeof(struct sys_thread));
-  thread->next = threads;
-  thread->timeouts.next = NULL;
+  sys_timeouts_init(&thread->timeouts);
   thread->pthread = pthread_self();
-  threads = thread;
+  current = thread;
 }
 
 void
@@ -145,10 +180,8 @@ sys_thread_new(void (* function)(void *arg), void *arg)
   struct thread_start_param *thread_param;
 
   thread = malloc(sizeof(struct sys_thread));
-  thread->next = threads;
-  thread->timeouts.next = NULL;
+  sys_timeouts_init(&thread->timeouts);
   thread->pthread = 0;
-  threads = thread;
 
   thread_param = malloc(sizeof(struct thread_start_param));
   
@@ -164,13 +197,37 @@ sys_thread_new(void (* function)(void *arg), void *arg)
 /*-----------------------------------------------------------------------------------*/
 struct sys_mbox *
 sys_mbox_new()
+{
+  return sys_mbox_new_sized(SYS_MBOX_SIZE);
+}
+/*-----------------------------------------------------------------------------------*/
+struct sys_mbox *
+sys_mbox_new_sized(uint32_t size)
 {
   struct sys_mbox *mbox;
+  void *mem;
+  uint32_t i, n;
+
+  /* Round up to a power of two, the ring indexes with a mask. */
+  for(n = 2; n < size; n <<= 1);
 
-  mbox = malloc(sizeof(struct sys_mbox));
-  mbox->first = mbox->last = 0;
-  mbox->mail = sys_sem_new_(0);
-  mbox->mutex = sys_sem_new_(1);
+  if(posix_memalign(&mem, SYS_MBOX_ALIGN, sizeof(struct sys_mbox) +
+                    n * sizeof(struct sys_mbox_slot)) != 0) {
+#ifdef SYS_STATS
+    stats.sys.mbox.err++;
+#endif /* SYS_STATS */
+    return SYS_MBOX_NULL;
+  }
+  mbox = mem;
+  memset(mbox, 0, sizeof(struct sys_mbox));
+  mbox->mask = n - 1;
+  for(i = 0; i < n; ++i) {
+    mbox->slots[i].seq = i;
+  }
+#ifndef _LINUX_
+  pthread_mutex_init(&(mbox->lock), NULL);
+  pthread_cond_init(&(mbox->cond), NULL);
+#endif /* _LINUX_ */
   
 #ifdef SYS_STATS
   stats.sys.mbox.used++;
@@ -189,11 +246,10 @@ sys_mbox_free(struct sys_mbox *mbox)
 #ifdef SYS_STATS
     stats.sys.mbox.used--;
 #endif /* SYS_STATS */
-    sys_sem_wait(mbox->mutex);
-    
-    sys_sem_free_(mbox->mail);
-    sys_sem_free_(mbox->mutex);
-    mbox->mail = mbox->mutex = NULL;
+#ifndef _LINUX_
+    pthread_cond_destroy(&(mbox->cond));
+    pthread_mutex_destroy(&(mbox->lock));
+#endif /* _LINUX_ */
     /*  DEBUGF("sys_mbox_free: mbox 0x%lx\n", mbox);*/
     free(mbox);
   }
@@ -202,74 +258,250 @@ sys_mbox_free(struct sys_mbox *mbox)
 void
 sys_mbox_post(struct sys_mbox *mbox, void *msg)
 {
-  uint8_t first;
-  
-  sys_sem_wait(mbox->mutex);
-  
-  DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", mbox, msg));
+  uint32_t room;
 
-  mbox->msgs[mbox->last] = msg;
+  DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", mbox, msg));
 
-  if(mbox->last == mbox->first) {
-    first = 1;
-  } else {
-    first = 0;
+  if(mbox_trypost(mbox, msg) != 0) {
+    /* Full: wait for a fetch to make room rather than overwrite. */
+#ifdef SYS_STATS
+    __atomic_add_fetch(&stats.sys.mbox.block, 1, __ATOMIC_RELAXED);
+#endif /* SYS_STATS */
+    for(;;) {
+      room = __atomic_load_n(&mbox->room, __ATOMIC_ACQUIRE);
+      __atomic_add_fetch(&mbox->waiters, 1, __ATOMIC_RELAXED);
+      /* Pairs with the fence in mbox_tryfetch(). */
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if(mbox_trypost(mbox, msg) == 0) {
+        __atomic_sub_fetch(&mbox->waiters, 1, __ATOMIC_RELAXED);
+        break;
+      }
+      mbox_sleep(mbox, &mbox->room, room, 0);
+      __atomic_sub_fetch(&mbox->waiters, 1, __ATOMIC_RELAXED);
+      if(mbox_trypost(mbox, msg) == 0) {
+        break;
+      }
+    }
   }
-  
-  mbox->last++;
-  if(mbox->last == SYS_MBOX_SIZE) {
-    mbox->last = 0;
+
+  /* Pairs with the fence in sys_arch_mbox_fetch(). */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&mbox->sleepers, __ATOMIC_RELAXED) != 0) {
+    mbox_wakeup(mbox, &mbox->wake);
   }
+}
+/*-----------------------------------------------------------------------------------*/
+err_t
+sys_mbox_trypost(struct sys_mbox *mbox, void *msg)
+{
+  DEBUGF(SYS_DEBUG, ("sys_mbox_trypost: mbox %p msg %p\n", mbox, msg));
 
-  if(first) {
-    sys_sem_signal(mbox->mail);
+  if(mbox_trypost(mbox, msg) != 0) {
+#ifdef SYS_STATS
+    __atomic_add_fetch(&stats.sys.mbox.drop, 1, __ATOMIC_RELAXED);
+#endif /* SYS_STATS */
+    return ERR_MEM;
   }
-  
-  sys_sem_signal(mbox->mutex);
 
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&mbox->sleepers, __ATOMIC_RELAXED) != 0) {
+    mbox_wakeup(mbox, &mbox->wake);
+  }
+  return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
 uint16_t
 sys_arch_mbox_fetch(struct sys_mbox *mbox, void **msg, uint16_t timeout)
 {
-  uint16_t time = 1;
-  
-  /* The mutex lock is quick so we don't bother with the timeout
-     stuff here. */
-  sys_arch_sem_wait(mbox->mutex, 0);
-  
-  while(mbox->first == mbox->last) {
-    sys_sem_signal(mbox->mutex);
-    
-    /* We block while waiting for a mail to arrive in the mailbox. We
-       must be prepared to timeout. */
-    if(timeout != 0) {
-      time = sys_arch_sem_wait(mbox->mail, timeout);
-      
-      /* If time == 0, the sem_wait timed out, and we return 0. */
-      if(time == 0) {
-	return 0;
+  unsigned long start, now, waited;
+  uint32_t wake;
+  void *dummy;
+
+  if(msg == NULL) {
+    msg = &dummy;
+  }
+
+  if(mbox_tryfetch(mbox, msg) == 0) {
+    DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, *msg));
+    return 1;
+  }
+
+  start = mono_ms();
+  for(;;) {
+    /* Announce ourselves before the last look so that a post racing
+       with us either sees us asleep or is seen by that look. */
+    wake = __atomic_load_n(&mbox->wake, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&mbox->sleepers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if(mbox_tryfetch(mbox, msg) == 0) {
+      __atomic_sub_fetch(&mbox->sleepers, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    now = mono_ms();
+    if(timeout != 0 && now - start >= timeout) {
+      __atomic_sub_fetch(&mbox->sleepers, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+
+    mbox_sleep(mbox, &mbox->wake, wake,
+               timeout != 0 ? timeout - (now - start) : 0);
+    __atomic_sub_fetch(&mbox->sleepers, 1, __ATOMIC_RELAXED);
+
+    if(mbox_tryfetch(mbox, msg) == 0) {
+      break;
+    }
+  }
+
+  DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, *msg));
+
+  /* Like the semaphore version: how long we waited, at least 1. */
+  waited = mono_ms() - start;
+  if(waited == 0) {
+    return 1;
+  }
+  return waited > 0xffff ? 0xffff : waited;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+mbox_trypost(struct sys_mbox *mbox, void *msg)
+{
+  struct sys_mbox_slot *slot;
+  uint32_t pos, seq;
+  int32_t diff;
+
+  pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
+  for(;;) {
+    slot = &mbox->slots[pos & mbox->mask];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    diff = (int32_t)(seq - pos);
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&mbox->tail, &pos, pos + 1, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
       }
+    } else if(diff < 0) {
+      return -1; /* full */
     } else {
-      sys_arch_sem_wait(mbox->mail, 0);
+      pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
     }
-    
-    sys_arch_sem_wait(mbox->mutex, 0);
   }
-  
-  if(msg != NULL) {
-    DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, *msg));
-    *msg = mbox->msgs[mbox->first];
+
+  slot->msg = msg;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* Fetchers may already be past pos, then there is nothing to note. */
+  diff = (int32_t)(pos + 1 - __atomic_load_n(&mbox->head, __ATOMIC_RELAXED));
+  if(diff > 0) {
+    mbox_hwm(mbox, diff);
   }
-  
-  mbox->first++;
-  if(mbox->first == SYS_MBOX_SIZE) {
-    mbox->first = 0;
-  }    
-  
-  sys_sem_signal(mbox->mutex);
-  
-  return time;
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+mbox_tryfetch(struct sys_mbox *mbox, void **msg)
+{
+  struct sys_mbox_slot *slot;
+  uint32_t pos, seq;
+  int32_t diff;
+
+  pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+  for(;;) {
+    slot = &mbox->slots[pos & mbox->mask];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    diff = (int32_t)(seq - (pos + 1));
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&mbox->head, &pos, pos + 1, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if(diff < 0) {
+      return -1; /* empty */
+    } else {
+      pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  *msg = slot->msg;
+  __atomic_store_n(&slot->seq, pos + mbox->mask + 1, __ATOMIC_RELEASE);
+
+  /* Pairs with the fence in sys_mbox_post(): a poster that found the
+     ring full either sees this slot free or is seen waiting here. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&mbox->waiters, __ATOMIC_RELAXED) != 0) {
+    mbox_wakeup(mbox, &mbox->room);
+  }
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Note n messages waiting, for the mailbox's and the global high water
+   marks.  Both only ever grow. */
+static void
+mbox_hwm(struct sys_mbox *mbox, uint32_t n)
+{
+  uint32_t hwm;
+
+  hwm = __atomic_load_n(&mbox->hwm, __ATOMIC_RELAXED);
+  while(n > hwm) {
+    if(__atomic_compare_exchange_n(&mbox->hwm, &hwm, n, 1,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+#ifdef SYS_STATS
+      hwm = __atomic_load_n(&stats.sys.mbox.hwm, __ATOMIC_RELAXED);
+      while(n > hwm &&
+            !__atomic_compare_exchange_n(&stats.sys.mbox.hwm, &hwm, n, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#endif /* SYS_STATS */
+      break;
+    }
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Sleep while *word (mbox->wake or mbox->room) is still val, at most ms
+   (0: no limit).  May return early, callers look at the ring again
+   anyway. */
+static void
+mbox_sleep(struct sys_mbox *mbox, uint32_t *word, uint32_t val,
+           unsigned long ms)
+{
+#ifdef _LINUX_
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000;
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val,
+          ms != 0 ? &ts : NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&(mbox->lock));
+  if(__atomic_load_n(word, __ATOMIC_RELAXED) == val) {
+    cond_wait(&(mbox->cond), &(mbox->lock), ms > 0xffff ? 0xffff : ms);
+  }
+  pthread_mutex_unlock(&(mbox->lock));
+#endif /* _LINUX_ */
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+mbox_wakeup(struct sys_mbox *mbox, uint32_t *word)
+{
+#ifdef _LINUX_
+  __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+  /* Fetchers and posters share the condition, wake them all. */
+  pthread_mutex_lock(&(mbox->lock));
+  __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&(mbox->cond));
+  pthread_mutex_unlock(&(mbox->lock));
+#endif /* _LINUX_ */
+}
+/*-----------------------------------------------------------------------------------*/
+static unsigned long
+mono_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 /*-----------------------------------------------------------------------------------*/
 struct sys_sem *
@@ -395,6 +627,12 @@ sys_sem_free_(struct sys_sem *sem)
 }
 /*-----------------------------------------------------------------------------------*/
 unsigned long
+sys_now(void)
+{
+  return mono_ms();
+}
+/*-----------------------------------------------------------------------------------*/
+unsigned long
 sys_unix_now()
 {
   struct timeval tv;
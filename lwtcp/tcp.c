@@ -48,12 +48,10 @@
 #include "lwip/def.h"
 #include "lwip/mem.h"
 #include "lwip/memp.h"
+#include "lwip/conf.h"
 
 #include "lwip/tcp.h"
 
-/* Incremented every coarse grained timer shot
-   (typically every 500 ms, determined by TCP_COARSE_TIMEOUT). */
-uint32_t tcp_ticks;
 const uint8_t tcp_backoff[13] =
     { 1, 2, 4, 8, 16, 32, 64, 64, 64, 64, 64, 64, 64 };
 
@@ -75,7 +73,9 @@ static uint8_t tcp_memp_reclaim(void *arg, memp_t type);
 static mem_size_t tcp_mem_reclaim(void *arg, mem_size_t size);
 #endif
 
-static uint8_t tcp_timer;
+static void tcp_slowtmr_pcb(void *arg);
+static void tcp_fasttmr_pcb(void *arg);
+static uint8_t tcp_slow_due(struct tcp_pcb *pcb, uint32_t *due);
 
 /*-----------------------------------------------------------------------------------*/
 /*
@@ -103,37 +103,67 @@ tcp_init(void)
   memp_register_reclaim(MEMP_TCP_SEG, (memp_reclaim_func)tcp_memp_reclaim, NULL);
   memp_register_reclaim(MEMP_TCP_PCB, (memp_reclaim_func)tcp_memp_reclaim, NULL);
 #endif /* MEMP_RECLAIM */
-
-  /* initialize timer */
-  tcp_ticks = 0;
-  tcp_timer = 0;
-  
 }
 /*-----------------------------------------------------------------------------------*/
 /*
- * tcp_tmr():
+ * tcp_timers_update():
  *
- * Called periodically to dispatch TCP timers.
+ * Makes sure the timers of a PCB are running if it has anything for
+ * them to do: the delayed ACK timer while an ACK is held back, the
+ * coarse timer while segments wait to be acknowledged, for the next
+ * poll and for the FIN-WAIT-2, SYN-RCVD, out of sequence and TIME-WAIT
+ * timeouts.  An idle connection has no timer running at all.  Called
+ * by tcp_output(), which every path that changes any of this goes
+ * through.
  *
  */
 /*-----------------------------------------------------------------------------------*/
 void
-tcp_tmr()
+tcp_timers_update(struct tcp_pcb *pcb)
 {
-  ++tcp_timer;
-  if(tcp_timer == 10) {
-    tcp_timer = 0;
+  uint32_t due, now;
+
+  if(pcb->state == CLOSED || pcb->state == LISTEN) {
+    return;
   }
-  
-  if(tcp_timer & 1) {
-    /* Call tcp_fasttmr() every 200 ms, i.e., every other timer
-       tcp_tmr() is called. */
-    tcp_fasttmr();
+
+  if((pcb->flags & TF_ACK_DELAY) && pcb->fasttmr == NULL) {
+    pcb->fasttmr = sys_timeout(TCP_FAST_INTERVAL, tcp_fasttmr_pcb, pcb);
+  }
+
+  if(!tcp_slow_due(pcb, &due)) {
+    return;
+  }
+  if(pcb->slowtmr != NULL) {
+    if(!TCP_SEQ_LT(due, pcb->slowdue)) {
+      return;
+    }
+    sys_untimeout(pcb->slowtmr);
+  }
+  /* Fire on the tick boundary, like the old shared 500 ms timer. */
+  now = sys_now();
+  pcb->slowdue = due;
+  pcb->slowtmr = sys_timeout(due * TCP_SLOW_INTERVAL - now,
+                             tcp_slowtmr_pcb, pcb);
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_timers_stop():
+ *
+ * Cancels the timers of a PCB that is going away.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_timers_stop(struct tcp_pcb *pcb)
+{
+  if(pcb->slowtmr != NULL) {
+    sys_untimeout(pcb->slowtmr);
+    pcb->slowtmr = NULL;
   }
-  if(tcp_timer == 0 || tcp_timer == 5) {
-    /* Call tcp_slowtmr() every 500 ms, i.e., every fifth timer
-       tcp_tmr() is called. */
-    tcp_slowtmr();
+  if(pcb->fasttmr != NULL) {
+    sys_untimeout(pcb->fasttmr);
+    pcb->fasttmr = NULL;
   }
 }
 /*-----------------------------------------------------------------------------------*/
@@ -322,16 +352,18 @@ tcp_listen(struct tcp_pcb *pcb)
 void
 tcp_recved(struct tcp_pcb *pcb, uint16_t len)
 {
-  pcb->rcv_wnd += len;
-  if(pcb->rcv_wnd > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
+  if((uint32_t)pcb->rcv_wnd + len > lwip_conf.tcp_wnd) {
+    pcb->rcv_wnd = lwip_conf.tcp_wnd;
+  } else {
+    pcb->rcv_wnd += len;
   }
   if(!(pcb->flags & TF_ACK_DELAY) ||
      !(pcb->flags & TF_ACK_NOW)) {
     tcp_ack(pcb);
+    tcp_timers_update(pcb);
   }
   DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %d bytes, wnd %u (%u).\n",
-		     len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+		     len, pcb->rcv_wnd, lwip_conf.tcp_wnd - pcb->rcv_wnd));
 }
 /*-----------------------------------------------------------------------------------*/
 /*
@@ -401,8 +433,8 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, uint16_t port,
   pcb->snd_nxt = iss;
   pcb->lastack = iss - 1;
   pcb->snd_lbb = iss - 1;
-  pcb->rcv_wnd = TCP_WND;
-  pcb->snd_wnd = TCP_WND;
+  pcb->rcv_wnd = lwip_conf.tcp_wnd;
+  pcb->snd_wnd = lwip_conf.tcp_wnd;
   pcb->mss = TCP_MSS;
   pcb->cwnd = 1;
   pcb->ssthresh = pcb->mss * 10;
@@ -424,197 +456,219 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, uint16_t port,
 } 
 /*-----------------------------------------------------------------------------------*/
 /*
- * tcp_slowtmr():
+ * tcp_slow_due():
+ *
+ * The tick at which the coarse timer next has work for pcb, if it has
+ * any.
  *
- * Called every 500 ms and implements the retransmission timer and the timer that
- * removes PCBs that have been in TIME-WAIT for enough time. It also increments
- * various timers such as the inactivity timer in each PCB.
  */
 /*-----------------------------------------------------------------------------------*/
-void
-tcp_slowtmr(void)
+static uint8_t
+tcp_slow_due(struct tcp_pcb *pcb, uint32_t *due)
 {
-  static struct tcp_pcb *pcb, *pcb2, *prev;
-  static struct tcp_seg *seg, *useg;
-  static uint32_t eff_wnd;
-  static uint8_t pcb_remove;      /* flag if a PCB should be removed */
+  uint32_t now, t;
+  uint8_t need;
 
-  ++tcp_ticks;
-  
-  /* Steps through all of the active PCBs. */
-  prev = NULL;
-  pcb = tcp_active_pcbs;
-  while(pcb != NULL) {
-    ASSERT("tcp_timer_coarse: active pcb->state != CLOSED", pcb->state != CLOSED);
-    ASSERT("tcp_timer_coarse: active pcb->state != LISTEN", pcb->state != LISTEN);
-    ASSERT("tcp_timer_coarse: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
+  now = tcp_ticks;
+  need = 0;
 
-    pcb_remove = 0;
+#define TCP_DUE(tick) do {                              \
+    t = (tick);                                         \
+    if(!need || TCP_SEQ_LT(t, *due)) {                  \
+      *due = t;                                         \
+      need = 1;                                         \
+    }                                                   \
+  } while(0)
 
-    if(pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) {
-      ++pcb_remove;
-    } else if(pcb->nrtx == TCP_MAXRTX) {
-      ++pcb_remove;
-    } else {
-      ++pcb->rtime;
-      seg = pcb->unacked;
-      if(seg != NULL && pcb->rtime >= pcb->rto) {
-        
-        DEBUGF(TCP_RTO_DEBUG, ("tcp_timer_coarse: rtime %ld pcb->rto %d\n",
-                               tcp_ticks - pcb->rtime, pcb->rto));
-
-	/* Double retransmission time-out unless we are trying to
-           connect to somebody (i.e., we are in SYN_SENT). */
-	if(pcb->state != SYN_SENT) {
-	  pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
-	}
-
-        /* Move all other unacked segments to the unsent queue. */
-        if(seg->next != NULL) {
-          for(useg = seg->next; useg->next != NULL; useg = useg->next);
-          /* useg now points to the last segment on the unacked queue. */
-          useg->next = pcb->unsent;
-          pcb->unsent = seg->next;
-          seg->next = NULL;
-          pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
-        }
-
-	/* Do the actual retransmission. */
-        tcp_rexmit_seg(pcb, seg);
-
-        /* Reduce congestion window and ssthresh. */
-        eff_wnd = MIN(pcb->cwnd, pcb->snd_wnd);
-        pcb->ssthresh = eff_wnd >> 1;
-        if(pcb->ssthresh < pcb->mss) {
-          pcb->ssthresh = pcb->mss * 2;
-        }
-        pcb->cwnd = pcb->mss;
-
-        DEBUGF(TCP_CWND_DEBUG, ("tcp_rexmit_seg: cwnd %u ssthresh %u\n",
-                                pcb->cwnd, pcb->ssthresh));
-      }
+  if(pcb->state == TIME_WAIT) {
+    TCP_DUE(pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+  } else {
+    /* Retransmissions count every tick. */
+    if(pcb->unacked != NULL) {
+      TCP_DUE(now + 1);
+    }
+    if(pcb->poll != NULL) {
+      TCP_DUE(pcb->slowlast + (pcb->polltmr < pcb->pollinterval ?
+                               pcb->pollinterval - pcb->polltmr : 1));
     }
-	  
-    /* Check if this PCB has stayed too long in FIN-WAIT-2 */
     if(pcb->state == FIN_WAIT_2) {
-      if((uint32_t)(tcp_ticks - pcb->tmr) >
-	 TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-      }
+      TCP_DUE(pcb->tmr + TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL + 1);
     }
-
-    /* If this PCB has queued out of sequence data, but has been
-       inactive for too long, will drop the data (it will eventually
-       be retransmitted). */
-#if TCP_QUEUE_OOSEQ    
-    if(pcb->ooseq != NULL &&
-       (uint32_t)tcp_ticks - pcb->tmr >=
-       pcb->rto * TCP_OOSEQ_TIMEOUT) {
-      tcp_segs_free(pcb->ooseq);
-      pcb->ooseq = NULL;
+    if(pcb->state == SYN_RCVD) {
+      TCP_DUE(pcb->tmr + TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+    }
+#if TCP_QUEUE_OOSEQ
+    if(pcb->ooseq != NULL) {
+      TCP_DUE(pcb->tmr + pcb->rto * TCP_OOSEQ_TIMEOUT);
     }
 #endif /* TCP_QUEUE_OOSEQ */
+  }
+#undef TCP_DUE
 
-    /* Check if this PCB has stayed too long in SYN-RCVD */
-    if(pcb->state == SYN_RCVD) {
-      if((uint32_t)(tcp_ticks - pcb->tmr) >
-	 TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-      }
+  if(need && !TCP_SEQ_GT(*due, now)) {
+    *due = now + 1;
+  }
+  return need;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_slowtmr_pcb():
+ *
+ * The coarse timer of one PCB, running on tick boundaries (every 500
+ * ms while it has segments out).  Implements retransmissions, the
+ * poll callback and the timeouts that remove PCBs, TIME-WAIT ones
+ * included.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+static void
+tcp_slowtmr_pcb(void *arg)
+{
+  struct tcp_pcb *pcb;
+  struct tcp_seg *seg, *useg;
+  uint32_t eff_wnd, ticks;
+  uint8_t pcb_remove;      /* flag if the PCB should be removed */
+  void (* errf)(void *arg, err_t err);
+  void *errf_arg;
+
+  pcb = arg;
+  pcb->slowtmr = NULL;
+  ticks = tcp_ticks - pcb->slowlast;
+  pcb->slowlast = tcp_ticks;
+
+  if(pcb->state == TIME_WAIT) {
+    /* Check if this PCB has stayed long enough in TIME-WAIT */
+    if((uint32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      tcp_pcb_remove(&tcp_tw_pcbs, pcb);
+      memp_free(MEMP_TCP_PCB, pcb);
+    } else {
+      tcp_timers_update(pcb);
     }
+    return;
+  }
+
+  ASSERT("tcp_slowtmr_pcb: active pcb->state != CLOSED", pcb->state != CLOSED);
+  ASSERT("tcp_slowtmr_pcb: active pcb->state != LISTEN", pcb->state != LISTEN);
 
+  pcb_remove = 0;
 
-    /* If the PCB should be removed, do it. */
-    if(pcb_remove) {
-      tcp_pcb_purge(pcb);      
-      /* Remove PCB from tcp_active_pcbs list. */
-      if(prev != NULL) {
-	ASSERT("tcp_timer_coarse: middle tcp != tcp_active_pcbs", pcb != tcp_active_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        ASSERT("tcp_timer_coarse: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
-        tcp_active_pcbs = pcb->next;
+  if(pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) {
+    ++pcb_remove;
+  } else if(pcb->nrtx == TCP_MAXRTX) {
+    ++pcb_remove;
+  } else if((seg = pcb->unacked) != NULL) {
+    ++pcb->rtime;
+    if(pcb->rtime >= pcb->rto) {
+        
+      DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr_pcb: rtime %d pcb->rto %d\n",
+                             pcb->rtime, pcb->rto));
+
+      /* Double retransmission time-out unless we are trying to
+         connect to somebody (i.e., we are in SYN_SENT). */
+      if(pcb->state != SYN_SENT) {
+        pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
       }
 
-      if(pcb->errf != NULL) {
-	pcb->errf(pcb->callback_arg, ERR_ABRT);
+      /* Move all other unacked segments to the unsent queue. */
+      if(seg->next != NULL) {
+        for(useg = seg->next; useg->next != NULL; useg = useg->next);
+        /* useg now points to the last segment on the unacked queue. */
+        useg->next = pcb->unsent;
+        pcb->unsent = seg->next;
+        seg->next = NULL;
+        pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
       }
 
-      pcb2 = pcb->next;
-      memp_free(MEMP_TCP_PCB, pcb);
-      pcb = pcb2;
-    } else {
+      /* Do the actual retransmission. */
+      tcp_rexmit_seg(pcb, seg);
 
-      /* We check if we should poll the connection. */
-      ++pcb->polltmr;
-      if(pcb->polltmr >= pcb->pollinterval &&
-	 pcb->poll != NULL) {
-	pcb->polltmr = 0;
-	pcb->poll(pcb->callback_arg, pcb);
-	tcp_output(pcb);
+      /* Reduce congestion window and ssthresh. */
+      eff_wnd = MIN(pcb->cwnd, pcb->snd_wnd);
+      pcb->ssthresh = eff_wnd >> 1;
+      if(pcb->ssthresh < pcb->mss) {
+        pcb->ssthresh = pcb->mss * 2;
       }
-      
-      prev = pcb;
-      pcb = pcb->next;
+      pcb->cwnd = pcb->mss;
+
+      DEBUGF(TCP_CWND_DEBUG, ("tcp_rexmit_seg: cwnd %u ssthresh %u\n",
+                              pcb->cwnd, pcb->ssthresh));
+    }
+  }
+	  
+  /* Check if this PCB has stayed too long in FIN-WAIT-2 */
+  if(pcb->state == FIN_WAIT_2) {
+    if((uint32_t)(tcp_ticks - pcb->tmr) >
+       TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
     }
   }
 
-  
-  /* Steps through all of the TIME-WAIT PCBs. */
-  prev = NULL;    
-  pcb = tcp_tw_pcbs;
-  while(pcb != NULL) {
-    ASSERT("tcp_timer_coarse: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
-    pcb_remove = 0;
+  /* If this PCB has queued out of sequence data, but has been
+     inactive for too long, will drop the data (it will eventually
+     be retransmitted). */
+#if TCP_QUEUE_OOSEQ    
+  if(pcb->ooseq != NULL &&
+     (uint32_t)tcp_ticks - pcb->tmr >=
+     pcb->rto * TCP_OOSEQ_TIMEOUT) {
+    tcp_segs_free(pcb->ooseq);
+    pcb->ooseq = NULL;
+  }
+#endif /* TCP_QUEUE_OOSEQ */
 
-    /* Check if this PCB has stayed long enough in TIME-WAIT */
-    if((uint32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+  /* Check if this PCB has stayed too long in SYN-RCVD */
+  if(pcb->state == SYN_RCVD) {
+    if((uint32_t)(tcp_ticks - pcb->tmr) >
+       TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
       ++pcb_remove;
     }
-    
+  }
 
+  /* If the PCB should be removed, do it. */
+  if(pcb_remove) {
+    tcp_pcb_purge(pcb);
+    TCP_RMV(&tcp_active_pcbs, pcb);
+    tcp_timers_stop(pcb);
 
-    /* If the PCB should be removed, do it. */
-    if(pcb_remove) {
-      tcp_pcb_purge(pcb);      
-      /* Remove PCB from tcp_tw_pcbs list. */
-      if(prev != NULL) {
-	ASSERT("tcp_timer_coarse: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        ASSERT("tcp_timer_coarse: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
-        tcp_tw_pcbs = pcb->next;
-      }
-      pcb2 = pcb->next;
-      memp_free(MEMP_TCP_PCB, pcb);
-      pcb = pcb2;
-    } else {
-      prev = pcb;
-      pcb = pcb->next;
+    errf = pcb->errf;
+    errf_arg = pcb->callback_arg;
+    memp_free(MEMP_TCP_PCB, pcb);
+    if(errf != NULL) {
+      errf(errf_arg, ERR_ABRT);
     }
+    return;
+  }
+
+  /* We check if we should poll the connection.  The timer may have
+     slept through several ticks. */
+  pcb->polltmr = pcb->polltmr + ticks > 0xff ? 0xff : pcb->polltmr + ticks;
+  if(pcb->polltmr >= pcb->pollinterval &&
+     pcb->poll != NULL) {
+    pcb->polltmr = 0;
+    pcb->poll(pcb->callback_arg, pcb);
+    tcp_output(pcb);
+  } else {
+    tcp_timers_update(pcb);
   }
 }
 /*-----------------------------------------------------------------------------------*/
 /*
- * tcp_fasttmr():
+ * tcp_fasttmr_pcb():
+ *
+ * Runs TCP_FAST_INTERVAL ms after a PCB delayed an ACK and sends it.
  *
- * Is called every TCP_FINE_TIMEOUT (100 ms) and sends delayed ACKs.
  */
 /*-----------------------------------------------------------------------------------*/
-void
-tcp_fasttmr(void)
+static void
+tcp_fasttmr_pcb(void *arg)
 {
   struct tcp_pcb *pcb;
 
-  /* send delayed ACKs */  
-  for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
-    if(pcb->flags & TF_ACK_DELAY) {
-      DEBUGF(TCP_DEBUG, ("tcp_timer_fine: delayed ACK\n"));
-      tcp_ack_now(pcb);
-      pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
-    }
+  pcb = arg;
+  pcb->fasttmr = NULL;
+  if(pcb->flags & TF_ACK_DELAY) {
+    DEBUGF(TCP_DEBUG, ("tcp_timer_fine: delayed ACK\n"));
+    tcp_ack_now(pcb);
+    pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
   }
 }
 /*-----------------------------------------------------------------------------------*/
@@ -704,9 +758,9 @@ tcp_new(void)
   pcb = (struct tcp_pcb*)memp_malloc2(MEMP_TCP_PCB);
   if(pcb != NULL) {
     bzero(pcb, sizeof(struct tcp_pcb));
-    pcb->snd_buf = TCP_SND_BUF;
+    pcb->snd_buf = lwip_conf.tcp_snd_buf;
     pcb->snd_queuelen = 0;
-    pcb->rcv_wnd = TCP_WND;
+    pcb->rcv_wnd = lwip_conf.tcp_wnd;
     pcb->mss = TCP_MSS;
     pcb->rto = 3000 / TCP_SLOW_INTERVAL;
     pcb->sa = 0;
@@ -720,6 +774,7 @@ tcp_new(void)
     pcb->lastack = iss;
     pcb->snd_lbb = iss;   
     pcb->tmr = tcp_ticks;
+    pcb->slowlast = tcp_ticks;
 
     pcb->polltmr = 0;
 
@@ -807,6 +862,7 @@ tcp_memp_reclaim(void *arg, memp_t type)
     pcb = tcp_tw_pcbs;
     if(pcb != NULL) {
       tcp_tw_pcbs = tcp_tw_pcbs->next;
+      tcp_timers_stop(pcb);
       memp_free(MEMP_TCP_PCB, pcb);
       return 1;
     } else {
@@ -899,7 +955,9 @@ tcp_err(struct tcp_pcb *pcb,
  *
  * Used to specify the function that should be called periodically
  * from TCP. The interval is specified in terms of the TCP coarse
- * timer interval, which is called twice a second.
+ * timer interval, which is called twice a second.  The coarse timer
+ * only runs for a poll callback while one is set, so callers should
+ * clear it (NULL) when they have nothing to poll for.
  *
  */ 
 /*-----------------------------------------------------------------------------------*/
@@ -907,8 +965,19 @@ void
 tcp_poll(struct tcp_pcb *pcb,
 	 err_t (* poll)(void *arg, struct tcp_pcb *tpcb), uint8_t interval)
 {
+  if(poll != NULL && pcb->poll == NULL) {
+    /* Count the interval from now, not from whenever the idle
+       timer last ran. */
+    if(pcb->slowtmr == NULL) {
+      pcb->slowlast = tcp_ticks;
+    }
+    pcb->polltmr = 0;
+  }
   pcb->poll = poll;
   pcb->pollinterval = interval;
+  if(poll != NULL) {
+    tcp_timers_update(pcb);
+  }
 }
 /*-----------------------------------------------------------------------------------*/
 /*
@@ -985,6 +1054,9 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
     pcb->flags |= TF_ACK_NOW;
     tcp_output(pcb);
   }  
+  if(pcb->state != LISTEN) {
+    tcp_timers_stop(pcb);
+  }
   pcb->state = CLOSED;
 
   ASSERT("tcp_pcb_remove: tcp_pcbs_sane()", tcp_pcbs_sane());
@@ -121,6 +121,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
     return;
   }
 
+  /* The header is rewritten below, so any sum left in the pbuf is stale. */
+  p->chksum_len = 0;
+
   /* Move the payload pointer in the pbuf so that it points to the
      TCP data instead of the TCP header. */
   offset = TCPH_OFFSET(tcphdr) >> 4;
@@ -280,6 +283,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
 	    }	    
 	    if(err == ERR_OK) {
 	      tcp_output(pcb);
+	    } else if(err != ERR_ABRT) {
+	      /* Still arm the timers, e.g. for a delayed ACK. */
+	      tcp_timers_update(pcb);
 	    }
 	  } else if(pcb->state == TIME_WAIT) {
 	    pbuf_free(pcb->recv_data);	  
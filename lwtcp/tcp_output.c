@@ -51,6 +51,7 @@
 
 #include "lwip/mem.h"
 #include "lwip/memp.h"
+#include "lwip/conf.h"
 #include "lwip/sys.h"
 
 #include "lwip/netif.h"
@@ -67,6 +68,7 @@
 
 
 /* Forward declarations.*/
+static err_t tcp_output_(struct tcp_pcb *pcb);
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
 
 
@@ -104,7 +106,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, uint16_t len,
 	uint32_t left, seqno;
 	uint16_t seglen;
 	void *ptr;
-	uint8_t queuelen;
+	uint16_t queuelen;
 
 	left = len;
 	ptr = arg;
@@ -126,10 +128,10 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, uint16_t len,
 				pcb->unsent != NULL);      
 	}
 
-	if(queuelen >= TCP_SND_QUEUELEN) {
+	if(queuelen >= lwip_conf.tcp_snd_queuelen) {
 		printf(" unacked %d, unsent %d\n", pcb->unacked != NULL, pcb->unsent !=
 				NULL);
-		DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue: too long queue %d (max %d)\n", queuelen, TCP_SND_QUEUELEN));
+		DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue: too long queue %d (max %d)\n", queuelen, lwip_conf.tcp_snd_queuelen));
 		goto memerr;
 	}   
 
@@ -180,7 +182,10 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, uint16_t len,
 			}
 			++queuelen;
 			if(arg != NULL) {
-				bcopy(ptr, seg->p->payload, seglen);
+				/* sum while copying, tcp_output_segment() only
+				   has to add in the header */
+				seg->p->chksum = inet_chksum_copy(seg->p->payload, ptr, seglen);
+				seg->p->chksum_len = seglen;
 			}
 			seg->dataptr = seg->p->payload;
 		} else {
@@ -201,8 +206,8 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, uint16_t len,
 			pbuf_chain(seg->p, p);
 		}
 
-		if(queuelen > TCP_SND_QUEUELEN) {
-			DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue: queue too long %d (%d)\n", queuelen, TCP_SND_QUEUELEN)); 	
+		if(queuelen > lwip_conf.tcp_snd_queuelen) {
+			DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue: queue too long %d (%d)\n", queuelen, lwip_conf.tcp_snd_queuelen)); 	
 			goto memerr;
 		}
 
@@ -326,6 +331,16 @@ memerr:
 /* find out what we can send and send it */
 err_t
 tcp_output(struct tcp_pcb *pcb)
+{
+  err_t err;
+
+  err = tcp_output_(pcb);
+  tcp_timers_update(pcb);
+  return err;
+}
+/*-----------------------------------------------------------------------------------*/
+static err_t
+tcp_output_(struct tcp_pcb *pcb)
 {
   struct pbuf *p;
   struct tcp_hdr *tcphdr;
@@ -52,13 +52,6 @@ static void (* tcpip_init_done)(void *arg) = NULL;
 static void *tcpip_init_done_arg;
 static sys_mbox_t mbox;
 
-/*-----------------------------------------------------------------------------------*/
-static void
-tcpip_tcp_timer(void *arg)
-{
-  tcp_tmr();
-  sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)tcpip_tcp_timer, NULL);
-}
 /*-----------------------------------------------------------------------------------*/
 
 static void
@@ -70,8 +63,6 @@ tcpip_thread(void *arg)
   udp_init();
   tcp_init();
 
-  sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)tcpip_tcp_timer, NULL);
-  
   if(tcpip_init_done != NULL) {
     tcpip_init_done(tcpip_init_done_arg);
   }
@@ -52,15 +52,6 @@ static void (* transport_init_done)(void *arg) = NULL;
 static void *transport_init_done_arg;
 static sys_mbox_t mbox;
 
-/*-----------------------------------------------------------------------------------*/
-static void
-transport_tcp_timer(void *arg)
-{
-  tcp_tmr();
-  sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)transport_tcp_timer, NULL);
-}
-/*-----------------------------------------------------------------------------------*/
-
 /*-----------------------------------------------------------------------------------*/
 static void
 transport_thread(void *arg)
@@ -70,8 +61,6 @@ transport_thread(void *arg)
   udp_init();
   tcp_init();
 
-  sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)transport_tcp_timer, NULL);
-  
   if(transport_init_done != NULL) {
     transport_init_done(transport_init_done_arg);
   }
@@ -117,7 +106,13 @@ tcp_msg_input(struct pbuf *p, struct netif *inp)
   msg->type = TCP_MSG_INPUT;
   msg->msg.inp.p = p;
   msg->msg.inp.netif = inp;
-  sys_mbox_post(mbox, msg);
+  /* Never wait on the packet thread: if the transport thread is that far
+     behind, drop the segment and let the sender retransmit it. */
+  if(sys_mbox_trypost(mbox, msg) != ERR_OK) {
+    memp_freep(MEMP_TCP_MSG, msg);
+    pbuf_free(p);
+    return ERR_MEM;
+  }
   return ERR_OK;
 }
 
@@ -136,7 +131,13 @@ transport_subsys_input(struct pbuf *p, struct netif *inp)
   msg->type = TCP_MSG_INPUT;
   msg->msg.inp.p = p;
   msg->msg.inp.netif = inp;
-  sys_mbox_post(mbox, msg);
+  /* Never wait on the packet thread: if the transport thread is that far
+     behind, drop the segment and let the sender retransmit it. */
+  if(sys_mbox_trypost(mbox, msg) != ERR_OK) {
+    memp_freep(MEMP_TCP_MSG, msg);
+    pbuf_free(p);
+    return ERR_MEM;
+  }
   return ERR_OK;
 }
 
@@ -161,7 +162,7 @@ transport_subsys_init(void (* initfunc)(void *), void *arg)
 {
   transport_init_done = initfunc;
   transport_init_done_arg = arg;
-  mbox = sys_mbox_new();
+  mbox = sys_mbox_new_sized(TRANSPORT_MBOX_SIZE);
   sys_thread_new((void *)transport_thread, NULL);
 }
 /*-----------------------------------------------------------------------------------*/
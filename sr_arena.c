@@ -0,0 +1,111 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_arena.c
+ *
+ * Description:
+ *
+ * Packet buffer arena, see sr_arena.h.  Carving is a single atomic bump of
+ * the offset of the free part, rounded to the cache line.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "sr_arena.h"
+#include "sr_base_internal.h"
+
+static uint8_t* sr_arena_base    = 0;
+static size_t   sr_arena_size    = 0;
+static size_t   sr_arena_used    = 0;
+static int      sr_arena_hugetlb = 0;
+
+#define SR_ARENA_ROUND(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arena_init(..)
+ * Scope: global
+ *
+ * Hugetlb pages come prefaulted with MAP_POPULATE.  Normal pages are
+ * touched one by one after the madvise(..), so they fault in as
+ * transparent hugepages where the kernel can.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_arena_init(size_t size)
+{
+    void* mem = MAP_FAILED;
+    size_t page, off;
+
+    size = SR_ARENA_ROUND(size, SR_ARENA_HUGEPAGE);
+
+#ifdef MAP_HUGETLB
+    mem = mmap(0, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+#endif /* MAP_HUGETLB */
+
+    if ( mem != MAP_FAILED )
+    { sr_arena_hugetlb = 1; }
+    else
+    {
+        mem = mmap(0, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ( mem == MAP_FAILED )
+        {
+            perror("mmap(..) packet arena");
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(mem, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
+        page = (size_t)sysconf(_SC_PAGESIZE);
+        for ( off = 0; off < size; off += page )
+        { ((volatile uint8_t*)mem)[off] = 0; }
+    }
+
+    Debug("Packet arena: %lu KB on %s pages\n", (unsigned long)(size >> 10),
+          sr_arena_hugetlb ? "huge" : "normal");
+
+    sr_arena_base = (uint8_t*)mem;
+    sr_arena_size = size;
+    return 0;
+} /* -- sr_arena_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arena_carve(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void* sr_arena_carve(size_t size)
+{
+    size_t off;
+
+    if ( ! sr_arena_base )
+    { return 0; }
+
+    size = SR_ARENA_ROUND(size, SR_ARENA_ALIGN);
+    off  = __atomic_fetch_add(&sr_arena_used, size, __ATOMIC_RELAXED);
+    if ( off + size > sr_arena_size )
+    {
+        /* -- leave used past the end, later requests fail as well -- */
+        return 0;
+    }
+
+    return sr_arena_base + off;
+} /* -- sr_arena_carve -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arena_get_stats(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_arena_get_stats(size_t* size, size_t* used, int* hugetlb)
+{
+    *size    = sr_arena_size;
+    *used    = __atomic_load_n(&sr_arena_used, __ATOMIC_RELAXED);
+    if ( *used > *size )
+    { *used = *size; }
+    *hugetlb = sr_arena_hugetlb;
+} /* -- sr_arena_get_stats -- */
@@ -0,0 +1,46 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_arena.h
+ *
+ * Description:
+ *
+ * Packet buffer arena.  One region reserved at startup that the fixed
+ * packet buffers are carved out of: the receive buffer classes (see
+ * sr_rxbuf.h), which the VNS reader and the cpu mode receive path fill,
+ * and lwip's pbuf pool.  Keeping them together instead of scattered over
+ * the heap keeps the TLB footprint of the packet path small.
+ *
+ * The region is mapped on hugepages when some are reserved (MAP_HUGETLB),
+ * otherwise on normal pages the kernel is asked to back with transparent
+ * hugepages, and every page is faulted in up front so the first packets
+ * don't pay for it.
+ *
+ * Buffers are carved once and never given back; their owners recycle them
+ * on their own free lists.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ARENA_H
+#define SR_ARENA_H
+
+#include <stddef.h>
+
+#define SR_ARENA_ALIGN    64                 /* cache line */
+#define SR_ARENA_HUGEPAGE (2 * 1024 * 1024)
+
+/**
+ * Reserve and prefault an arena of at least size bytes.  Call once,
+ * before any buffer is carved.  Returns 0, or -1 if it could not be mapped
+ * (sr_arena_carve(..) then always fails and callers use their own memory).
+ */
+int sr_arena_init(size_t size);
+
+/**
+ * size bytes off the arena, aligned to SR_ARENA_ALIGN.  Any thread.
+ * Returns NULL once the arena is used up.
+ */
+void* sr_arena_carve(size_t size);
+
+/** Bytes reserved and carved so far, and whether hugetlb pages back them */
+void sr_arena_get_stats(size_t* size, size_t* used, int* hugetlb);
+
+#endif  /* -- SR_ARENA_H -- */
@@ -0,0 +1,861 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_arp.c
+ *
+ * Description:
+ *
+ * ARP cache, pending packet queues and the ARP timer, see sr_arp.h.
+ *
+ * Removed entries leave a tombstone in their slot so probe sequences stay
+ * intact for lock free readers.  When tombstones pile up the table is
+ * rebuilt without them and swapped in whole.  Entries and tables that were
+ * replaced go on retired lists which the timer frees after a grace period,
+ * so neither the packet thread nor the CLI ever waits on readers.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_arp.h"
+#include "sr_router.h"
+#include "sr_integration.h"
+#include "sr_epoch.h"
+#include "sr_flowcache.h"
+#include "sr_event.h"
+
+/* -- marks a removed entry, probing continues past it -- */
+static struct sr_arp_entry sr_arp_tomb;
+#define SR_ARP_TOMB (&sr_arp_tomb)
+
+static uint64_t sr_arp_now(void);
+static unsigned sr_arp_hash(uint32_t ip);
+static int  sr_arp_find(const struct sr_arp_table* t, uint32_t ip);
+static unsigned sr_arp_free_slot(const struct sr_arp_table* t, uint32_t ip);
+static int  sr_arp_set(struct sr_arp* arp, uint32_t ip, const uint8_t* mac,
+                       int is_static, uint64_t now);
+static void sr_arp_unset(struct sr_arp* arp, unsigned i);
+static int  sr_arp_rebuild(struct sr_arp* arp);
+static void sr_arp_learn(struct sr_arp* arp, uint32_t ip, const uint8_t* mac);
+static struct sr_arp_req* sr_arp_req_detach(struct sr_arp* arp, uint32_t ip);
+static void sr_arp_req_release(struct sr_arp* arp, struct sr_arp_req* req);
+static void sr_arp_flush(struct sr_arp* arp, struct sr_arp_req* req,
+                         const uint8_t* mac);
+static void sr_arp_send_request(struct sr_arp* arp,
+                                struct sr_router_if* intf, uint32_t ip);
+static unsigned sr_arp_purge(struct sr_instance* sr, int is_static);
+static void sr_arp_timer(void* arg);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_create(..)
+ * Scope: global
+ *
+ * Allocates the table and every buffer the cache will ever hold packets
+ * in, then adds the timer to the packet thread's event loop.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_arp* sr_arp_create(struct sr_instance* sr)
+{
+    struct sr_arp* arp;
+    unsigned i;
+
+    if ( ! (arp = (struct sr_arp*)calloc(1, sizeof(struct sr_arp))) )
+    { return 0; }
+
+    arp->sr       = sr;
+    arp->table    = (struct sr_arp_table*)calloc(1, sizeof(struct sr_arp_table));
+    arp->req_pool = (struct sr_arp_req*)calloc(SR_ARP_MAX_REQS,
+                                               sizeof(struct sr_arp_req));
+    arp->pkt_pool = (struct sr_arp_pkt*)calloc(SR_ARP_MAX_PENDING,
+                                               sizeof(struct sr_arp_pkt));
+    if ( ! arp->table || ! arp->req_pool || ! arp->pkt_pool )
+    {
+        fprintf(stderr, "Error: out of memory (sr_arp_create)\n");
+        free(arp->table);
+        free(arp->req_pool);
+        free(arp->pkt_pool);
+        free(arp);
+        return 0;
+    }
+
+    for ( i = 0; i < SR_ARP_MAX_REQS; ++i )
+    {
+        arp->req_pool[i].next = arp->free_reqs;
+        arp->free_reqs = &(arp->req_pool[i]);
+    }
+    for ( i = 0; i < SR_ARP_MAX_PENDING; ++i )
+    {
+        arp->pkt_pool[i].next = arp->free_pkts;
+        arp->free_pkts = &(arp->pkt_pool[i]);
+    }
+
+    pthread_mutex_init(&(arp->lock), 0);
+
+    arp->timer = sr_event_add_timer(sr->events, SR_ARP_TICK_MS,
+                                    sr_arp_timer, arp);
+    if ( arp->timer < 0 )
+    {
+        pthread_mutex_destroy(&(arp->lock));
+        free(arp->table);
+        free(arp->req_pool);
+        free(arp->pkt_pool);
+        free(arp);
+        return 0;
+    }
+
+    return arp;
+} /* -- sr_arp_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_destroy(..)
+ * Scope: global
+ *
+ * Stops the timer and frees everything.  No readers may be left and the
+ * event loop must not be running on another thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_arp_destroy(struct sr_arp* arp)
+{
+    struct sr_arp_entry* e;
+    struct sr_arp_table* t;
+    unsigned i;
+
+    if ( ! arp )
+    { return; }
+
+    sr_event_del_timer(arp->sr->events, arp->timer);
+
+    for ( i = 0; i < SR_ARP_TABLE_SIZE; ++i )
+    {
+        e = arp->table->slot[i];
+        if ( e && e != SR_ARP_TOMB )
+        { free(e); }
+    }
+    free(arp->table);
+
+    while ( (e = arp->retired) )
+    {
+        arp->retired = e->retired_next;
+        free(e);
+    }
+    while ( (t = arp->retired_tables) )
+    {
+        arp->retired_tables = t->retired_next;
+        free(t);
+    }
+
+    free(arp->req_pool);
+    free(arp->pkt_pool);
+    pthread_mutex_destroy(&(arp->lock));
+    free(arp);
+} /* -- sr_arp_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_lookup(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_arp_lookup(struct sr_arp* arp, uint32_t ip /* nbo */,
+                  uint8_t* mac /* ETHER_ADDR_LEN */)
+{
+    const struct sr_arp_table* t;
+    const struct sr_arp_entry* e;
+    unsigned i, n;
+    int hit = 0;
+
+    sr_epoch_enter();
+
+    t = sr_rcu_deref(arp->table);
+    for ( n = 0, i = sr_arp_hash(ip); n < SR_ARP_TABLE_SIZE;
+          ++n, i = (i + 1) & (SR_ARP_TABLE_SIZE - 1) )
+    {
+        if ( ! (e = sr_rcu_deref(t->slot[i])) )
+        { break; }
+        if ( e != SR_ARP_TOMB && e->ip == ip )
+        {
+            memcpy(mac, e->mac, ETHER_ADDR_LEN);
+            hit = 1;
+            break;
+        }
+    }
+
+    sr_epoch_exit();
+
+    return hit;
+} /* -- sr_arp_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_queue(..)
+ * Scope: global
+ *
+ * Park a copy of packet until next_hop is resolved.  The first packet for
+ * a host sends a request right away, later ones only wait for the timer.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_arp_queue(struct sr_arp* arp, uint8_t* packet /* borrowed */,
+                 unsigned int len, struct sr_router_if* out_if,
+                 uint32_t next_hop /* nbo */)
+{
+    struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)packet;
+    struct sr_arp_req* req;
+    struct sr_arp_pkt* pkt = 0;
+    int send_req = 0;
+    int i;
+
+    pthread_mutex_lock(&(arp->lock));
+
+    /* -- the reply may have come in since the caller looked -- */
+    if ( (i = sr_arp_find(arp->table, next_hop)) >= 0 )
+    {
+        memcpy(eth->ether_dhost, arp->table->slot[i]->mac, ETHER_ADDR_LEN);
+        pthread_mutex_unlock(&(arp->lock));
+        return sr_integ_low_level_output(arp->sr, packet, len, out_if->name);
+    }
+
+    for ( req = arp->reqs; req; req = req->next )
+    {
+        if ( req->ip == next_hop )
+        { break; }
+    }
+
+    if ( ! req && (req = arp->free_reqs) )
+    {
+        arp->free_reqs = req->next;
+        req->ip        = next_hop;
+        req->intf      = out_if;
+        req->tries     = 1;
+        req->last_sent = sr_arp_now();
+        req->head      = 0;
+        req->tail      = 0;
+        req->qlen      = 0;
+        req->next      = arp->reqs;
+        arp->reqs      = req;
+
+        arp->requests_sent++;
+        send_req = 1;
+    }
+
+    if ( req && req->qlen < SR_ARP_QUEUE_LEN && len <= SR_ARP_PKT_MAX &&
+         (pkt = arp->free_pkts) )
+    {
+        arp->free_pkts = pkt->next;
+        memcpy(pkt->buf, packet, len);
+        pkt->len  = len;
+        pkt->next = 0;
+        if ( req->tail )
+        { req->tail->next = pkt; }
+        else
+        { req->head = pkt; }
+        req->tail = pkt;
+        req->qlen++;
+    }
+    else
+    { arp->pending_drops++; }
+
+    pthread_mutex_unlock(&(arp->lock));
+
+    if ( send_req )
+    { sr_arp_send_request(arp, out_if, next_hop); }
+
+    return pkt ? 0 : -1;
+} /* -- sr_arp_queue -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_handle_packet(..)
+ * Scope: global
+ *
+ * Learn the sender of any request or reply addressed to us and answer
+ * requests by rewriting the frame in place.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_arp_handle_packet(struct sr_arp* arp, uint8_t* packet /* lent */,
+                          unsigned int len, struct sr_router_if* in_if)
+{
+    struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)packet;
+    struct sr_arphdr* arph;
+
+    /* REQUIRES */
+    assert(arp);
+    assert(in_if);
+
+    if ( len < SR_ETHER_HDR_LEN + sizeof(struct sr_arphdr) )
+    { return; }
+
+    arph = (struct sr_arphdr*)(packet + SR_ETHER_HDR_LEN);
+    if ( ntohs(arph->ar_hrd) != SR_ARP_HRD_ETHER ||
+         ntohs(arph->ar_pro) != SR_ETHERTYPE_IP ||
+         arph->ar_hln != ETHER_ADDR_LEN || arph->ar_pln != 4 )
+    {
+        Debug("dropping malformed ARP packet on %s\n", in_if->name);
+        return;
+    }
+
+    if ( arph->ar_tip != in_if->ip )
+    { return; } /* -- not for us -- */
+
+    if ( arph->ar_sip )
+    { sr_arp_learn(arp, arph->ar_sip, arph->ar_sha); }
+
+    if ( ntohs(arph->ar_op) != SR_ARP_OP_REQUEST )
+    { return; }
+
+    memcpy(arph->ar_tha, arph->ar_sha, ETHER_ADDR_LEN);
+    arph->ar_tip = arph->ar_sip;
+    memcpy(arph->ar_sha, in_if->addr, ETHER_ADDR_LEN);
+    arph->ar_sip = in_if->ip;
+    arph->ar_op  = htons(SR_ARP_OP_REPLY);
+
+    memcpy(eth->ether_dhost, arph->ar_tha, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, in_if->addr, ETHER_ADDR_LEN);
+
+    sr_integ_low_level_output(arp->sr, packet, len, in_if->name);
+} /* -- sr_arp_handle_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_tick(..)
+ * Scope: global
+ *
+ * Called every SR_ARP_TICK_MS on the packet thread, from its event loop.
+ * Requests and frees happen after the lock is dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_arp_tick(struct sr_arp* arp)
+{
+    uint32_t retry_ip[SR_ARP_MAX_REQS];
+    struct sr_router_if* retry_if[SR_ARP_MAX_REQS];
+    unsigned num_retry = 0;
+    struct sr_arp_req* req;
+    struct sr_arp_req** prev;
+    struct sr_arp_entry* e;
+    struct sr_arp_entry* entries;
+    struct sr_arp_table* t;
+    struct sr_arp_table* tables;
+    uint64_t now;
+    unsigned i;
+
+    pthread_mutex_lock(&(arp->lock));
+
+    now = sr_arp_now();
+
+    prev = &(arp->reqs);
+    while ( (req = *prev) )
+    {
+        if ( now - req->last_sent < SR_ARP_RETRY_MS )
+        {
+            prev = &(req->next);
+            continue;
+        }
+
+        if ( req->tries >= SR_ARP_MAX_TRIES )
+        {
+            Debug("not yet implemented: ICMP host unreachable for %u "
+                  "packets\n", req->qlen);
+            *prev = req->next;
+            arp->unresolved_drops += req->qlen;
+            sr_arp_req_release(arp, req);
+            continue;
+        }
+
+        req->tries++;
+        req->last_sent = now;
+        arp->requests_sent++;
+        retry_ip[num_retry] = req->ip;
+        retry_if[num_retry] = req->intf;
+        num_retry++;
+        prev = &(req->next);
+    }
+
+    for ( i = 0; i < SR_ARP_TABLE_SIZE; ++i )
+    {
+        e = arp->table->slot[i];
+        if ( e && e != SR_ARP_TOMB && ! e->is_static && e->expires <= now )
+        { sr_arp_unset(arp, i); }
+    }
+
+    entries = arp->retired;
+    tables  = arp->retired_tables;
+    arp->retired        = 0;
+    arp->retired_tables = 0;
+
+    pthread_mutex_unlock(&(arp->lock));
+
+    for ( i = 0; i < num_retry; ++i )
+    { sr_arp_send_request(arp, retry_if[i], retry_ip[i]); }
+
+    if ( ! entries && ! tables )
+    { return; }
+
+    sr_epoch_synchronize();
+
+    while ( (e = entries) )
+    {
+        entries = e->retired_next;
+        free(e);
+    }
+    while ( (t = tables) )
+    {
+        tables = t->retired_next;
+        free(t);
+    }
+} /* -- sr_arp_tick -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: arp_cache_static_entry_add(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int arp_cache_static_entry_add( struct sr_instance* sr,
+                                uint32_t ip,
+                                uint8_t* mac )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+    struct sr_arp* arp;
+    struct sr_arp_req* req = 0;
+    int ret;
+
+    if ( ! router )
+    { return 0; }
+    arp = router->arp;
+
+    pthread_mutex_lock(&(arp->lock));
+    if ( (ret = sr_arp_set(arp, ip, mac, 1, sr_arp_now())) == 0 )
+    { req = sr_arp_req_detach(arp, ip); }
+    pthread_mutex_unlock(&(arp->lock));
+
+    if ( req )
+    { sr_arp_flush(arp, req, mac); }
+
+    return ret == 0;
+} /* -- arp_cache_static_entry_add -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: arp_cache_static_entry_remove(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int arp_cache_static_entry_remove( struct sr_instance* sr, uint32_t ip )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+    struct sr_arp* arp;
+    int i, removed = 0;
+
+    if ( ! router )
+    { return 0; }
+    arp = router->arp;
+
+    pthread_mutex_lock(&(arp->lock));
+    if ( (i = sr_arp_find(arp->table, ip)) >= 0 &&
+         arp->table->slot[i]->is_static )
+    {
+        sr_arp_unset(arp, i);
+        removed = 1;
+    }
+    pthread_mutex_unlock(&(arp->lock));
+
+    return removed;
+} /* -- arp_cache_static_entry_remove -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: arp_cache_static_purge(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+unsigned arp_cache_static_purge( struct sr_instance* sr )
+{
+    return sr_arp_purge(sr, 1);
+} /* -- arp_cache_static_purge -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: arp_cache_dynamic_purge(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+unsigned arp_cache_dynamic_purge( struct sr_instance* sr )
+{
+    return sr_arp_purge(sr, 0);
+} /* -- arp_cache_dynamic_purge -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_purge(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static unsigned sr_arp_purge(struct sr_instance* sr, int is_static)
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+    struct sr_arp* arp;
+    struct sr_arp_entry* e;
+    unsigned i, count = 0;
+
+    if ( ! router )
+    { return 0; }
+    arp = router->arp;
+
+    pthread_mutex_lock(&(arp->lock));
+    for ( i = 0; i < SR_ARP_TABLE_SIZE; ++i )
+    {
+        e = arp->table->slot[i];
+        if ( e && e != SR_ARP_TOMB && e->is_static == is_static )
+        {
+            sr_arp_unset(arp, i);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&(arp->lock));
+
+    return count;
+} /* -- sr_arp_purge -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_now(..)
+ * Scope: local
+ *
+ * Monotonic milliseconds.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint64_t sr_arp_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* -- sr_arp_now -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_hash(..)
+ * Scope: local
+ *
+ * Fibonacci hashing, addresses on one subnet only differ in the low bits.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned sr_arp_hash(uint32_t ip)
+{
+    return (ntohl(ip) * 2654435761u) >> (32 - SR_ARP_TABLE_BITS);
+} /* -- sr_arp_hash -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_find(..)
+ * Scope: local
+ *
+ * Slot holding ip or -1.  Writers only.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_arp_find(const struct sr_arp_table* t, uint32_t ip)
+{
+    const struct sr_arp_entry* e;
+    unsigned i, n;
+
+    for ( n = 0, i = sr_arp_hash(ip); n < SR_ARP_TABLE_SIZE;
+          ++n, i = (i + 1) & (SR_ARP_TABLE_SIZE - 1) )
+    {
+        if ( ! (e = t->slot[i]) )
+        { return -1; }
+        if ( e != SR_ARP_TOMB && e->ip == ip )
+        { return i; }
+    }
+
+    return -1;
+} /* -- sr_arp_find -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_free_slot(..)
+ * Scope: local
+ *
+ * First empty or dead slot on ip's probe sequence.  The table is never
+ * more than 3/4 used so there always is one.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned sr_arp_free_slot(const struct sr_arp_table* t, uint32_t ip)
+{
+    unsigned i = sr_arp_hash(ip);
+
+    while ( t->slot[i] && t->slot[i] != SR_ARP_TOMB )
+    { i = (i + 1) & (SR_ARP_TABLE_SIZE - 1); }
+
+    return i;
+} /* -- sr_arp_free_slot -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_set(..)
+ * Scope: local
+ *
+ * Insert or update the translation for ip.  Dynamic updates never
+ * override static entries.  Called with arp->lock held.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success, -1 if the table (or the static quota) is full
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_arp_set(struct sr_arp* arp, uint32_t ip, const uint8_t* mac,
+                      int is_static, uint64_t now)
+{
+    struct sr_arp_entry* old = 0;
+    struct sr_arp_entry* e;
+    int i;
+
+    if ( (i = sr_arp_find(arp->table, ip)) >= 0 )
+    {
+        old = arp->table->slot[i];
+        if ( old->is_static && ! is_static )
+        { return 0; }
+        if ( old->is_static == is_static &&
+             memcmp(old->mac, mac, ETHER_ADDR_LEN) == 0 )
+        {
+            old->expires = now + SR_ARP_TIMEOUT_MS;
+            return 0;
+        }
+    }
+    else if ( arp->num_entries >= SR_ARP_MAX_ENTRIES )
+    { return -1; }
+
+    if ( is_static && ! (old && old->is_static) &&
+         arp->num_static >= SR_ARP_MAX_STATIC )
+    { return -1; }
+
+    if ( ! old && arp->table->used >= SR_ARP_TABLE_SIZE / 4 * 3 &&
+         sr_arp_rebuild(arp) )
+    { return -1; }
+
+    if ( ! (e = (struct sr_arp_entry*)malloc(sizeof(struct sr_arp_entry))) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_arp_set)\n");
+        return -1;
+    }
+    e->ip        = ip;
+    memcpy(e->mac, mac, ETHER_ADDR_LEN);
+    e->is_static = is_static ? 1 : 0;
+    e->expires   = now + SR_ARP_TIMEOUT_MS;
+
+    if ( old )
+    {
+        sr_rcu_assign(arp->table->slot[i], e);
+        sr_flowcache_invalidate();
+        arp->num_static += e->is_static - old->is_static;
+        old->retired_next = arp->retired;
+        arp->retired = old;
+        return 0;
+    }
+
+    i = sr_arp_free_slot(arp->table, ip);
+    if ( ! arp->table->slot[i] )
+    { arp->table->used++; }
+    sr_rcu_assign(arp->table->slot[i], e);
+    arp->num_entries++;
+    arp->num_static += e->is_static;
+
+    return 0;
+} /* -- sr_arp_set -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_unset(..)
+ * Scope: local
+ *
+ * Replace the entry in slot i with a tombstone.  Called with arp->lock
+ * held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_arp_unset(struct sr_arp* arp, unsigned i)
+{
+    struct sr_arp_entry* e = arp->table->slot[i];
+
+    sr_rcu_assign(arp->table->slot[i], SR_ARP_TOMB);
+    sr_flowcache_invalidate();
+    arp->num_entries--;
+    arp->num_static -= e->is_static;
+
+    e->retired_next = arp->retired;
+    arp->retired = e;
+} /* -- sr_arp_unset -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_rebuild(..)
+ * Scope: local
+ *
+ * Swap in a copy of the table without tombstones.  Called with arp->lock
+ * held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_arp_rebuild(struct sr_arp* arp)
+{
+    struct sr_arp_table* old = arp->table;
+    struct sr_arp_table* t;
+    struct sr_arp_entry* e;
+    unsigned i;
+
+    if ( ! (t = (struct sr_arp_table*)calloc(1, sizeof(struct sr_arp_table))) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_arp_rebuild)\n");
+        return -1;
+    }
+
+    for ( i = 0; i < SR_ARP_TABLE_SIZE; ++i )
+    {
+        e = old->slot[i];
+        if ( e && e != SR_ARP_TOMB )
+        {
+            t->slot[sr_arp_free_slot(t, e->ip)] = e;
+            t->used++;
+        }
+    }
+
+    sr_rcu_assign(arp->table, t);
+
+    old->retired_next = arp->retired_tables;
+    arp->retired_tables = old;
+
+    return 0;
+} /* -- sr_arp_rebuild -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_learn(..)
+ * Scope: local
+ *
+ * Cache ip -> mac and send whatever was waiting for it.  Waiting packets
+ * go out even if the cache happens to be full.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_arp_learn(struct sr_arp* arp, uint32_t ip, const uint8_t* mac)
+{
+    struct sr_arp_req* req;
+
+    pthread_mutex_lock(&(arp->lock));
+    if ( sr_arp_set(arp, ip, mac, 0, sr_arp_now()) )
+    { Debug("ARP cache full, not caching reply\n"); }
+    req = sr_arp_req_detach(arp, ip);
+    pthread_mutex_unlock(&(arp->lock));
+
+    if ( req )
+    { sr_arp_flush(arp, req, mac); }
+} /* -- sr_arp_learn -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_req_detach(..)
+ * Scope: local
+ *
+ * Unlink and return the outstanding request for ip, if any.  Called with
+ * arp->lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_arp_req* sr_arp_req_detach(struct sr_arp* arp, uint32_t ip)
+{
+    struct sr_arp_req** prev;
+    struct sr_arp_req* req;
+
+    for ( prev = &(arp->reqs); (req = *prev); prev = &(req->next) )
+    {
+        if ( req->ip == ip )
+        {
+            *prev = req->next;
+            return req;
+        }
+    }
+
+    return 0;
+} /* -- sr_arp_req_detach -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_req_release(..)
+ * Scope: local
+ *
+ * Return req and its packets to the pools.  Called with arp->lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_arp_req_release(struct sr_arp* arp, struct sr_arp_req* req)
+{
+    if ( req->tail )
+    {
+        req->tail->next = arp->free_pkts;
+        arp->free_pkts  = req->head;
+    }
+
+    req->next = arp->free_reqs;
+    arp->free_reqs = req;
+} /* -- sr_arp_req_release -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_flush(..)
+ * Scope: local
+ *
+ * Send the packets queued on a detached request, then release it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_arp_flush(struct sr_arp* arp, struct sr_arp_req* req,
+                         const uint8_t* mac)
+{
+    struct sr_ethernet_hdr* eth;
+    struct sr_arp_pkt* pkt;
+
+    for ( pkt = req->head; pkt; pkt = pkt->next )
+    {
+        eth = (struct sr_ethernet_hdr*)pkt->buf;
+        memcpy(eth->ether_dhost, mac, ETHER_ADDR_LEN);
+        sr_integ_low_level_output(arp->sr, pkt->buf, pkt->len,
+                                  req->intf->name);
+    }
+
+    pthread_mutex_lock(&(arp->lock));
+    sr_arp_req_release(arp, req);
+    pthread_mutex_unlock(&(arp->lock));
+} /* -- sr_arp_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_send_request(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_arp_send_request(struct sr_arp* arp,
+                                struct sr_router_if* intf, uint32_t ip)
+{
+    uint8_t frame[SR_ETHER_MIN_LEN];
+    struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)frame;
+    struct sr_arphdr* arph = (struct sr_arphdr*)(frame + SR_ETHER_HDR_LEN);
+
+    memset(frame, 0, SR_ETHER_MIN_LEN);
+
+    memset(eth->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, intf->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(SR_ETHERTYPE_ARP);
+
+    arph->ar_hrd = htons(SR_ARP_HRD_ETHER);
+    arph->ar_pro = htons(SR_ETHERTYPE_IP);
+    arph->ar_hln = ETHER_ADDR_LEN;
+    arph->ar_pln = 4;
+    arph->ar_op  = htons(SR_ARP_OP_REQUEST);
+    memcpy(arph->ar_sha, intf->addr, ETHER_ADDR_LEN);
+    arph->ar_sip = intf->ip;
+    arph->ar_tip = ip;
+
+    sr_integ_low_level_output(arp->sr, frame, SR_ETHER_MIN_LEN, intf->name);
+} /* -- sr_arp_send_request -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_timer(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_arp_timer(void* arg)
+{
+    sr_arp_tick((struct sr_arp*)arg);
+} /* -- sr_arp_timer -- */
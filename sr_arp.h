@@ -0,0 +1,187 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_arp.h
+ *
+ * Description:
+ *
+ * ARP cache of the router subsystem.  IP to ethernet translations live in
+ * an open addressing hash table (linear probing) keyed by next hop address.
+ * Dynamic entries expire, static entries (added from the CLI) don't.
+ *
+ * Lookups on the forwarding path take no lock: entries are immutable once
+ * published and are read inside an epoch read section (sr_epoch.h).
+ * Writers (ARP replies, the CLI, the timer) serialize on arp->lock.
+ *
+ * Packets to a next hop that isn't resolved yet are copied into one of a
+ * fixed number of preallocated buffers and parked on a bounded queue per
+ * destination.  Requests go out once when the first packet is queued and
+ * are then retried from a timer at most once per SR_ARP_RETRY_MS, so a
+ * burst towards an unresolved host neither floods the link with requests
+ * nor allocates per packet.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ARP_H
+#define SR_ARP_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_base_internal.h"
+#include "sr_protocol.h"
+
+#define SR_ARP_TABLE_BITS   10
+#define SR_ARP_TABLE_SIZE   (1 << SR_ARP_TABLE_BITS)
+#define SR_ARP_MAX_ENTRIES  (SR_ARP_TABLE_SIZE / 2) /* keeps probes short */
+#define SR_ARP_MAX_STATIC   64
+
+#define SR_ARP_TIMEOUT_MS   60000 /* lifetime of a dynamic entry          */
+#define SR_ARP_RETRY_MS     1000  /* between requests for the same host   */
+#define SR_ARP_MAX_TRIES    5     /* requests before giving up on a host  */
+#define SR_ARP_TICK_MS      100   /* timer granularity                    */
+
+#define SR_ARP_MAX_REQS     64    /* hosts being resolved at once         */
+#define SR_ARP_QUEUE_LEN    8     /* packets held per host                */
+#define SR_ARP_MAX_PENDING  256   /* packets held in total                */
+#define SR_ARP_PKT_MAX      1518  /* largest frame we hold on to          */
+
+struct sr_router_if; /* -- forward declare, see sr_router.h -- */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_arp_entry
+ *
+ * ip and mac never change after the entry is published, a new mac means a
+ * new entry.  expires is only used by writers.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_arp_entry
+{
+    uint32_t             ip;   /* nbo */
+    uint8_t              mac[ETHER_ADDR_LEN];
+    uint8_t              is_static;
+    uint64_t             expires; /* ms, dynamic entries only */
+    struct sr_arp_entry* retired_next;
+};
+
+struct sr_arp_table
+{
+    unsigned             used;  /* live entries plus tombstones */
+    struct sr_arp_table* retired_next;
+    struct sr_arp_entry* slot[SR_ARP_TABLE_SIZE];
+};
+
+/* ----------------------------------------------------------------------------
+ * Pending packets and outstanding requests, both from preallocated pools
+ * -------------------------------------------------------------------------- */
+
+struct sr_arp_pkt
+{
+    struct sr_arp_pkt* next;
+    unsigned int       len;
+    uint8_t            buf[SR_ARP_PKT_MAX];
+};
+
+struct sr_arp_req
+{
+    struct sr_arp_req*   next;
+    uint32_t             ip;    /* nbo */
+    struct sr_router_if* intf;
+    unsigned             tries;
+    uint64_t             last_sent; /* ms */
+    struct sr_arp_pkt*   head;
+    struct sr_arp_pkt*   tail;
+    unsigned             qlen;
+};
+
+struct sr_arp
+{
+    struct sr_instance*  sr;
+
+    pthread_mutex_t      lock;  /* serializes writers, not lookups */
+    struct sr_arp_table* table; /* published with sr_rcu_assign */
+    unsigned             num_entries;
+    unsigned             num_static;
+
+    struct sr_arp_req*   reqs;  /* outstanding requests */
+    struct sr_arp_req*   free_reqs;
+    struct sr_arp_pkt*   free_pkts;
+    struct sr_arp_req*   req_pool;
+    struct sr_arp_pkt*   pkt_pool;
+
+    /* -- freed by the timer after a grace period -- */
+    struct sr_arp_entry* retired;
+    struct sr_arp_table* retired_tables;
+
+    int                  timer; /* id in sr->events */
+
+    /* -- counters -- */
+    unsigned long        requests_sent;
+    unsigned long        pending_drops; /* no buffer or queue full */
+    unsigned long        unresolved_drops; /* host never answered */
+};
+
+struct sr_arp* sr_arp_create(struct sr_instance* sr);
+void sr_arp_destroy(struct sr_arp* arp);
+
+/**
+ * Copy the ethernet address of ip into mac if it is cached.  Returns 1 on a
+ * hit and 0 otherwise.  Does not lock or allocate.
+ */
+int  sr_arp_lookup(struct sr_arp* arp, uint32_t ip /* nbo */,
+                   uint8_t* mac /* ETHER_ADDR_LEN */);
+
+/**
+ * Send packet (ethernet source already set) to next_hop out of out_if once
+ * next_hop is resolved.  The packet is copied, the caller keeps it.
+ * Returns 0 if the packet was sent or queued, -1 if it was dropped.
+ */
+int  sr_arp_queue(struct sr_arp* arp, uint8_t* packet /* borrowed */,
+                  unsigned int len, struct sr_router_if* out_if,
+                  uint32_t next_hop /* nbo */);
+
+/** Handle an ARP frame received on in_if, may reply in place */
+void sr_arp_handle_packet(struct sr_arp* arp, uint8_t* packet /* lent */,
+                          unsigned int len, struct sr_router_if* in_if);
+
+/** Retry requests, expire entries and free retired memory */
+void sr_arp_tick(struct sr_arp* arp);
+
+/* ----------------------------------------------------------------------------
+ * ARP cache hooks used by the CLI
+ * -------------------------------------------------------------------------*/
+
+/**
+ * Add a static entry to the static ARP cache.
+ * @return 1 if succeeded (fails if the max # of static entries are already
+ *         in the cache).
+ */
+int arp_cache_static_entry_add( struct sr_instance* sr,
+                                uint32_t ip,
+                                uint8_t* mac );
+
+/**
+ * Remove a static entry to the static ARP cache.
+ * @return 1 if succeeded (false if ip wasn't in the cache as a static entry)
+ */
+int arp_cache_static_entry_remove( struct sr_instance* sr, uint32_t ip );
+
+/**
+ * Remove all static entries from the ARP cache.
+ * @return  number of static entries removed
+ */
+unsigned arp_cache_static_purge( struct sr_instance* sr );
+
+/**
+ * Remove all dynamic entries from the ARP cache.
+ * @return  number of dynamic entries removed
+ */
+unsigned arp_cache_dynamic_purge( struct sr_instance* sr );
+
+#endif  /* -- SR_ARP_H -- */
@@ -49,9 +49,16 @@
 #include "lwip/tcp.h"
 #include "lwip/memp.h"
 #include "lwip/transport_subsys.h"
+#include "lwip/conf.h"
+#include "lwip/pbuf.h"
 
 #include "sr_vns.h"
 #include "sr_base.h"
+#include "sr_event.h"
+#include "sr_workers.h"
+#include "sr_rxbuf.h"
+#include "sr_arena.h"
+#include "sr_txring.h"
 #include "sr_base_internal.h"
 
 #ifdef _CPUMODE_
@@ -66,6 +73,9 @@ static void sr_set_user(struct sr_instance* sr);
 static void sr_init_instance(struct sr_instance* sr);
 static void sr_low_level_network_subsystem(void *arg);
 static void sr_destroy_instance(struct sr_instance* sr);
+#ifndef _CPUMODE_
+static int  sr_vns_input(void* arg);
+#endif
 
 /**
  * Returns a logfile name which is in the format:
@@ -131,6 +141,9 @@ int sr_init_low_level_subystem(int argc, char **argv)
     uint16_t port =  3250;
     uint16_t topo =  0;
     int ospf = 0;
+    int fib_type = SR_FIB_TRIE;
+    int ip_chksum_trusted = 0;
+    unsigned num_workers = 0;
 
     char  *logfile = 0;
     int free_logfile = 0;
@@ -150,7 +163,7 @@ int sr_init_low_level_subystem(int argc, char **argv)
 
     sr = (struct sr_instance*) malloc(sizeof(struct sr_instance));
 
-    while ((c = getopt(argc, argv, "hna:s:v:p:t:r:l:i:u:")) != EOF)
+    while ((c = getopt(argc, argv, "hcna:s:v:p:t:r:l:i:u:f:w:m:o:")) != EOF)
     {
         switch (c)
         {
@@ -194,6 +207,36 @@ int sr_init_low_level_subystem(int argc, char **argv)
                 Debug("\nOSPF disabled!\n\n");
                 ospf = 0;
                 break;
+            case 'c':
+                ip_chksum_trusted = 1;
+                break;
+            case 'w':
+                num_workers = atoi((char *) optarg);
+                if ( num_workers > SR_WORKERS_MAX )
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                if ( lwip_conf_read(optarg) )
+                { exit(1); }
+                break;
+            case 'o':
+                if ( lwip_conf_set(optarg) )
+                { exit(1); }
+                break;
+            case 'f':
+                if ( strcmp("trie", optarg) == 0 )
+                { fib_type = SR_FIB_TRIE; }
+                else if ( strcmp("dir24", optarg) == 0 )
+                { fib_type = SR_FIB_DIR24; }
+                else
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
@@ -216,6 +259,9 @@ int sr_init_low_level_subystem(int argc, char **argv)
     strncpy(sr->auth_key_fn,auth_key_file,64);
 
     strncpy(sr->rtable, rtable, SR_NAMELEN);
+    sr->fib_type = fib_type;
+    sr->ip_chksum_trusted = ip_chksum_trusted;
+    sr->num_workers = num_workers;
 #ifdef _CPUMODE_
     sr->topo_id = 0;
     strncpy(sr->vhost,  "cpu",    SR_NAMELEN);
@@ -245,6 +291,10 @@ int sr_init_low_level_subystem(int argc, char **argv)
     sr_vns_init_log(sr, logfile);
     if( free_logfile ) free( logfile );
 
+    /* -- receive buffers and lwip's pbuf pool share the packet arena -- */
+    if ( sr_arena_init(sr_rxbuf_arena_size() + pbuf_pool_memsize()) == 0 )
+    { lwip_conf.pbuf_pool_alloc = sr_arena_carve; }
+
     sr_lwip_transport_startup();
 
 
@@ -328,18 +378,55 @@ static void sr_low_level_network_subsystem(void *arg)
     sr_get_global_instance(sr);
 
 
-#ifdef _CPUMODE_
-    /* -- whizbang main loop ;-) */
-    while( sr_cpu_input(sr) == 1);
-#else
-    /* -- whizbang main loop ;-) */
-    while( sr_vns_read_from_server(sr) == 1);
+#ifndef _CPUMODE_
+    /* -- in cpu mode sr_cpu_init_hardware(..) adds the interfaces -- */
+    if ( sr_event_add_fd(sr->events, sr->sockfd, sr_vns_input, sr) )
+    {
+        sr_destroy_instance(sr);
+        return;
+    }
+
+    /* -- commands that arrived along with the hardware info -- */
+    if ( sr_vns_have_command(sr) && sr_vns_handle_input(sr) != 1 )
+    {
+        sr_destroy_instance(sr);
+        return;
+    }
 #endif
 
+    /* -- from here on frames are handed to the workers, if any -- */
+    if ( sr->num_workers &&
+         ! (sr->workers = sr_workers_create(sr, sr->num_workers)) )
+    {
+        sr_destroy_instance(sr);
+        return;
+    }
+
+    /* -- whizbang main loop ;-) */
+    sr_event_run(sr->events);
+
+    sr_workers_destroy(sr->workers);
+    sr->workers = 0;
+
    /* -- this is the end ... my only friend .. the end -- */
     sr_destroy_instance(sr);
 } /* --  sr_low_level_network_subsystem -- */
 
+#ifndef _CPUMODE_
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_input(..)
+ * Scope: local
+ *
+ * Event loop callback for the VNS socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_input(void* arg)
+{
+    return sr_vns_handle_input((struct sr_instance*)arg);
+} /* -- sr_vns_input -- */
+#endif
+
 /*-----------------------------------------------------------------------------
  * Method: sr_lwip_transport_startup(..)
  * Scope: local
@@ -402,11 +489,23 @@ void sr_init_instance(struct sr_instance* sr)
     sr->topo_id  = 0;
     sr->logfile  = 0;
     sr->hw_init  = 0;
+    sr->fib_type = SR_FIB_TRIE;
+    sr->ip_chksum_trusted = 0;
+    sr->rx_chunk = 0;
+    sr->rx_pos   = 0;
+    sr->rx_fill  = 0;
+    sr->tx_ring  = 0;
+    sr->workers  = 0;
+    sr->num_workers = 0;
 
     sr->interface_subsystem = 0;
 
     pthread_mutex_init(&(sr->send_lock), 0);
 
+    /* -- before sr_integ_init(..), the router adds its timers to it -- */
+    if ( ! (sr->events = sr_event_create()) )
+    { die( "Error: could not create the event loop" ); }
+
     sr_integ_init(sr);
 } /* -- sr_init_instance -- */
 
@@ -418,7 +517,17 @@ void sr_init_instance(struct sr_instance* sr)
 
 static void sr_destroy_instance(struct sr_instance* sr) {
     assert(sr);
+#ifndef _CPUMODE_
+    /* -- the writer reads sr, it has to be gone first -- */
+    sr_vns_stop_tx(sr);
+    if ( sr->tx_ring )
+    {
+        sr_txring_destroy(sr->tx_ring);
+        sr->tx_ring = 0;
+    }
+#endif /* _CPUMODE_ */
     sr_integ_destroy(sr);
+    sr_event_destroy(sr->events);
     free( sr );
 }
 
@@ -432,4 +541,8 @@ static void usage(char* argv0)
     printf("Simple Router Client\n");
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-t topo id] [-r rtable_file] [-l log_file] [-i interface_file]\n");
+    printf("           [-f trie|dir24 (forwarding table, default trie)]\n");
+    printf("           [-c (trust received IP header checksums)]\n");
+    printf("           [-w workers (forwarding threads, default 0: forward on the reader)]\n");
+    printf("           [-m lwip_size_file] [-o lwip_size=value (e.g. tcp_pcbs=400, mem_size=64M)]\n");
 } /* -- usage -- */
@@ -33,12 +33,28 @@
 
 #include <stdio.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #define SR_NAMELEN 32
 
+/* -- room for the ethernet and (optionless) IP headers in front of a
+ *    segment passed to sr_integ_ip_output_v(..), and the most pieces a
+ *    frame handed to the low level output may be made of -- */
+#define SR_INTEG_IP_HEADROOM (14 + 20)
+#define SR_INTEG_MAX_IOV     64
+
 #define CPU_HW_FILENAME "cpuhw"
 
+struct sr_rxbuf;  /* -- forward declare, see sr_rxbuf.h -- */
+struct sr_txring; /* -- forward declare, see sr_txring.h -- */
+struct sr_event_loop; /* -- forward declare, see sr_event.h -- */
+struct sr_workers;    /* -- forward declare, see sr_workers.h -- */
+
+/* -- forwarding table implementations, see sr_rtable.h -- */
+#define SR_FIB_TRIE  0
+#define SR_FIB_DIR24 1
+
 /* -- gcc specific vararg macro support ... but its so nice! -- */
 #ifdef _DEBUG_
 #define Debug(x, args...) printf(x, ## args)
@@ -86,6 +102,9 @@ struct sr_instance
     char template[30]; /* template name if any */
     char auth_key_fn[64]; /* auth key filename */
     char rtable[32];/* filename for routing table          */
+    int  fib_type;  /* SR_FIB_TRIE or SR_FIB_DIR24         */
+    uint8_t ip_chksum_trusted; /* bool : skip checking received IP header
+                                  checksums (known good upstream)      */
     char server[32];
     unsigned short topo_id; /* topology id */
     struct sockaddr_in sr_addr; /* address to server */
@@ -93,6 +112,19 @@ struct sr_instance
     volatile uint8_t  hw_init; /* bool : hardware has been initialized */
     pthread_mutex_t   send_lock; /* experimental */
 
+    /* VNS read buffer, commands [rx_pos, rx_fill) not yet handled */
+    struct sr_rxbuf*  rx_chunk;
+    unsigned          rx_pos;
+    unsigned          rx_fill;
+
+    struct sr_txring* tx_ring; /* packets for the VNS writer thread */
+    pthread_t         tx_thread; /* the writer, joined by sr_vns_stop_tx */
+
+    struct sr_event_loop* events; /* run by the low level network thread */
+
+    unsigned           num_workers; /* -w, 0 to forward on the packet thread */
+    struct sr_workers* workers;     /* set while they are running            */
+
     void* interface_subsystem; /* subsystem to send/recv packets from */
 };
 
@@ -116,7 +148,7 @@ void sr_integ_init(struct sr_instance* );
 void sr_integ_hw_setup(struct sr_instance* ); /* called after hwinfo */
 void sr_integ_destroy(struct sr_instance* );
 void sr_integ_input(struct sr_instance* sr,
-                   const uint8_t * packet/* borrowed */,
+                   uint8_t * packet/* lent */,
                    unsigned int len,
                    const char* interface/* borrowed */);
 void sr_integ_add_interface(struct sr_instance*,
@@ -133,6 +165,13 @@ uint32_t sr_integ_ip_output(uint8_t* payload /* given */,
                             uint32_t src, /* nbo */
                             uint32_t dest, /* nbo */
                             int len);
+/* -- iov[0] is SR_INTEG_IP_HEADROOM bytes to put the headers in, the
+ *    segment follows in iov[1] .. iov[iovcnt - 1], all lent -- */
+uint32_t sr_integ_ip_output_v(struct iovec* iov /* lent */,
+                              int iovcnt,
+                              uint8_t  proto,
+                              uint32_t src, /* nbo */
+                              uint32_t dest /* nbo */);
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
 
 
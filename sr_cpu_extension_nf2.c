@@ -12,6 +12,7 @@
 #include "sr_cpu_extension_nf2.h"
 
 #include "sr_base_internal.h"
+#include "sr_protocol.h"
 
 #include "sr_vns.h"
 
@@ -25,16 +26,6 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
-struct sr_ethernet_hdr
-{
-#ifndef ETHER_ADDR_LEN
-#define ETHER_ADDR_LEN 6
-#endif
-    uint8_t  ether_dhost[ETHER_ADDR_LEN];    /* destination ethernet address */
-    uint8_t  ether_shost[ETHER_ADDR_LEN];    /* source ethernet address */
-    uint16_t ether_type;                     /* packet type ID */
-} __attribute__ ((packed)) ;
-
 static char*    copy_next_field(FILE* fp, char*  line, char* buf);
 static uint32_t asci_to_nboip(const char* ip);
 static void     asci_to_ether(const char* addr, uint8_t mac[6]);
@@ -147,6 +138,14 @@ int sr_cpu_input(struct sr_instance* sr)
 
     /*
      * TODO: Read packet from the hardware and pass to sr_integ_input(..)
+     *       This runs on the event loop of the packet thread, so it must
+     *       not block: have sr_cpu_init_hardware(..) open the interfaces
+     *       and add each descriptor with sr_event_add_fd(sr->events, ..)
+     *       with a callback that calls this method.  Read each frame
+     *       into a buffer from sr_rxbuf_alloc(..) (carved from the packet
+     *       arena, see sr_arena.h) and mark it with
+     *       sr_rxbuf_set_current(..) around the call, so the TCP stack
+     *       can keep the frame without a copy; sr_rxbuf_put(..) after.
      *       e.g.
      *
      *  sr_integ_input(sr,
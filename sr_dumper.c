@@ -32,8 +32,11 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
     h.caplen = size;
     h.len = (size < SR_PACKET_DUMP_SIZE) ? size : SR_PACKET_DUMP_SIZE;
 
+    /* -- frames may be logged from several threads at once -- */
+    flockfile(sr->logfile);
     sr_dump(sr->logfile, &h, buf);
     fflush(sr->logfile);
+    funlockfile(sr->logfile);
 } /* -- sr_log_packet -- */
 
 static void
@@ -0,0 +1,195 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_epoch.c
+ *
+ * Description:
+ *
+ * Each reading thread owns a record holding the global epoch it entered
+ * its read section at (0 while outside).  sr_epoch_synchronize() bumps the
+ * global epoch and spins until no record is still in an older epoch.
+ *
+ * Records are registered the first time a thread reads.  When the thread
+ * exits its record is marked free and taken over by the next thread that
+ * registers, so the list only grows to the most threads alive at once
+ * (CLI sessions come and go).  Records are never unlinked, which keeps the
+ * scan in sr_epoch_synchronize() lock free with respect to registration.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "sr_epoch.h"
+
+struct sr_epoch_reader
+{
+    struct sr_epoch_reader* next;
+    unsigned long           epoch; /* 0 if quiescent */
+    unsigned                nest;  /* only touched by the owner */
+    int                     used;  /* bool : owned by a live thread */
+};
+
+static unsigned long sr_epoch_global = 1;
+static struct sr_epoch_reader* sr_epoch_readers = 0;
+static pthread_mutex_t sr_epoch_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct sr_epoch_reader* sr_epoch_self = 0;
+
+static pthread_once_t sr_epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  sr_epoch_key;
+
+static struct sr_epoch_reader* sr_epoch_register(void);
+static void sr_epoch_key_init(void);
+static void sr_epoch_release(void* arg);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_epoch_enter(..)
+ * Scope: global
+ *
+ * The full fence orders our epoch store before the loads of the read
+ * section; synchronize has the matching fence between unpublishing and
+ * scanning, so either it sees us or we see the unpublished state.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_epoch_enter(void)
+{
+    struct sr_epoch_reader* self = sr_epoch_self;
+
+    if ( ! self )
+    { self = sr_epoch_register(); }
+
+    if ( self->nest++ )
+    { return; }
+
+    __atomic_store_n(&(self->epoch),
+                     __atomic_load_n(&sr_epoch_global, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+} /* -- sr_epoch_enter -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_epoch_exit(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_epoch_exit(void)
+{
+    struct sr_epoch_reader* self = sr_epoch_self;
+
+    /* REQUIRES */
+    assert(self && self->nest);
+
+    if ( --self->nest )
+    { return; }
+
+    __atomic_store_n(&(self->epoch), 0, __ATOMIC_RELEASE);
+} /* -- sr_epoch_exit -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_epoch_synchronize(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_epoch_synchronize(void)
+{
+    struct sr_epoch_reader* r;
+    unsigned long target, e;
+
+    /* REQUIRES */
+    assert( ! sr_epoch_self || ! sr_epoch_self->nest );
+
+    pthread_mutex_lock(&sr_epoch_sync_lock);
+
+    target = __atomic_add_fetch(&sr_epoch_global, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for ( r = __atomic_load_n(&sr_epoch_readers, __ATOMIC_ACQUIRE); r;
+          r = r->next )
+    {
+        while ( (e = __atomic_load_n(&(r->epoch), __ATOMIC_ACQUIRE)) &&
+                e < target )
+        { sched_yield(); }
+    }
+
+    pthread_mutex_unlock(&sr_epoch_sync_lock);
+} /* -- sr_epoch_synchronize -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_epoch_register(..)
+ * Scope: local
+ *
+ * Take over a record a finished thread left behind, or push a new one onto
+ * the reader list.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_epoch_reader* sr_epoch_register(void)
+{
+    struct sr_epoch_reader* self;
+    int unused;
+
+    pthread_once(&sr_epoch_once, sr_epoch_key_init);
+
+    for ( self = __atomic_load_n(&sr_epoch_readers, __ATOMIC_ACQUIRE); self;
+          self = self->next )
+    {
+        unused = 0;
+        if ( ! __atomic_load_n(&(self->used), __ATOMIC_RELAXED) &&
+             __atomic_compare_exchange_n(&(self->used), &unused, 1, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+        { break; }
+    }
+
+    if ( ! self )
+    {
+        if ( ! (self = (struct sr_epoch_reader*)calloc(1,
+                                            sizeof(struct sr_epoch_reader))) )
+        {
+            fprintf(stderr, "Error: out of memory (sr_epoch_register)\n");
+            exit(1);
+        }
+        self->used = 1;
+
+        self->next = __atomic_load_n(&sr_epoch_readers, __ATOMIC_RELAXED);
+        while ( ! __atomic_compare_exchange_n(&sr_epoch_readers, &(self->next),
+                                              self, 0, __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED) )
+        { }
+    }
+
+    pthread_setspecific(sr_epoch_key, self);
+    sr_epoch_self = self;
+    return self;
+} /* -- sr_epoch_register -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_epoch_key_init(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_epoch_key_init(void)
+{
+    if ( pthread_key_create(&sr_epoch_key, sr_epoch_release) )
+    { fprintf(stderr, "Error: can't create key (sr_epoch_key_init)\n"); }
+} /* -- sr_epoch_key_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_epoch_release(..)
+ * Scope: local
+ *
+ * Thread exit: hand the record back for the next thread to register.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_epoch_release(void* arg)
+{
+    struct sr_epoch_reader* self = (struct sr_epoch_reader*)arg;
+
+    self->nest = 0;
+    __atomic_store_n(&(self->epoch), 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&(self->used), 0, __ATOMIC_RELEASE);
+    sr_epoch_self = 0;
+} /* -- sr_epoch_release -- */
@@ -0,0 +1,43 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_epoch.h
+ *
+ * Description:
+ *
+ * Epoch based reclamation for tables that are read on the forwarding path
+ * and written from the CLI (routing table, ARP cache).  Readers bracket
+ * their lookups with sr_epoch_enter()/sr_epoch_exit() which never block.
+ * Writers publish changes with sr_rcu_assign(), then call
+ * sr_epoch_synchronize() which waits until every reader that might still
+ * see the old data has left its read section, after which the old data
+ * may be freed.
+ *
+ * Writers are expected to serialize among themselves (e.g. with the
+ * table's own mutex); readers never touch that mutex.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EPOCH_H
+#define SR_EPOCH_H
+
+/* -- publish v in p, everything written before is visible to readers of p -- */
+#define sr_rcu_assign(p, v)  __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/* -- read a pointer (or index) published with sr_rcu_assign -- */
+#define sr_rcu_deref(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+/**
+ * Enter a read section on the calling thread.  Sections nest.  Data
+ * reached through sr_rcu_deref(..) stays valid until the matching
+ * sr_epoch_exit().  Does not block and, after the first call on a thread,
+ * does not allocate.
+ */
+void sr_epoch_enter(void);
+void sr_epoch_exit(void);
+
+/**
+ * Wait until all read sections that were active when called have exited.
+ * Must not be called from inside a read section.
+ */
+void sr_epoch_synchronize(void);
+
+#endif  /* -- SR_EPOCH_H -- */
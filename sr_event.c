@@ -0,0 +1,576 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.c
+ *
+ * Description:
+ *
+ * Event loop of the packet thread, see sr_event.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif /* _LINUX_ */
+
+#include "sr_event.h"
+
+#define SR_EVENT_TIMER_SLOT SR_EVENT_MAX_FDS       /* epoll data of timer_fd */
+#define SR_EVENT_WAKE_SLOT  (SR_EVENT_MAX_FDS + 1) /* epoll data of wake_fd  */
+
+static uint64_t sr_event_now(void);
+static int  sr_event_next_due(struct sr_event_loop* loop, uint64_t* due);
+static void sr_event_arm(struct sr_event_loop* loop);
+static void sr_event_run_timers(struct sr_event_loop* loop);
+static void sr_event_run_calls(struct sr_event_loop* loop);
+static void sr_event_wake(struct sr_event_loop* loop);
+static void sr_event_drain(int fd);
+static int  sr_event_dispatch_fd(struct sr_event_loop* loop, unsigned i);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_create(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_event_loop* sr_event_create(void)
+{
+    struct sr_event_loop* loop;
+    unsigned i;
+
+    if ( ! (loop = (struct sr_event_loop*)calloc(1, sizeof(struct sr_event_loop))) )
+    { return 0; }
+
+    for ( i = 0; i < SR_EVENT_MAX_FDS; ++i )
+    { loop->fds[i].fd = -1; }
+    loop->poll_fd = loop->timer_fd = loop->wake_fd = loop->wake_wr = -1;
+
+#ifdef _LINUX_
+    {
+        struct epoll_event ev;
+
+        loop->poll_fd  = epoll_create1(EPOLL_CLOEXEC);
+        loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                        TFD_NONBLOCK | TFD_CLOEXEC);
+        loop->wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->wake_wr  = loop->wake_fd;
+        if ( loop->poll_fd < 0 || loop->timer_fd < 0 || loop->wake_fd < 0 )
+        {
+            perror("sr_event_create");
+            sr_event_destroy(loop);
+            return 0;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN;
+        ev.data.u32 = SR_EVENT_TIMER_SLOT;
+        if ( epoll_ctl(loop->poll_fd, EPOLL_CTL_ADD, loop->timer_fd, &ev) == 0 )
+        {
+            ev.data.u32 = SR_EVENT_WAKE_SLOT;
+            if ( epoll_ctl(loop->poll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) == 0 )
+            { ev.events = 0; }
+        }
+        if ( ev.events )
+        {
+            perror("epoll_ctl");
+            sr_event_destroy(loop);
+            return 0;
+        }
+    }
+#else
+    {
+        int p[2];
+
+        if ( pipe(p) )
+        {
+            perror("pipe");
+            sr_event_destroy(loop);
+            return 0;
+        }
+        fcntl(p[0], F_SETFL, O_NONBLOCK);
+        fcntl(p[1], F_SETFL, O_NONBLOCK);
+        loop->wake_fd = p[0];
+        loop->wake_wr = p[1];
+    }
+#endif /* _LINUX_ */
+
+    pthread_mutex_init(&(loop->lock), 0);
+
+    return loop;
+} /* -- sr_event_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_destroy(..)
+ * Scope: global
+ *
+ * Closes the loop's own descriptors, not the ones added to it.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_event_destroy(struct sr_event_loop* loop)
+{
+    if ( ! loop )
+    { return; }
+
+    if ( loop->wake_wr >= 0 && loop->wake_wr != loop->wake_fd )
+    { close(loop->wake_wr); }
+    if ( loop->wake_fd >= 0 )
+    { close(loop->wake_fd); }
+    if ( loop->timer_fd >= 0 )
+    { close(loop->timer_fd); }
+    if ( loop->poll_fd >= 0 )
+    { close(loop->poll_fd); }
+
+    pthread_mutex_destroy(&(loop->lock));
+    free(loop);
+} /* -- sr_event_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_add_fd(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int sr_event_add_fd(struct sr_event_loop* loop, int fd,
+                    sr_event_fd_fn fn, void* arg)
+{
+    unsigned i;
+
+    /* REQUIRES */
+    assert(loop);
+    assert(fn);
+
+    for ( i = 0; i < SR_EVENT_MAX_FDS; ++i )
+    {
+        if ( loop->fds[i].fd == -1 )
+        { break; }
+    }
+    if ( i == SR_EVENT_MAX_FDS )
+    {
+        fprintf(stderr, "Error: too many descriptors (sr_event_add_fd)\n");
+        return -1;
+    }
+
+#ifdef _LINUX_
+    {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN;
+        ev.data.u32 = i;
+        if ( epoll_ctl(loop->poll_fd, EPOLL_CTL_ADD, fd, &ev) )
+        {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+#endif /* _LINUX_ */
+
+    loop->fds[i].fn  = fn;
+    loop->fds[i].arg = arg;
+    loop->fds[i].fd  = fd;
+
+    return 0;
+} /* -- sr_event_add_fd -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_del_fd(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_event_del_fd(struct sr_event_loop* loop, int fd)
+{
+    unsigned i;
+
+    for ( i = 0; i < SR_EVENT_MAX_FDS; ++i )
+    {
+        if ( loop->fds[i].fd != fd )
+        { continue; }
+
+#ifdef _LINUX_
+        /* -- fails harmlessly if fd was closed already -- */
+        epoll_ctl(loop->poll_fd, EPOLL_CTL_DEL, fd, 0);
+#endif /* _LINUX_ */
+        loop->fds[i].fd = -1;
+        return;
+    }
+} /* -- sr_event_del_fd -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_add_timer(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int sr_event_add_timer(struct sr_event_loop* loop, unsigned period_ms,
+                       sr_event_fn fn, void* arg)
+{
+    int i;
+
+    /* REQUIRES */
+    assert(loop);
+    assert(fn);
+    assert(period_ms > 0);
+
+    for ( i = 0; i < SR_EVENT_MAX_TIMERS; ++i )
+    {
+        if ( ! loop->timers[i].fn )
+        { break; }
+    }
+    if ( i == SR_EVENT_MAX_TIMERS )
+    {
+        fprintf(stderr, "Error: too many timers (sr_event_add_timer)\n");
+        return -1;
+    }
+
+    loop->timers[i].arg       = arg;
+    loop->timers[i].period_ms = period_ms;
+    loop->timers[i].due       = sr_event_now() + period_ms;
+    loop->timers[i].fn        = fn;
+
+    sr_event_arm(loop);
+
+    return i;
+} /* -- sr_event_add_timer -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_del_timer(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_event_del_timer(struct sr_event_loop* loop, int id)
+{
+    if ( id < 0 || id >= SR_EVENT_MAX_TIMERS )
+    { return; }
+
+    loop->timers[id].fn = 0;
+    sr_event_arm(loop);
+} /* -- sr_event_del_timer -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_call(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int sr_event_call(struct sr_event_loop* loop, sr_event_fn fn, void* arg)
+{
+    struct sr_event_call* c;
+
+    /* REQUIRES */
+    assert(loop);
+    assert(fn);
+
+    pthread_mutex_lock(&(loop->lock));
+    if ( loop->call_tail - loop->call_head == SR_EVENT_MAX_CALLS )
+    {
+        loop->calls_dropped++;
+        pthread_mutex_unlock(&(loop->lock));
+        return -1;
+    }
+    c = &(loop->calls[loop->call_tail % SR_EVENT_MAX_CALLS]);
+    c->fn  = fn;
+    c->arg = arg;
+    loop->call_tail++;
+    pthread_mutex_unlock(&(loop->lock));
+
+    sr_event_wake(loop);
+
+    return 0;
+} /* -- sr_event_call -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_stop(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_event_stop(struct sr_event_loop* loop)
+{
+    loop->stop = 1;
+    sr_event_wake(loop);
+} /* -- sr_event_stop -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_run(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int sr_event_run(struct sr_event_loop* loop)
+{
+    int ret = 1;
+    int n, i;
+
+    /* REQUIRES */
+    assert(loop);
+
+    sr_event_arm(loop);
+
+    while ( ret == 1 && ! loop->stop )
+    {
+#ifdef _LINUX_
+        struct epoll_event evs[SR_EVENT_MAX_FDS + 2];
+
+        n = epoll_wait(loop->poll_fd, evs, SR_EVENT_MAX_FDS + 2, -1);
+#else
+        struct pollfd pfds[SR_EVENT_MAX_FDS + 1];
+        unsigned slot[SR_EVENT_MAX_FDS + 1];
+        uint64_t due = 0, now;
+        int timeout = -1;
+
+        n = 0;
+        for ( i = 0; i < SR_EVENT_MAX_FDS; ++i )
+        {
+            if ( loop->fds[i].fd == -1 )
+            { continue; }
+            pfds[n].fd     = loop->fds[i].fd;
+            pfds[n].events = POLLIN;
+            slot[n++]      = i;
+        }
+        pfds[n].fd     = loop->wake_fd;
+        pfds[n].events = POLLIN;
+        slot[n++]      = SR_EVENT_WAKE_SLOT;
+
+        if ( sr_event_next_due(loop, &due) )
+        {
+            now = sr_event_now();
+            timeout = due > now ? (int)(due - now) : 0;
+        }
+
+        n = poll(pfds, n, timeout);
+#endif /* _LINUX_ */
+
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            perror("sr_event_run");
+            return -1;
+        }
+        loop->wakeups++;
+
+#ifdef _LINUX_
+        for ( i = 0; i < n && ret == 1; ++i )
+        {
+            if ( evs[i].data.u32 == SR_EVENT_TIMER_SLOT )
+            {
+                sr_event_drain(loop->timer_fd);
+                sr_event_run_timers(loop);
+            }
+            else if ( evs[i].data.u32 == SR_EVENT_WAKE_SLOT )
+            { sr_event_drain(loop->wake_fd); }
+            else
+            { ret = sr_event_dispatch_fd(loop, evs[i].data.u32); }
+        }
+#else
+        for ( i = 0; n > 0 && i < SR_EVENT_MAX_FDS + 1 && ret == 1; ++i )
+        {
+            if ( ! pfds[i].revents )
+            { continue; }
+            --n;
+            if ( slot[i] == SR_EVENT_WAKE_SLOT )
+            { sr_event_drain(loop->wake_fd); }
+            else
+            { ret = sr_event_dispatch_fd(loop, slot[i]); }
+        }
+        sr_event_run_timers(loop);
+#endif /* _LINUX_ */
+
+        sr_event_run_calls(loop);
+    }
+
+    return ret < 0 ? -1 : 0;
+} /* -- sr_event_run -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_dispatch_fd(..)
+ * Scope: local
+ *
+ * The slot may have been emptied by an earlier callback of the same round.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_event_dispatch_fd(struct sr_event_loop* loop, unsigned i)
+{
+    if ( i >= SR_EVENT_MAX_FDS || loop->fds[i].fd == -1 )
+    { return 1; }
+
+    return loop->fds[i].fn(loop->fds[i].arg);
+} /* -- sr_event_dispatch_fd -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_run_timers(..)
+ * Scope: local
+ *
+ * A timer that fell more than a period behind skips the missed runs rather
+ * than firing back to back.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_event_run_timers(struct sr_event_loop* loop)
+{
+    struct sr_event_timer* t;
+    uint64_t now = sr_event_now();
+    unsigned i;
+
+    for ( i = 0; i < SR_EVENT_MAX_TIMERS; ++i )
+    {
+        t = &(loop->timers[i]);
+        if ( ! t->fn || t->due > now )
+        { continue; }
+
+        t->due += t->period_ms;
+        if ( t->due <= now )
+        { t->due = now + t->period_ms; }
+
+        loop->timer_runs++;
+        t->fn(t->arg);
+    }
+
+    sr_event_arm(loop);
+} /* -- sr_event_run_timers -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_run_calls(..)
+ * Scope: local
+ *
+ * Only runs the calls queued when it started, calls that post more calls
+ * get them run on the next round.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_event_run_calls(struct sr_event_loop* loop)
+{
+    struct sr_event_call c;
+    unsigned todo;
+
+    pthread_mutex_lock(&(loop->lock));
+    todo = loop->call_tail - loop->call_head;
+    while ( todo-- )
+    {
+        c = loop->calls[loop->call_head % SR_EVENT_MAX_CALLS];
+        loop->call_head++;
+        pthread_mutex_unlock(&(loop->lock));
+
+        loop->calls_run++;
+        c.fn(c.arg);
+
+        pthread_mutex_lock(&(loop->lock));
+    }
+    pthread_mutex_unlock(&(loop->lock));
+} /* -- sr_event_run_calls -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_next_due(..)
+ * Scope: local
+ *
+ * Earliest deadline of any timer, returns 0 if there are no timers.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_event_next_due(struct sr_event_loop* loop, uint64_t* due)
+{
+    int found = 0;
+    unsigned i;
+
+    for ( i = 0; i < SR_EVENT_MAX_TIMERS; ++i )
+    {
+        if ( ! loop->timers[i].fn )
+        { continue; }
+        if ( ! found || loop->timers[i].due < *due )
+        { *due = loop->timers[i].due; }
+        found = 1;
+    }
+
+    return found;
+} /* -- sr_event_next_due -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_arm(..)
+ * Scope: local
+ *
+ * Point timer_fd at the earliest deadline (absolute, so time spent between
+ * here and epoll_wait(..) doesn't push it back), or disarm it.  poll(..)
+ * computes its timeout on every round instead.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_event_arm(struct sr_event_loop* loop)
+{
+#ifdef _LINUX_
+    struct itimerspec its;
+    uint64_t due = 0;
+
+    memset(&its, 0, sizeof(its));
+    if ( sr_event_next_due(loop, &due) )
+    {
+        /* -- an all zero it_value would disarm the timer -- */
+        if ( due == 0 )
+        { due = 1; }
+        its.it_value.tv_sec  = due / 1000;
+        its.it_value.tv_nsec = (due % 1000) * 1000000;
+    }
+
+    if ( timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &its, 0) )
+    { perror("timerfd_settime"); }
+#else
+    (void)loop;
+#endif /* _LINUX_ */
+} /* -- sr_event_arm -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_wake(..)
+ * Scope: local
+ *
+ * Make wake_fd readable.  Writing to a full pipe or an eventfd at its limit
+ * fails with EAGAIN, which is fine: the loop is being woken anyway.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_event_wake(struct sr_event_loop* loop)
+{
+    ssize_t ret;
+
+#ifdef _LINUX_
+    uint64_t one = 1;
+    ret = write(loop->wake_wr, &one, sizeof(one));
+#else
+    ret = write(loop->wake_wr, "", 1);
+#endif /* _LINUX_ */
+    (void)ret;
+} /* -- sr_event_wake -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_drain(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_event_drain(int fd)
+{
+    uint8_t buf[64];
+
+    while ( read(fd, buf, sizeof(buf)) > 0 )
+    { }
+} /* -- sr_event_drain -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_now(..)
+ * Scope: local
+ *
+ * Monotonic milliseconds, the clock timer_fd runs on.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint64_t sr_event_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* -- sr_event_now -- */
@@ -0,0 +1,130 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.h
+ *
+ * Description:
+ *
+ * Event loop run by the low level network thread.  It waits on the input
+ * descriptors (the VNS socket, or the interfaces in cpu mode), fires the
+ * periodic timers of the router (ARP retries and expiry, ...) and runs
+ * calls posted by other threads, so all of that work happens on the packet
+ * thread and the thread only wakes up when there is something to do.
+ *
+ * On linux the loop is an epoll set holding the input descriptors, a
+ * timerfd armed for the earliest timer and an eventfd other threads write
+ * to.  Elsewhere it falls back to poll(..) with a timeout and a pipe.
+ *
+ * Descriptors and timers are added and removed either before
+ * sr_event_run(..) or from the loop thread itself.  sr_event_call(..) and
+ * sr_event_stop(..) are for any thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EVENT_H
+#define SR_EVENT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#define SR_EVENT_MAX_FDS    16
+#define SR_EVENT_MAX_TIMERS 16
+#define SR_EVENT_MAX_CALLS  256 /* posted calls waiting for the loop */
+
+/**
+ * Called when fd is readable.  Return 1 to keep the loop going, 0 to end
+ * it (e.g. the peer closed) or -1 to end it with an error.
+ */
+typedef int  (*sr_event_fd_fn)(void* arg);
+
+/** Timer callbacks and posted calls */
+typedef void (*sr_event_fn)(void* arg);
+
+struct sr_event_fd
+{
+    int            fd;  /* -1 if the slot is free */
+    sr_event_fd_fn fn;
+    void*          arg;
+};
+
+struct sr_event_timer
+{
+    sr_event_fn fn;  /* 0 if the slot is free */
+    void*       arg;
+    unsigned    period_ms;
+    uint64_t    due; /* ms, monotonic clock */
+};
+
+struct sr_event_call
+{
+    sr_event_fn fn;
+    void*       arg;
+};
+
+struct sr_event_loop
+{
+    int poll_fd;  /* epoll set, -1 when using poll(..)         */
+    int timer_fd; /* timerfd, -1 when using poll(..)           */
+    int wake_fd;  /* eventfd, or read end of the wakeup pipe   */
+    int wake_wr;  /* write end of the wakeup pipe, or wake_fd  */
+
+    volatile int stop;
+
+    struct sr_event_fd    fds[SR_EVENT_MAX_FDS];
+    struct sr_event_timer timers[SR_EVENT_MAX_TIMERS];
+
+    /* -- posted calls, a ring under lock -- */
+    pthread_mutex_t       lock;
+    struct sr_event_call  calls[SR_EVENT_MAX_CALLS];
+    unsigned              call_head;
+    unsigned              call_tail;
+
+    /* -- stats -- */
+    unsigned long         wakeups;
+    unsigned long         timer_runs;
+    unsigned long         calls_run;
+    unsigned long         calls_dropped; /* ring was full */
+};
+
+struct sr_event_loop* sr_event_create(void);
+void sr_event_destroy(struct sr_event_loop* loop);
+
+/**
+ * Run fn(arg) on the loop thread whenever fd is readable.
+ * @return 0 on success, -1 if the table is full or fd can't be watched
+ */
+int  sr_event_add_fd(struct sr_event_loop* loop, int fd,
+                     sr_event_fd_fn fn, void* arg);
+void sr_event_del_fd(struct sr_event_loop* loop, int fd);
+
+/**
+ * Run fn(arg) on the loop thread every period_ms, starting period_ms from
+ * now.  Timers never fire early but may fire late by however long the
+ * loop is busy with input.
+ * @return a timer id (>= 0) for sr_event_del_timer(..), -1 on error
+ */
+int  sr_event_add_timer(struct sr_event_loop* loop, unsigned period_ms,
+                        sr_event_fn fn, void* arg);
+void sr_event_del_timer(struct sr_event_loop* loop, int id);
+
+/**
+ * Have the loop thread run fn(arg) soon.  Any thread, never blocks.
+ * @return 0 on success, -1 if too many calls are waiting
+ */
+int  sr_event_call(struct sr_event_loop* loop, sr_event_fn fn, void* arg);
+
+/** Make sr_event_run(..) return 0 after the current round.  Any thread. */
+void sr_event_stop(struct sr_event_loop* loop);
+
+/**
+ * Dispatch until an input callback ends the loop or sr_event_stop(..)
+ * is called.  Returns 0, or -1 on error.
+ */
+int  sr_event_run(struct sr_event_loop* loop);
+
+#endif  /* -- SR_EVENT_H -- */
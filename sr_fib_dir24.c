@@ -0,0 +1,497 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib_dir24.c
+ *
+ * Description:
+ *
+ * DIR-24-8 forwarding table, see sr_fib_dir24.h for the layout.
+ *
+ * Updates are incremental.  Adding a prefix only touches the tbl24 range
+ * (or tbl8 group) it covers and only overwrites entries whose depth is not
+ * longer than its own.  Removing a prefix rewrites exactly the entries
+ * whose depth equals its length with the next longest covering prefix,
+ * then folds a tbl8 group back into tbl24 if it became uniform.
+ *
+ * Every entry goes from one valid value straight to the next with a single
+ * published 16 bit store, so lock free readers see either the old or the
+ * new route, never a hole.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <arpa/inet.h>
+
+#include "sr_fib_dir24.h"
+#include "sr_rtable.h"
+#include "sr_epoch.h"
+
+static uint16_t sr_dir24_nh_get(struct sr_fib_dir24* d,
+                                struct sr_router_if* intf, uint32_t gw);
+static uint16_t sr_dir24_nh_find(struct sr_fib_dir24* d,
+                                 const struct sr_rt* rt);
+static void sr_dir24_fill(uint16_t* tbl, uint8_t* depth, unsigned count,
+                          uint16_t nh, uint8_t plen);
+static void sr_dir24_replace(uint16_t* tbl, uint8_t* depth, unsigned count,
+                             uint8_t plen, uint16_t nh, uint8_t nh_plen);
+static int  sr_dir24_group_split(struct sr_fib_dir24* d, uint32_t i);
+static void sr_dir24_group_fold(struct sr_fib_dir24* d, uint32_t i);
+static void sr_dir24_nh_put(struct sr_fib_dir24* d, uint16_t nh);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_dir24_create(..)
+ * Scope: global
+ *
+ * The tables are big (~54MB) but calloc hands back untouched zero pages, so
+ * only the parts covered by routes are ever faulted in.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_fib_dir24* sr_fib_dir24_create(void)
+{
+    struct sr_fib_dir24* d;
+    unsigned g;
+
+    if ( ! (d = (struct sr_fib_dir24*)calloc(1, sizeof(struct sr_fib_dir24))) )
+    { return 0; }
+
+    d->tbl24       = (uint16_t*)calloc(SR_DIR24_TBL24_SIZE, sizeof(uint16_t));
+    d->tbl24_depth = (uint8_t*) calloc(SR_DIR24_TBL24_SIZE, sizeof(uint8_t));
+    d->tbl8        = (uint16_t*)calloc(SR_DIR24_MAX_GROUPS * SR_DIR24_GROUP_SIZE,
+                                       sizeof(uint16_t));
+    d->tbl8_depth  = (uint8_t*) calloc(SR_DIR24_MAX_GROUPS * SR_DIR24_GROUP_SIZE,
+                                       sizeof(uint8_t));
+    d->free_groups = (uint16_t*)calloc(SR_DIR24_MAX_GROUPS, sizeof(uint16_t));
+    d->retired_groups = (uint16_t*)calloc(SR_DIR24_MAX_GROUPS, sizeof(uint16_t));
+    d->nh          = (struct sr_dir24_nh*)calloc(SR_DIR24_MAX_NH,
+                                                 sizeof(struct sr_dir24_nh));
+
+    if ( ! d->tbl24 || ! d->tbl24_depth || ! d->tbl8 || ! d->tbl8_depth ||
+         ! d->free_groups || ! d->retired_groups || ! d->nh )
+    {
+        fprintf(stderr, "Error: out of memory (sr_fib_dir24_create)\n");
+        sr_fib_dir24_destroy(d);
+        return 0;
+    }
+
+    /* -- hand out low groups first -- */
+    for ( g = 0; g < SR_DIR24_MAX_GROUPS; ++g )
+    { d->free_groups[g] = SR_DIR24_MAX_GROUPS - 1 - g; }
+    d->num_free_groups = SR_DIR24_MAX_GROUPS;
+
+    return d;
+} /* -- sr_fib_dir24_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_dir24_destroy(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_fib_dir24_destroy(struct sr_fib_dir24* d)
+{
+    if ( ! d )
+    { return; }
+
+    free(d->tbl24);
+    free(d->tbl24_depth);
+    free(d->tbl8);
+    free(d->tbl8_depth);
+    free(d->free_groups);
+    free(d->retired_groups);
+    free(d->nh);
+    free(d);
+} /* -- sr_fib_dir24_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_dir24_insert(..)
+ * Scope: global
+ *
+ * Add rt.  If rt replaces a route with the same prefix and length the
+ * caller passes it as old so its next hop reference can be dropped.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success, -1 if the table is out of next hops or tbl8 groups
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_fib_dir24_insert(struct sr_fib_dir24* d, struct sr_rt* rt,
+                        const struct sr_rt* old)
+{
+    uint32_t prefix, i, g;
+    unsigned count;
+    uint16_t nh, old_nh;
+
+    /* REQUIRES */
+    assert(d);
+    assert(rt);
+
+    old_nh = old ? sr_dir24_nh_find(d, old) : 0;
+
+    if ( (nh = sr_dir24_nh_get(d, rt->intf, rt->gw)) == 0 )
+    {
+        fprintf(stderr, "Error: DIR-24-8 next hop table is full\n");
+        return -1;
+    }
+
+    prefix = ntohl(rt->dest);
+
+    if ( rt->plen == 0 )
+    { sr_rcu_assign(d->dflt, nh); }
+    else if ( rt->plen <= 24 )
+    {
+        count = 1 << (24 - rt->plen);
+        for ( i = prefix >> 8; count; ++i, --count )
+        {
+            if ( d->tbl24[i] & SR_DIR24_EXT )
+            {
+                g = d->tbl24[i] & ~SR_DIR24_EXT;
+                sr_dir24_fill(d->tbl8 + g * SR_DIR24_GROUP_SIZE,
+                              d->tbl8_depth + g * SR_DIR24_GROUP_SIZE,
+                              SR_DIR24_GROUP_SIZE, nh, rt->plen);
+            }
+            else
+            { sr_dir24_fill(d->tbl24 + i, d->tbl24_depth + i, 1, nh, rt->plen); }
+        }
+    }
+    else
+    {
+        i = prefix >> 8;
+        if ( ! (d->tbl24[i] & SR_DIR24_EXT) && sr_dir24_group_split(d, i) )
+        {
+            fprintf(stderr, "Error: DIR-24-8 is out of tbl8 groups\n");
+            sr_dir24_nh_put(d, nh);
+            return -1;
+        }
+
+        g = d->tbl24[i] & ~SR_DIR24_EXT;
+        sr_dir24_fill(d->tbl8 + g * SR_DIR24_GROUP_SIZE + (prefix & 0xff),
+                      d->tbl8_depth + g * SR_DIR24_GROUP_SIZE + (prefix & 0xff),
+                      1 << (32 - rt->plen), nh, rt->plen);
+    }
+
+    if ( old_nh )
+    { sr_dir24_nh_put(d, old_nh); }
+
+    return 0;
+} /* -- sr_fib_dir24_insert -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_dir24_remove(..)
+ * Scope: global
+ *
+ * Remove rt.  Every entry rt owned (depth == rt->plen within its range)
+ * falls back to the longest remaining prefix covering rt, found by a walk
+ * over the route list that the caller passes with rt already unlinked.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_fib_dir24_remove(struct sr_fib_dir24* d, struct sr_rt* rt,
+                         struct sr_rt* remaining)
+{
+    struct sr_rt* r;
+    struct sr_rt* cover = 0;
+    uint32_t prefix, i, g;
+    unsigned count;
+    uint16_t nh, rep = 0;
+    uint8_t rep_plen = 0;
+
+    /* REQUIRES */
+    assert(d);
+    assert(rt);
+
+    if ( (nh = sr_dir24_nh_find(d, rt)) == 0 )
+    { return; } /* -- never inserted -- */
+
+    if ( rt->plen == 0 )
+    {
+        sr_rcu_assign(d->dflt, (uint16_t)0);
+        sr_dir24_nh_put(d, nh);
+        return;
+    }
+
+    /* -- the default route is consulted on a miss, it needs no entries -- */
+    for ( r = remaining; r; r = r->next )
+    {
+        if ( r->plen > 0 && r->plen < rt->plen &&
+             (rt->dest & r->mask) == r->dest &&
+             ( ! cover || r->plen > cover->plen ) )
+        { cover = r; }
+    }
+    if ( cover )
+    {
+        rep      = sr_dir24_nh_find(d, cover);
+        rep_plen = cover->plen;
+    }
+
+    prefix = ntohl(rt->dest);
+
+    if ( rt->plen <= 24 )
+    {
+        count = 1 << (24 - rt->plen);
+        for ( i = prefix >> 8; count; ++i, --count )
+        {
+            if ( d->tbl24[i] & SR_DIR24_EXT )
+            {
+                g = d->tbl24[i] & ~SR_DIR24_EXT;
+                sr_dir24_replace(d->tbl8 + g * SR_DIR24_GROUP_SIZE,
+                                 d->tbl8_depth + g * SR_DIR24_GROUP_SIZE,
+                                 SR_DIR24_GROUP_SIZE, rt->plen, rep, rep_plen);
+                sr_dir24_group_fold(d, i);
+            }
+            else
+            {
+                sr_dir24_replace(d->tbl24 + i, d->tbl24_depth + i, 1,
+                                 rt->plen, rep, rep_plen);
+            }
+        }
+    }
+    else
+    {
+        i = prefix >> 8;
+        if ( d->tbl24[i] & SR_DIR24_EXT )
+        {
+            g = d->tbl24[i] & ~SR_DIR24_EXT;
+            sr_dir24_replace(d->tbl8 + g * SR_DIR24_GROUP_SIZE + (prefix & 0xff),
+                             d->tbl8_depth + g * SR_DIR24_GROUP_SIZE + (prefix & 0xff),
+                             1 << (32 - rt->plen), rt->plen, rep, rep_plen);
+            sr_dir24_group_fold(d, i);
+        }
+    }
+
+    sr_dir24_nh_put(d, nh);
+} /* -- sr_fib_dir24_remove -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_dir24_reclaim(..)
+ * Scope: global
+ *
+ * Make tbl8 groups and next hops released since the last call available
+ * again.  Only call once no reader can still be looking at them.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_fib_dir24_reclaim(struct sr_fib_dir24* d)
+{
+    unsigned i;
+
+    while ( d->num_retired_groups )
+    {
+        d->free_groups[d->num_free_groups++] =
+            d->retired_groups[--d->num_retired_groups];
+    }
+
+    for ( i = 1; d->num_retired_nh && i < SR_DIR24_MAX_NH; ++i )
+    {
+        if ( d->nh[i].retired )
+        {
+            d->nh[i].retired = 0;
+            d->num_retired_nh--;
+        }
+    }
+} /* -- sr_fib_dir24_reclaim -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_dir24_lookup(..)
+ * Scope: global
+ *
+ * Longest prefix match: one tbl24 read plus one tbl8 read for long
+ * prefixes.
+ *
+ *---------------------------------------------------------------------------*/
+
+const struct sr_dir24_nh* sr_fib_dir24_lookup(const struct sr_fib_dir24* d,
+                                              uint32_t dest /* hbo */)
+{
+    uint16_t e;
+
+    e = sr_rcu_deref(d->tbl24[dest >> 8]);
+    if ( e & SR_DIR24_EXT )
+    { e = sr_rcu_deref(d->tbl8[((e & ~SR_DIR24_EXT) << 8) | (dest & 0xff)]); }
+
+    if ( ! e )
+    { e = sr_rcu_deref(d->dflt); }
+
+    return e ? &(d->nh[e]) : 0;
+} /* -- sr_fib_dir24_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_nh_get(..)
+ * Scope: local
+ *
+ * Take a reference on the next hop (intf, gw), allocating it if needed.
+ * Returns its index or 0 if the table is full.  There are only ever a
+ * handful of distinct next hops so a scan is fine.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint16_t sr_dir24_nh_get(struct sr_fib_dir24* d,
+                                struct sr_router_if* intf, uint32_t gw)
+{
+    uint16_t i, avail = 0;
+
+    for ( i = 1; i < SR_DIR24_MAX_NH; ++i )
+    {
+        if ( d->nh[i].refs == 0 )
+        {
+            if ( ! avail && ! d->nh[i].retired )
+            { avail = i; }
+        }
+        else if ( d->nh[i].intf == intf && d->nh[i].gw == gw )
+        {
+            d->nh[i].refs++;
+            return i;
+        }
+    }
+
+    if ( avail )
+    {
+        d->nh[avail].intf = intf;
+        d->nh[avail].gw   = gw;
+        d->nh[avail].refs = 1;
+    }
+
+    return avail;
+} /* -- sr_dir24_nh_get -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_nh_put(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_dir24_nh_put(struct sr_fib_dir24* d, uint16_t nh)
+{
+    if ( --d->nh[nh].refs == 0 )
+    {
+        d->nh[nh].retired = 1;
+        d->num_retired_nh++;
+    }
+} /* -- sr_dir24_nh_put -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_nh_find(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static uint16_t sr_dir24_nh_find(struct sr_fib_dir24* d,
+                                 const struct sr_rt* rt)
+{
+    uint16_t i;
+
+    for ( i = 1; i < SR_DIR24_MAX_NH; ++i )
+    {
+        if ( d->nh[i].refs && d->nh[i].intf == rt->intf &&
+             d->nh[i].gw == rt->gw )
+        { return i; }
+    }
+
+    return 0;
+} /* -- sr_dir24_nh_find -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_fill(..)
+ * Scope: local
+ *
+ * Point count entries at nh unless they hold a longer prefix.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_dir24_fill(uint16_t* tbl, uint8_t* depth, unsigned count,
+                          uint16_t nh, uint8_t plen)
+{
+    unsigned i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( depth[i] <= plen )
+        {
+            depth[i] = plen;
+            sr_rcu_assign(tbl[i], nh);
+        }
+    }
+} /* -- sr_dir24_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_replace(..)
+ * Scope: local
+ *
+ * Hand the entries of a prefix of length plen over to nh/nh_plen.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_dir24_replace(uint16_t* tbl, uint8_t* depth, unsigned count,
+                             uint8_t plen, uint16_t nh, uint8_t nh_plen)
+{
+    unsigned i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( depth[i] == plen )
+        {
+            depth[i] = nh_plen;
+            sr_rcu_assign(tbl[i], nh);
+        }
+    }
+} /* -- sr_dir24_replace -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_group_split(..)
+ * Scope: local
+ *
+ * Give tbl24 entry i a tbl8 group which inherits its current next hop.
+ * Returns 0 on success, -1 if there are no groups left.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_dir24_group_split(struct sr_fib_dir24* d, uint32_t i)
+{
+    uint32_t g, j;
+
+    if ( d->num_free_groups == 0 )
+    { return -1; }
+
+    g = d->free_groups[--d->num_free_groups];
+    for ( j = 0; j < SR_DIR24_GROUP_SIZE; ++j )
+    {
+        d->tbl8[g * SR_DIR24_GROUP_SIZE + j]       = d->tbl24[i];
+        d->tbl8_depth[g * SR_DIR24_GROUP_SIZE + j] = d->tbl24_depth[i];
+    }
+
+    sr_rcu_assign(d->tbl24[i], (uint16_t)(SR_DIR24_EXT | g));
+    return 0;
+} /* -- sr_dir24_group_split -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dir24_group_fold(..)
+ * Scope: local
+ *
+ * If the tbl8 group behind tbl24 entry i no longer holds anything longer
+ * than /24 and all of its entries agree, put the entry back in tbl24 and
+ * retire the group.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_dir24_group_fold(struct sr_fib_dir24* d, uint32_t i)
+{
+    uint16_t* tbl;
+    uint8_t*  depth;
+    uint32_t g, j;
+
+    g     = d->tbl24[i] & ~SR_DIR24_EXT;
+    tbl   = d->tbl8 + g * SR_DIR24_GROUP_SIZE;
+    depth = d->tbl8_depth + g * SR_DIR24_GROUP_SIZE;
+
+    if ( depth[0] > 24 )
+    { return; }
+    for ( j = 1; j < SR_DIR24_GROUP_SIZE; ++j )
+    {
+        if ( tbl[j] != tbl[0] || depth[j] != depth[0] )
+        { return; }
+    }
+
+    d->tbl24_depth[i] = depth[0];
+    sr_rcu_assign(d->tbl24[i], tbl[0]);
+
+    d->retired_groups[d->num_retired_groups++] = g;
+} /* -- sr_dir24_group_fold -- */
@@ -0,0 +1,82 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib_dir24.h
+ *
+ * Description:
+ *
+ * DIR-24-8 forwarding table (Gupta, Lin, McKeown).  A 2^24 entry table
+ * indexed by the top 24 bits of the destination either holds the next hop
+ * directly or points at a 256 entry second level group for prefixes longer
+ * than /24, so a lookup is at most two table reads.
+ *
+ * Entries are 16 bits: 0 means no route, SR_DIR24_EXT set means the low
+ * 15 bits name a tbl8 group, anything else indexes the next hop table.
+ * Next hops are (interface, gateway) pairs shared by all routes using
+ * them.  Prefix lengths are kept in separate depth arrays that only the
+ * update path looks at.
+ *
+ * sr_fib_dir24_lookup(..) may run concurrently with a single writer inside
+ * an epoch read section (sr_epoch.h).  tbl8 groups and next hops released
+ * by a removal are not reused until sr_fib_dir24_reclaim(..) is called
+ * after the readers have been waited out.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FIB_DIR24_H
+#define SR_FIB_DIR24_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_DIR24_TBL24_SIZE  (1 << 24)
+#define SR_DIR24_GROUP_SIZE  256
+#define SR_DIR24_EXT         0x8000
+#define SR_DIR24_MAX_GROUPS  8192   /* second level groups (/25 - /32) */
+#define SR_DIR24_MAX_NH      0x7fff /* next hop indices 1 .. 0x7ffe   */
+
+struct sr_rt;          /* -- forward declare, see sr_rtable.h -- */
+struct sr_router_if;   /* -- forward declare, see sr_router.h -- */
+
+struct sr_dir24_nh
+{
+    struct sr_router_if* intf;
+    uint32_t             gw;   /* nbo */
+    unsigned             refs; /* routes using this next hop, 0 if free */
+    unsigned             retired; /* unused but readers may still see it */
+};
+
+struct sr_fib_dir24
+{
+    uint16_t* tbl24;
+    uint8_t*  tbl24_depth;
+    uint16_t* tbl8;            /* SR_DIR24_MAX_GROUPS groups */
+    uint8_t*  tbl8_depth;
+
+    uint16_t* free_groups;     /* stack of unused tbl8 groups */
+    unsigned  num_free_groups;
+    uint16_t* retired_groups;  /* folded, waiting for sr_fib_dir24_reclaim */
+    unsigned  num_retired_groups;
+    unsigned  num_retired_nh;
+
+    uint16_t  dflt;            /* next hop of 0/0, kept out of tbl24 */
+
+    struct sr_dir24_nh* nh;    /* SR_DIR24_MAX_NH entries, [0] unused */
+};
+
+struct sr_fib_dir24* sr_fib_dir24_create(void);
+void sr_fib_dir24_destroy(struct sr_fib_dir24* d);
+
+int  sr_fib_dir24_insert(struct sr_fib_dir24* d, struct sr_rt* rt,
+                         const struct sr_rt* old /* replaced by rt, or 0 */);
+void sr_fib_dir24_remove(struct sr_fib_dir24* d, struct sr_rt* rt,
+                         struct sr_rt* remaining /* route list without rt */);
+void sr_fib_dir24_reclaim(struct sr_fib_dir24* d);
+
+const struct sr_dir24_nh* sr_fib_dir24_lookup(const struct sr_fib_dir24* d,
+                                              uint32_t dest /* hbo */);
+
+#endif  /* -- SR_FIB_DIR24_H -- */
@@ -0,0 +1,343 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib_trie.c
+ *
+ * Description:
+ *
+ * Multibit trie with a fixed 8 bit stride.  A prefix of length plen is
+ * stored at level (plen-1)/8 and expanded over the 2^(8 - plen%8) slots it
+ * covers there (controlled prefix expansion).  Each slot keeps the longest
+ * prefix that ends at its level, the lookup remembers the last hit while it
+ * walks down and returns it when it falls off the bottom.
+ *
+ * The trie does not own the routes it points at, see sr_rtable.c.
+ *
+ * Lookups run without a lock concurrently with one writer.  Every slot is
+ * switched from one valid value to the next with a single published store
+ * and nodes cut off by a removal sit on a retired list until the caller
+ * has waited out the readers (sr_epoch_synchronize) and calls
+ * sr_fib_trie_reclaim(..).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <arpa/inet.h>
+
+#include "sr_fib_trie.h"
+#include "sr_rtable.h"
+#include "sr_epoch.h"
+
+/* -- slot index of hbo address a in a node at level -- */
+#define SR_TRIE_INDEX(a, level) \
+    (((a) >> (32 - SR_TRIE_STRIDE * ((level) + 1))) & (SR_TRIE_FANOUT - 1))
+
+static struct sr_trie_node* sr_trie_node_new(struct sr_fib_trie* trie);
+static void sr_trie_node_free(struct sr_fib_trie* trie,
+                              struct sr_trie_node* node);
+static void sr_trie_fill(struct sr_trie_node* node, struct sr_rt* rt,
+                         unsigned level);
+static int  sr_trie_node_empty(const struct sr_trie_node* node);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_trie_create(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_fib_trie* sr_fib_trie_create(void)
+{
+    struct sr_fib_trie* trie;
+
+    trie = (struct sr_fib_trie*)calloc(1, sizeof(struct sr_fib_trie));
+    return trie;
+} /* -- sr_fib_trie_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_trie_destroy(..)
+ * Scope: global
+ *
+ * Frees the trie and all of its nodes (but not the routes).
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_fib_trie_destroy(struct sr_fib_trie* trie)
+{
+    if ( ! trie )
+    { return; }
+
+    if ( trie->root )
+    { sr_trie_node_free(trie, trie->root); }
+
+    sr_fib_trie_reclaim(trie);
+    free(trie);
+} /* -- sr_fib_trie_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_trie_insert(..)
+ * Scope: global
+ *
+ * Index rt.  A route with the same prefix and length that is already in
+ * the trie is replaced.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success, -1 if a node could not be allocated
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_fib_trie_insert(struct sr_fib_trie* trie, struct sr_rt* rt)
+{
+    struct sr_trie_node* node;
+    struct sr_trie_slot* slot;
+    uint32_t prefix;
+    unsigned level, last;
+
+    /* REQUIRES */
+    assert(trie);
+    assert(rt);
+
+    if ( rt->plen == 0 )
+    {
+        sr_rcu_assign(trie->dflt, rt);
+        return 0;
+    }
+
+    prefix = ntohl(rt->dest);
+    last   = (rt->plen - 1) / SR_TRIE_STRIDE;
+
+    if ( ! trie->root )
+    {
+        if ( ! (node = sr_trie_node_new(trie)) )
+        { return -1; }
+        sr_rcu_assign(trie->root, node);
+    }
+
+    node = trie->root;
+    for ( level = 0; level < last; ++level )
+    {
+        slot = &node->slot[SR_TRIE_INDEX(prefix, level)];
+        if ( ! slot->child )
+        {
+            if ( ! (node = sr_trie_node_new(trie)) )
+            { return -1; }
+            sr_rcu_assign(slot->child, node);
+        }
+        node = slot->child;
+    }
+
+    sr_trie_fill(node, rt, last);
+
+    return 0;
+} /* -- sr_fib_trie_insert -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_trie_remove(..)
+ * Scope: global
+ *
+ * Remove rt from the trie.  Slots that rt occupied are handed straight to
+ * the longest remaining prefix ending at the same level (it covers all of
+ * them), which is why the caller passes the route list (with rt already
+ * unlinked).  Shorter prefixes at higher levels need no help since lookups
+ * fall back on them anyway.  Nodes left empty are unlinked and retired.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_fib_trie_remove(struct sr_fib_trie* trie, struct sr_rt* rt,
+                        struct sr_rt* remaining)
+{
+    struct sr_trie_node* path[SR_TRIE_LEVELS];
+    unsigned index[SR_TRIE_LEVELS];
+    struct sr_trie_node* node;
+    struct sr_rt* r;
+    struct sr_rt* cover = 0;
+    uint32_t prefix;
+    unsigned level, last, span, first, i;
+
+    /* REQUIRES */
+    assert(trie);
+    assert(rt);
+
+    if ( rt->plen == 0 )
+    {
+        if ( trie->dflt == rt )
+        { sr_rcu_assign(trie->dflt, (struct sr_rt*)0); }
+        return;
+    }
+
+    prefix = ntohl(rt->dest);
+    last   = (rt->plen - 1) / SR_TRIE_STRIDE;
+
+    node = trie->root;
+    for ( level = 0; level < last && node; ++level )
+    {
+        path[level]  = node;
+        index[level] = SR_TRIE_INDEX(prefix, level);
+        node = node->slot[index[level]].child;
+    }
+    if ( ! node )
+    { return; } /* -- never inserted -- */
+    path[last] = node;
+
+    /* -- the longest covering prefix from the same level takes the slots -- */
+    for ( r = remaining; r; r = r->next )
+    {
+        if ( r->plen > SR_TRIE_STRIDE * last && r->plen < rt->plen &&
+             (rt->dest & r->mask) == r->dest &&
+             ( ! cover || r->plen > cover->plen ) )
+        { cover = r; }
+    }
+
+    span  = 1 << (SR_TRIE_STRIDE * (last + 1) - rt->plen);
+    first = SR_TRIE_INDEX(prefix, last) & ~(span - 1);
+    for ( i = first; i < first + span; ++i )
+    {
+        if ( node->slot[i].rt == rt )
+        { sr_rcu_assign(node->slot[i].rt, cover); }
+    }
+
+    /* -- prune nodes which no longer hold anything -- */
+    for ( level = last; level > 0; --level )
+    {
+        if ( ! sr_trie_node_empty(path[level]) )
+        { return; }
+        sr_rcu_assign(path[level - 1]->slot[index[level - 1]].child,
+                      (struct sr_trie_node*)0);
+        trie->retired[trie->num_retired++] = path[level];
+    }
+    if ( sr_trie_node_empty(trie->root) )
+    {
+        trie->retired[trie->num_retired++] = trie->root;
+        sr_rcu_assign(trie->root, (struct sr_trie_node*)0);
+    }
+} /* -- sr_fib_trie_remove -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_trie_reclaim(..)
+ * Scope: global
+ *
+ * Free the nodes retired by earlier removals.  Only call once no reader
+ * can still be looking at them.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_fib_trie_reclaim(struct sr_fib_trie* trie)
+{
+    while ( trie->num_retired )
+    {
+        free(trie->retired[--trie->num_retired]);
+        trie->num_nodes--;
+    }
+} /* -- sr_fib_trie_reclaim -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_fib_trie_lookup(..)
+ * Scope: global
+ *
+ * Longest prefix match, at most SR_TRIE_LEVELS node visits.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_trie_lookup(const struct sr_fib_trie* trie,
+                                 uint32_t dest /* hbo */)
+{
+    const struct sr_trie_node* node;
+    const struct sr_trie_slot* slot;
+    struct sr_rt* best;
+    struct sr_rt* rt;
+    unsigned level;
+
+    best = sr_rcu_deref(trie->dflt);
+    node = sr_rcu_deref(trie->root);
+    for ( level = 0; node; ++level )
+    {
+        slot = &node->slot[SR_TRIE_INDEX(dest, level)];
+        if ( (rt = sr_rcu_deref(slot->rt)) )
+        { best = rt; }
+        node = sr_rcu_deref(slot->child);
+    }
+
+    return best;
+} /* -- sr_fib_trie_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trie_fill(..)
+ * Scope: local
+ *
+ * Expand rt over the slots it covers in node (which sits at level), without
+ * overriding longer prefixes already there.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_trie_fill(struct sr_trie_node* node, struct sr_rt* rt,
+                         unsigned level)
+{
+    unsigned span, first, i;
+    struct sr_rt* cur;
+
+    span  = 1 << (SR_TRIE_STRIDE * (level + 1) - rt->plen);
+    first = SR_TRIE_INDEX(ntohl(rt->dest), level) & ~(span - 1);
+
+    for ( i = first; i < first + span; ++i )
+    {
+        cur = node->slot[i].rt;
+        if ( ! cur || cur->plen <= rt->plen )
+        { sr_rcu_assign(node->slot[i].rt, rt); }
+    }
+} /* -- sr_trie_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trie_node_new(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static struct sr_trie_node* sr_trie_node_new(struct sr_fib_trie* trie)
+{
+    struct sr_trie_node* node;
+
+    node = (struct sr_trie_node*)calloc(1, sizeof(struct sr_trie_node));
+    if ( node )
+    { trie->num_nodes++; }
+    else
+    { fprintf(stderr, "Error: out of memory (sr_trie_node_new)\n"); }
+
+    return node;
+} /* -- sr_trie_node_new -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trie_node_free(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_trie_node_free(struct sr_fib_trie* trie,
+                              struct sr_trie_node* node)
+{
+    unsigned i;
+
+    for ( i = 0; i < SR_TRIE_FANOUT; ++i )
+    {
+        if ( node->slot[i].child )
+        { sr_trie_node_free(trie, node->slot[i].child); }
+    }
+
+    free(node);
+    trie->num_nodes--;
+} /* -- sr_trie_node_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trie_node_empty(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int sr_trie_node_empty(const struct sr_trie_node* node)
+{
+    unsigned i;
+
+    for ( i = 0; i < SR_TRIE_FANOUT; ++i )
+    {
+        if ( node->slot[i].child || node->slot[i].rt )
+        { return 0; }
+    }
+
+    return 1;
+} /* -- sr_trie_node_empty -- */
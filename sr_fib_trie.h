@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib_trie.h
+ *
+ * Description:
+ *
+ * Multibit (8-8-8-8 stride) trie used as the forwarding information base.
+ * Prefixes are expanded into the slots of the node at the level their
+ * length falls in, so a lookup visits at most four nodes and never
+ * allocates.  The trie only indexes routes, it does not own them; the
+ * authoritative route list lives in sr_rtable.
+ *
+ * sr_fib_trie_lookup(..) may run concurrently with a single writer inside
+ * an epoch read section, see sr_epoch.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FIB_TRIE_H
+#define SR_FIB_TRIE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TRIE_STRIDE 8
+#define SR_TRIE_FANOUT (1 << SR_TRIE_STRIDE)
+#define SR_TRIE_LEVELS (32 / SR_TRIE_STRIDE)
+
+struct sr_rt; /* -- forward declare, see sr_rtable.h -- */
+
+struct sr_trie_node;
+
+struct sr_trie_slot
+{
+    struct sr_trie_node* child; /* next level, covers the next stride   */
+    struct sr_rt*        rt;    /* longest prefix ending at this level  */
+};
+
+struct sr_trie_node
+{
+    struct sr_trie_slot slot[SR_TRIE_FANOUT];
+};
+
+struct sr_fib_trie
+{
+    struct sr_trie_node* root;
+    struct sr_rt*        dflt;  /* 0/0, lives outside of the node array */
+    unsigned             num_nodes;
+
+    /* -- nodes unlinked by a removal, see sr_fib_trie_reclaim -- */
+    struct sr_trie_node* retired[SR_TRIE_LEVELS];
+    unsigned             num_retired;
+};
+
+struct sr_fib_trie* sr_fib_trie_create(void);
+void sr_fib_trie_destroy(struct sr_fib_trie* trie);
+
+int  sr_fib_trie_insert(struct sr_fib_trie* trie, struct sr_rt* rt);
+void sr_fib_trie_remove(struct sr_fib_trie* trie, struct sr_rt* rt,
+                        struct sr_rt* remaining /* route list without rt */);
+void sr_fib_trie_reclaim(struct sr_fib_trie* trie);
+
+struct sr_rt* sr_fib_trie_lookup(const struct sr_fib_trie* trie,
+                                 uint32_t dest /* hbo */);
+
+#endif  /* -- SR_FIB_TRIE_H -- */
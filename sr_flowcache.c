@@ -0,0 +1,147 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flowcache.c
+ *
+ * Description:
+ *
+ * Flow cache, see sr_flowcache.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "sr_flowcache.h"
+
+/* -- entries are zeroed, so 0 never matches -- */
+static uint32_t sr_flow_generation = 1;
+
+static unsigned sr_flow_hash(uint32_t dest, const struct sr_router_if* in_if);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flowcache_create(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_flowcache* sr_flowcache_create(void)
+{
+    struct sr_flowcache* fc;
+    void* mem;
+
+    if ( ! (fc = (struct sr_flowcache*)calloc(1, sizeof(struct sr_flowcache))) )
+    { return 0; }
+
+    if ( posix_memalign(&mem, SR_CACHE_LINE,
+                        SR_FLOW_CACHE_SIZE * sizeof(struct sr_flow_entry)) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_flowcache_create)\n");
+        free(fc);
+        return 0;
+    }
+    memset(mem, 0, SR_FLOW_CACHE_SIZE * sizeof(struct sr_flow_entry));
+    fc->entries = (struct sr_flow_entry*)mem;
+
+    return fc;
+} /* -- sr_flowcache_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flowcache_destroy(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_flowcache_destroy(struct sr_flowcache* fc)
+{
+    if ( ! fc )
+    { return; }
+
+    free(fc->entries);
+    free(fc);
+} /* -- sr_flowcache_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flowcache_generation(..)
+ * Scope: global
+ *
+ * Acquire pairs with the release in sr_flowcache_invalidate(..): whoever
+ * sees the new generation also sees the change that caused it.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint32_t sr_flowcache_generation(void)
+{
+    return __atomic_load_n(&sr_flow_generation, __ATOMIC_ACQUIRE);
+} /* -- sr_flowcache_generation -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flowcache_invalidate(..)
+ * Scope: global
+ *
+ * Call after the change has been published.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flowcache_invalidate(void)
+{
+    if ( __atomic_add_fetch(&sr_flow_generation, 1, __ATOMIC_RELEASE) == 0 )
+    { __atomic_add_fetch(&sr_flow_generation, 1, __ATOMIC_RELEASE); }
+} /* -- sr_flowcache_invalidate -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flowcache_lookup(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+const struct sr_flow_entry* sr_flowcache_lookup(struct sr_flowcache* fc,
+                                                uint32_t dest /* nbo */,
+                                                const struct sr_router_if* in_if,
+                                                uint32_t gen)
+{
+    const struct sr_flow_entry* e = &(fc->entries[sr_flow_hash(dest, in_if)]);
+
+    if ( e->gen == gen && e->dest == dest && e->in_if == in_if )
+    {
+        fc->hits++;
+        return e;
+    }
+
+    fc->misses++;
+    return 0;
+} /* -- sr_flowcache_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flowcache_insert(..)
+ * Scope: global
+ *
+ * Newest flow wins the slot.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flowcache_insert(struct sr_flowcache* fc,
+                         uint32_t dest /* nbo */,
+                         struct sr_router_if* in_if,
+                         struct sr_router_if* out_if,
+                         const struct sr_ethernet_hdr* eth,
+                         uint32_t gen)
+{
+    struct sr_flow_entry* e = &(fc->entries[sr_flow_hash(dest, in_if)]);
+
+    e->gen    = gen;
+    e->dest   = dest;
+    e->in_if  = in_if;
+    e->out_if = out_if;
+    memcpy(e->ether_dhost, eth->ether_dhost, ETHER_ADDR_LEN);
+    memcpy(e->ether_shost, eth->ether_shost, ETHER_ADDR_LEN);
+} /* -- sr_flowcache_insert -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_hash(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static unsigned sr_flow_hash(uint32_t dest, const struct sr_router_if* in_if)
+{
+    uint32_t k = ntohl(dest) ^ ((uint32_t)(unsigned long)in_if >> 4);
+
+    return (k * 2654435761u) >> (32 - SR_FLOW_CACHE_BITS);
+} /* -- sr_flow_hash -- */
@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flowcache.h
+ *
+ * Description:
+ *
+ * Per-flow forwarding cache in front of the routing table and the ARP
+ * cache.  A direct mapped table of cache line sized entries keyed by
+ * (destination, ingress interface) remembers the egress interface and the
+ * complete ethernet addresses to write, so steady state traffic is
+ * forwarded with one hash and one cache line.
+ *
+ * Entries are stamped with a global generation which is bumped by anything
+ * that could change a forwarding decision (routes, ARP entries, interface
+ * state); entries from an older generation are misses.  Take the
+ * generation with sr_flowcache_generation() before doing the lookups whose
+ * results get inserted, so an update racing with them is never cached.
+ *
+ * A cache instance is not thread safe, each forwarding thread owns one.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOWCACHE_H
+#define SR_FLOWCACHE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_FLOW_CACHE_BITS 11
+#define SR_FLOW_CACHE_SIZE (1 << SR_FLOW_CACHE_BITS)
+#define SR_CACHE_LINE      64
+
+struct sr_router_if; /* -- forward declare, see sr_router.h -- */
+
+struct sr_flow_entry
+{
+    uint32_t             gen;   /* valid while == current generation */
+    uint32_t             dest;  /* nbo */
+    struct sr_router_if* in_if;
+    struct sr_router_if* out_if;
+    uint8_t              ether_dhost[ETHER_ADDR_LEN]; /* next hop */
+    uint8_t              ether_shost[ETHER_ADDR_LEN]; /* out_if's address */
+} __attribute__ ((aligned (SR_CACHE_LINE))) ;
+
+struct sr_flowcache
+{
+    struct sr_flow_entry* entries; /* SR_FLOW_CACHE_SIZE, line aligned */
+    unsigned long         hits;
+    unsigned long         misses;
+};
+
+struct sr_flowcache* sr_flowcache_create(void);
+void sr_flowcache_destroy(struct sr_flowcache* fc);
+
+/** Current generation, read before any lookup feeding an insert */
+uint32_t sr_flowcache_generation(void);
+
+/** Invalidate every entry in every cache */
+void sr_flowcache_invalidate(void);
+
+/** The entry for (dest, in_if) if it is from generation gen, else NULL */
+const struct sr_flow_entry* sr_flowcache_lookup(struct sr_flowcache* fc,
+                                                uint32_t dest /* nbo */,
+                                                const struct sr_router_if* in_if,
+                                                uint32_t gen);
+
+/** Remember that (dest, in_if) leaves out_if with ethernet header eth */
+void sr_flowcache_insert(struct sr_flowcache* fc,
+                         uint32_t dest /* nbo */,
+                         struct sr_router_if* in_if,
+                         struct sr_router_if* out_if,
+                         const struct sr_ethernet_hdr* eth,
+                         uint32_t gen);
+
+#endif  /* -- SR_FLOWCACHE_H -- */
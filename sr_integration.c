@@ -13,11 +13,15 @@
  *---------------------------------------------------------------------------*/
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <assert.h>
 
 #include "sr_vns.h"
 #include "sr_base_internal.h"
+#include "sr_router.h"
+#include "sr_rtable.h"
+#include "sr_workers.h"
 
 #ifdef _CPUMODE_
 #include "sr_cpu_extension_nf2.h"
@@ -35,7 +39,17 @@
 
 void sr_integ_init(struct sr_instance* sr)
 {
+    struct sr_router* router;
+
     printf(" ** sr_integ_init(..) called \n");
+
+    if ( ! (router = sr_router_create(sr)) )
+    {
+        fprintf(stderr, "Error: could not create the router subsystem\n");
+        exit(1);
+    }
+
+    sr_set_subsystem(sr, router);
 } /* -- sr_integ_init -- */
 
 /*-----------------------------------------------------------------------------
@@ -50,7 +64,16 @@ void sr_integ_init(struct sr_instance* sr)
 
 void sr_integ_hw_setup(struct sr_instance* sr)
 {
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
     printf(" ** sr_integ_hw(..) called \n");
+
+    /* -- pick the FIB before there is anything in it to reindex -- */
+    if ( sr_rtable_set_fib(router->rtable, sr->fib_type) )
+    { fprintf(stderr, "Warning: keeping the default forwarding table\n"); }
+
+    /* -- routes name interfaces, so load them now that we have them all -- */
+    sr_router_load_rtable(router, sr->rtable);
 } /* -- sr_integ_hw_setup -- */
 
 /*---------------------------------------------------------------------
@@ -67,23 +90,31 @@ void sr_integ_hw_setup(struct sr_instance* sr)
  * Note: Both the packet buffer and the character's memory are handled
  * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
  * packet instead if you intend to keep it around beyond the scope of
- * the method call.
+ * the method call.  The packet buffer is lent, the router rewrites the
+ * headers of forwarded packets in place.
+ *
+ * With forwarding workers (-w) the frame is queued for one of them and
+ * handled after this returns, on another thread.
  *
  *---------------------------------------------------------------------*/
 
 void sr_integ_input(struct sr_instance* sr,
-        const uint8_t * packet/* borrowed */,
+        uint8_t * packet/* lent */,
         unsigned int len,
         const char* interface/* borrowed */)
 {
     /* -- INTEGRATION PACKET ENTRY POINT!-- */
 
-    printf(" ** sr_integ_input(..) called \n");
-    
-    sr_integ_low_level_output(sr /* borrowed */,
-                       packet /* borrowed */ ,
-                       len,
-                       interface /* borrowed */);
+    if ( sr->workers )
+    {
+        sr_workers_dispatch(sr->workers, packet, len, interface);
+        return;
+    }
+
+    sr_router_handle_packet((struct sr_router*)sr_get_subsystem(sr),
+                            packet /* lent */,
+                            len,
+                            interface /* borrowed */);
 
 } /* -- sr_integ_input -- */
 
@@ -100,6 +131,8 @@ void sr_integ_add_interface(struct sr_instance* sr,
                             struct sr_vns_if* vns_if/* borrowed */)
 {
     printf(" ** sr_integ_add_interface(..) called \n");
+
+    sr_router_add_interface((struct sr_router*)sr_get_subsystem(sr), vns_if);
 } /* -- sr_integ_add_interface -- */
 
 struct sr_instance* get_sr() {
@@ -130,6 +163,51 @@ int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
 #endif /* _CPUMODE_ */
 } /* -- sr_vns_integ_output -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_low_level_output_v(..)
+ * Scope: global
+ *
+ * Send a packet gathered from iov.  VNS takes the pieces as they are, the
+ * hardware path only knows flat buffers so it gets a copy.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_integ_low_level_output_v(struct sr_instance* sr /* borrowed */,
+                               const struct iovec* iov /* borrowed */,
+                               int iovcnt,
+                               const char* iface /* borrowed */)
+{
+#ifdef _CPUMODE_
+    uint8_t* buf;
+    unsigned int len = 0;
+    int ret;
+    int i;
+
+    if ( iovcnt == 1 )
+    {
+        return sr_cpu_output(sr, (uint8_t*)iov[0].iov_base /*lent*/,
+                             iov[0].iov_len, iface);
+    }
+
+    for ( i = 0; i < iovcnt; ++i )
+    { len += iov[i].iov_len; }
+
+    if ( ! (buf = (uint8_t*)malloc(len)) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_integ_low_level_output_v)\n");
+        return -1;
+    }
+    for ( len = 0, i = 0; i < iovcnt; len += iov[i].iov_len, ++i )
+    { memcpy(buf + len, iov[i].iov_base, iov[i].iov_len); }
+
+    ret = sr_cpu_output(sr, buf /*lent*/, len, iface);
+    free(buf);
+    return ret;
+#else
+    return sr_vns_send_packet_v(sr, iov /*lent*/, iovcnt, iface);
+#endif /* _CPUMODE_ */
+} /* -- sr_integ_low_level_output_v -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_destroy(..)
  * Scope: global
@@ -141,6 +219,9 @@ int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
 void sr_integ_destroy(struct sr_instance* sr)
 {
     printf(" ** sr_integ_destroy(..) called \n");
+
+    sr_router_destroy((struct sr_router*)sr_get_subsystem(sr));
+    sr_set_subsystem(sr, 0);
 } /* -- sr_integ_destroy -- */
 
 /*-----------------------------------------------------------------------------
@@ -154,24 +235,10 @@ void sr_integ_destroy(struct sr_instance* sr)
 
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */)
 {
-    fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-    fprintf(stderr, "!!! Tranport layer called ip_findsrcip(..) this must be !!!\n");
-    fprintf(stderr, "!!! defined to return the correct source address        !!!\n");
-    fprintf(stderr, "!!! given a destination                                 !!!\n ");
-    fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-
-    assert(0);
-
-    /* --
-     * e.g.
-     *
-     * struct sr_instance* sr = sr_get_global_instance();
-     * struct my_router* mr = (struct my_router*)
-     *                              sr_get_subsystem(sr);
-     * return my_findsrcip(mr, dest);
-     * -- */
-
-    return 0;
+    struct sr_instance* sr = sr_get_global_instance(0);
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    return sr_router_findsrcip(router, dest);
 } /* -- ip_findsrcip -- */
 
 /*-----------------------------------------------------------------------------
@@ -179,7 +246,7 @@ uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */)
  * Scope: global
  *
  * Called by the transport layer for outgoing packets that need IP
- * encapsulation.
+ * encapsulation.  Returns 0 if the packet was sent or is waiting on ARP.
  *
  *---------------------------------------------------------------------------*/
 
@@ -189,26 +256,35 @@ uint32_t sr_integ_ip_output(uint8_t* payload /* given */,
                             uint32_t dest, /* nbo */
                             int len)
 {
-    fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-    fprintf(stderr, "!!! Tranport layer called sr_integ_ip_output(..)        !!!\n");
-    fprintf(stderr, "!!! this must be defined to handle the network          !!!\n ");
-    fprintf(stderr, "!!! level functionality of transport packets            !!!\n ");
-    fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-
-    assert(0);
-
-    /* --
-     * e.g.
-     *
-     * struct sr_instance* sr = sr_get_global_instance();
-     * struct my_router* mr = (struct my_router*)
-     *                              sr_get_subsystem(sr);
-     * return my_ip_output(mr, payload, proto, src, dest, len);
-     * -- */
-
-    return 0;
+    struct sr_instance* sr = sr_get_global_instance(0);
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    return sr_router_ip_output(router, payload /* given */, proto,
+                               src, dest, len) ? 1 : 0;
 } /* -- ip_integ_route -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_ip_output_v(..)
+ * Scope: global
+ *
+ * Same as sr_integ_ip_output(..) for a segment in pieces, the headers are
+ * written into iov[0] and the whole lot is sent without being flattened.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint32_t sr_integ_ip_output_v(struct iovec* iov /* lent */,
+                              int iovcnt,
+                              uint8_t  proto,
+                              uint32_t src, /* nbo */
+                              uint32_t dest /* nbo */)
+{
+    struct sr_instance* sr = sr_get_global_instance(0);
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    return sr_router_ip_output_v(router, iov /* lent */, iovcnt, proto,
+                                 src, dest) ? 1 : 0;
+} /* -- sr_integ_ip_output_v -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_close(..)
  * Scope: global
@@ -6,6 +6,8 @@
 #ifndef SR_INTEGRATION_H
 #define SR_INTEGRATION_H
 
+struct iovec; /* -- forward declare, see sys/uio.h -- */
+
 /** returns a pointer to the global sr (only valid after it is initialized) */
 struct sr_instance* get_sr();
 
@@ -14,6 +16,12 @@ int sr_integ_low_level_output( struct sr_instance* sr /* borrowed */,
                                unsigned int len,
                                const char* iface );
 
+/** same as above with the frame gathered from iov (at most SR_INTEG_MAX_IOV) */
+int sr_integ_low_level_output_v( struct sr_instance* sr /* borrowed */,
+                                 const struct iovec* iov /* borrowed */,
+                                 int iovcnt,
+                                 const char* iface );
+
 /** returns the ip of the interface this will be sent via */
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
 
@@ -23,20 +23,32 @@
 
 #include "lwip/ip_addr.h"
 #include "lwip/ip.h"
+#include "lwip/inet.h"
 #include "lwip/netif.h"
 #include "lwip/pbuf.h"
 #include "lwip/transport_subsys.h"
 
 #include "sr_base_internal.h"
+#include "sr_rxbuf.h"
 
+static void sr_transport_rxbuf_free(void* rxbuf);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_transport_input(..)
  * Scope:  Global
  *
  * Called by sr to send a packet to the transport layer.  Packet is assumed
- * to have a header with a correct ip length.  The memory holding packet is
- * left untouched.
+ * to have a header with a correct ip length.
+ *
+ * The pbuf handed to lwip points into a receive buffer it holds until
+ * lwip frees the pbuf (lwip rewrites the headers in place, so the caller
+ * must be done with the packet).  If the packet sits in the buffer being
+ * dispatched that is the buffer itself.  VNS read chunks are too big to
+ * hold on to (see sr_rxbuf_claim_long(..)), so a packet in one is moved
+ * to a pooled buffer of its own, everything past the IP header summed as
+ * it is copied so tcp_input(..) can verify the checksum without reading
+ * the payload again.  Only if that fails too does the packet go to lwip's
+ * heap.
  *
  *---------------------------------------------------------------------------*/
 
@@ -44,6 +56,10 @@ void sr_transport_input(uint8_t* packet /* borrowed */)
 {
     struct pbuf* pb;
     struct netif inp;
+    struct sr_rxbuf* rxbuf;
+    uint8_t* data = packet;
+    unsigned int hlen, ip_len;
+    uint16_t chksum = 0;
 
     /* -- this is sort of a hack for now, in the future we should
      *    initialize netif's with the hw information and pass handles
@@ -53,15 +69,62 @@ void sr_transport_input(uint8_t* packet /* borrowed */)
 
     struct ip* header = (struct ip*)packet;
 
-    pb = pbuf_alloc(PBUF_RAW, ntohs(header->ip_len), PBUF_RAM);
+    ip_len = ntohs(header->ip_len);
+
+    hlen = header->ip_hl * 4;
+    if ( hlen > ip_len )
+    { hlen = ip_len; }
 
-    pb->len = pb->tot_len = ntohs(header->ip_len);
+    if ( ! (rxbuf = sr_rxbuf_claim_long(packet, ip_len)) &&
+         (rxbuf = sr_rxbuf_alloc(ip_len)) )
+    {
+        data = rxbuf->data;
+        memcpy(data, packet, hlen);
+        chksum = inet_chksum_copy(data + hlen, packet + hlen, ip_len - hlen);
+    }
+
+    if ( rxbuf )
+    {
+        if ( (pb = pbuf_alloc_ref(data, ip_len,
+                                  sr_transport_rxbuf_free, rxbuf)) )
+        {
+            if ( data != packet )
+            {
+                pb->chksum = chksum;
+                pb->chksum_len = ip_len - hlen;
+            }
+            tcp_msg_input(pb, &inp);
+            return;
+        }
+        sr_rxbuf_put(rxbuf);
+    }
 
-    memcpy(pb->payload,packet,pb->tot_len);
+    pb = pbuf_alloc(PBUF_RAW, ip_len, PBUF_RAM);
+
+    pb->len = pb->tot_len = ip_len;
+
+    memcpy(pb->payload, packet, hlen);
+    pb->chksum = inet_chksum_copy((uint8_t*)pb->payload + hlen, packet + hlen,
+                                  pb->tot_len - hlen);
+    pb->chksum_len = pb->tot_len - hlen;
 
     tcp_msg_input(pb, &inp);
 } /* -- sr_transport_input -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_transport_rxbuf_free(..)
+ * Scope:  Local
+ *
+ * ref_free callback of pbufs made by sr_transport_input(..), runs on the
+ * transport thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_transport_rxbuf_free(void* rxbuf)
+{
+    sr_rxbuf_put((struct sr_rxbuf*)rxbuf);
+} /* -- sr_transport_rxbuf_free -- */
+
 /*-----------------------------------------------------------------------------
  * Method: ip_route(..)
  * Scope:  Global
@@ -89,25 +152,58 @@ uint32_t /*nbo*/ ip_route(struct ip_addr *dest)
  *
  * otherwise an IP header must be added
  *
- *  sr_integ_ip_output(..)
+ *  sr_integ_ip_output_v(..)
+ *
+ * The pbuf chain is handed down as it is, one iovec per pbuf.  The
+ * ethernet and IP headers go in the room lwip leaves in front of the first
+ * pbuf (PBUF_LINK_HLEN + IP_HLEN), or on the stack for pbufs that have
+ * none.  Only a chain too long for SR_INTEG_MAX_IOV is flattened.
  *
  *---------------------------------------------------------------------------*/
 
 err_t sr_lwip_output(struct pbuf *p, struct ip_addr *src, struct ip_addr *dst, uint8_t proto )
 {
+    struct iovec iov[SR_INTEG_MAX_IOV];
+    uint8_t hdr[SR_INTEG_IP_HEADROOM];
     struct pbuf *q;
     uint8_t* payload;
     int offset = 0;
+    int n = 1;
 
-    /* initiate transfer(); */
+    /* -- borrow the headroom, payload is put back right away -- */
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = SR_INTEG_IP_HEADROOM;
+    if ( (p->flags == PBUF_FLAG_POOL || p->flags == PBUF_FLAG_RAM) &&
+         pbuf_header(p, SR_INTEG_IP_HEADROOM) == 0 )
+    {
+        iov[0].iov_base = p->payload;
+        pbuf_header(p, -SR_INTEG_IP_HEADROOM);
+    }
 
+    for(q = p; q != NULL && n < SR_INTEG_MAX_IOV; q = q->next)
+    {
+        if ( q->len )
+        {
+            iov[n].iov_base = q->payload;
+            iov[n].iov_len  = q->len;
+            ++n;
+        }
+    }
 
-    payload = (uint8_t*)malloc(p->tot_len);
+    if ( ! q )
+    {
+        sr_integ_ip_output_v(iov /*lent*/, n, proto, src->addr, dst->addr);
+        return 0;
+    }
 
-    memcpy(payload + offset, p->payload, p->len);
-    offset += p->len;
+    /* -- too many pieces, flatten it -- */
+    if ( ! (payload = (uint8_t*)malloc(p->tot_len)) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_lwip_output)\n");
+        return ERR_MEM;
+    }
 
-    for(q = p->next; q != NULL; q = q->next)
+    for(q = p; q != NULL; q = q->next)
     {
         memcpy(payload + offset, q->payload, q->len);
         offset += q->len;
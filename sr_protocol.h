@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_protocol.h
+ *
+ * Description:
+ *
+ * Link and network level header definitions shared by the router
+ * subsystem.  IPv4 headers use struct ip from <netinet/ip.h> (as in
+ * sr_lwtcp_glue.c); everything the system headers don't give us portably
+ * lives here.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PROTOCOL_H
+#define SR_PROTOCOL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#ifdef _SOLARIS_
+#include <inttypes.h>
+#endif /* _SOLARIS_ */
+
+#ifndef ETHER_ADDR_LEN
+#define ETHER_ADDR_LEN 6
+#endif
+
+#define SR_ETHER_HDR_LEN 14
+
+#define SR_ETHERTYPE_IP  0x0800
+#define SR_ETHERTYPE_ARP 0x0806
+
+#define SR_IP_PROTO_ICMP 1
+#define SR_IP_PROTO_TCP  6
+#define SR_IP_PROTO_UDP  17
+
+#define SR_ARP_HRD_ETHER 1
+#define SR_ARP_OP_REQUEST 1
+#define SR_ARP_OP_REPLY   2
+
+#define SR_ETHER_MIN_LEN 60  /* shortest frame on the wire, sans FCS */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ethernet_hdr
+ *
+ * Ethernet II header, all fields in network byte order
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ethernet_hdr
+{
+    uint8_t  ether_dhost[ETHER_ADDR_LEN];    /* destination ethernet address */
+    uint8_t  ether_shost[ETHER_ADDR_LEN];    /* source ethernet address */
+    uint16_t ether_type;                     /* packet type ID */
+} __attribute__ ((packed)) ;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_arphdr
+ *
+ * ARP header for ethernet/IPv4 (RFC 826), all fields in network byte order
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_arphdr
+{
+    uint16_t ar_hrd;                  /* format of hardware address   */
+    uint16_t ar_pro;                  /* format of protocol address   */
+    uint8_t  ar_hln;                  /* length of hardware address   */
+    uint8_t  ar_pln;                  /* length of protocol address   */
+    uint16_t ar_op;                   /* ARP opcode (command)         */
+    uint8_t  ar_sha[ETHER_ADDR_LEN];  /* sender hardware address      */
+    uint32_t ar_sip;                  /* sender IP address            */
+    uint8_t  ar_tha[ETHER_ADDR_LEN];  /* target hardware address      */
+    uint32_t ar_tip;                  /* target IP address            */
+} __attribute__ ((packed)) ;
+
+#endif  /* -- SR_PROTOCOL_H -- */
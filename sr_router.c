@@ -0,0 +1,585 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_router.c
+ *
+ * Description:
+ *
+ * The router subsystem.  sr_integration.c forwards the integration
+ * callbacks (interfaces, packets, source address selection) here.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#define  __USE_BSD 1
+#include <sys/socket.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+
+#include "lwip/inet.h"
+#include "lwtcp_sr_integration.h"
+
+#include "sr_router.h"
+#include "sr_rtable.h"
+#include "sr_arp.h"
+#include "sr_flowcache.h"
+#include "sr_integration.h"
+
+static struct sr_router_if* sr_router_if_by_name(struct sr_router* router,
+                                                 const char* name);
+static struct sr_router_if* sr_router_if_by_ip(struct sr_router* router,
+                                               uint32_t ip /* nbo */);
+static void sr_router_handle_ip(struct sr_router* router,
+                                uint8_t* packet /* lent */,
+                                unsigned int len,
+                                struct sr_router_if* in_if);
+static void sr_router_deliver_local(struct sr_router* router,
+                                    struct ip* iph,
+                                    struct sr_router_if* in_if);
+static void sr_router_forward(struct sr_router* router,
+                              uint8_t* packet /* lent */,
+                              unsigned int len,
+                              struct sr_router_if* in_if);
+
+/* -- flow cache of a forwarding worker, router->flows if not set -- */
+static __thread struct sr_flowcache* sr_router_thread_flows = 0;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_create(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_router* sr_router_create(struct sr_instance* sr)
+{
+    struct sr_router* router;
+
+    router = (struct sr_router*)calloc(1, sizeof(struct sr_router));
+    if ( ! router )
+    { return 0; }
+
+    router->sr = sr;
+
+    if ( ! (router->rtable = sr_rtable_create()) )
+    {
+        free(router);
+        return 0;
+    }
+
+    if ( ! (router->arp = sr_arp_create(sr)) )
+    {
+        sr_rtable_destroy(router->rtable);
+        free(router);
+        return 0;
+    }
+
+    if ( ! (router->flows = sr_flowcache_create()) )
+    {
+        sr_arp_destroy(router->arp);
+        sr_rtable_destroy(router->rtable);
+        free(router);
+        return 0;
+    }
+
+    return router;
+} /* -- sr_router_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_destroy(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_router_destroy(struct sr_router* router)
+{
+    if ( ! router )
+    { return; }
+
+    sr_flowcache_destroy(router->flows);
+    sr_arp_destroy(router->arp);
+    sr_rtable_destroy(router->rtable);
+    free(router);
+} /* -- sr_router_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_add_interface(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_router_add_interface(struct sr_router* router,
+                             struct sr_vns_if* vns_if /* borrowed */)
+{
+    struct sr_router_if* intf;
+
+    /* REQUIRES */
+    assert(router);
+    assert(vns_if);
+
+    if ( router->num_if == SR_ROUTER_MAX_IF )
+    {
+        fprintf(stderr, "Error: too many interfaces, ignoring %s\n",
+                vns_if->name);
+        return;
+    }
+
+    intf = &(router->if_list[router->num_if]);
+    strncpy(intf->name, vns_if->name, SR_NAMELEN);
+    intf->name[SR_NAMELEN - 1] = 0;
+    memcpy(intf->addr, vns_if->addr, ETHER_ADDR_LEN);
+    intf->ip      = vns_if->ip;
+    intf->mask    = vns_if->mask;
+    intf->speed   = vns_if->speed;
+    intf->enabled = 1;
+
+    router->num_if++;
+} /* -- sr_router_add_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_load_rtable(..)
+ * Scope: global
+ *
+ * Must be called after all interfaces have been added since routes refer
+ * to them by name.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_router_load_rtable(struct sr_router* router, const char* filename)
+{
+    /* REQUIRES */
+    assert(router);
+
+    return sr_rtable_load(router->sr, router->rtable, filename);
+} /* -- sr_router_load_rtable -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_handle_packet(..)
+ * Scope: global
+ *
+ * Entry point for every frame received by the router.  The frame is
+ * rewritten in place on the way out so the buffer must be writable, it is
+ * not kept beyond the call.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_router_handle_packet(struct sr_router* router,
+                             uint8_t* packet /* lent */,
+                             unsigned int len,
+                             const char* interface /* borrowed */)
+{
+    struct sr_ethernet_hdr* eth;
+    struct sr_router_if* in_if;
+
+    /* REQUIRES */
+    assert(router);
+    assert(packet);
+
+    if ( len < SR_ETHER_HDR_LEN )
+    { return; }
+
+    in_if = sr_router_if_by_name(router, interface);
+    if ( ! in_if || ! in_if->enabled )
+    { return; }
+
+    eth = (struct sr_ethernet_hdr*)packet;
+    switch ( ntohs(eth->ether_type) )
+    {
+        case SR_ETHERTYPE_IP:
+            sr_router_handle_ip(router, packet, len, in_if);
+            break;
+
+        case SR_ETHERTYPE_ARP:
+            sr_arp_handle_packet(router->arp, packet, len, in_if);
+            break;
+
+        default:
+            Debug("dropping frame with ethertype 0x%04x on %s\n",
+                  ntohs(eth->ether_type), in_if->name);
+            break;
+    }
+} /* -- sr_router_handle_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_set_thread_flowcache(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_router_set_thread_flowcache(struct sr_flowcache* flows)
+{
+    sr_router_thread_flows = flows;
+} /* -- sr_router_set_thread_flowcache -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_findsrcip(..)
+ * Scope: global
+ *
+ * Address of the interface the route to dest goes out of, 0 if unroutable.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint32_t sr_router_findsrcip(struct sr_router* router, uint32_t dest /* nbo */)
+{
+    struct sr_router_if* out_if;
+    uint32_t next_hop;
+
+    out_if = sr_rtable_lookup(router->rtable, dest, &next_hop);
+
+    return out_if ? out_if->ip : 0;
+} /* -- sr_router_findsrcip -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_ip_output(..)
+ * Scope: global
+ *
+ * Wrap a transport segment generated by the router in an IP header and
+ * send it.  payload is freed.
+ *
+ * RETURN VALUES:
+ *
+ *  0 if the packet was sent or queued for ARP, -1 if it was dropped
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_router_ip_output(struct sr_router* router,
+                        uint8_t* payload /* given */,
+                        uint8_t  proto,
+                        uint32_t src /* nbo */,
+                        uint32_t dest /* nbo */,
+                        unsigned int len)
+{
+    uint8_t hdr[SR_INTEG_IP_HEADROOM];
+    struct iovec iov[2];
+    int ret;
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = sizeof(hdr);
+    iov[1].iov_base = payload;
+    iov[1].iov_len  = len;
+
+    ret = sr_router_ip_output_v(router, iov, 2, proto, src, dest);
+
+    free(payload);
+    return ret;
+} /* -- sr_router_ip_output -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_ip_output_v(..)
+ * Scope: global
+ *
+ * Same as sr_router_ip_output(..) for a segment in pieces.  The ethernet
+ * and IP headers are written into iov[0] (SR_INTEG_IP_HEADROOM bytes, in
+ * practice room lwip left in front of its first pbuf) and the frame goes
+ * out as it is.  Only a frame that has to wait for ARP is flattened, the
+ * queue keeps a copy anyway.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_router_ip_output_v(struct sr_router* router,
+                          struct iovec* iov /* lent */,
+                          int iovcnt,
+                          uint8_t  proto,
+                          uint32_t src /* nbo */,
+                          uint32_t dest /* nbo */)
+{
+    static uint16_t ip_id = 0; /* -- workers and lwip both send -- */
+    struct sr_router_if* out_if;
+    struct sr_ethernet_hdr* eth;
+    struct ip* iph;
+    uint8_t* packet;
+    uint32_t next_hop;
+    unsigned int len = 0;
+    int ret = -1;
+    int i;
+
+    assert(iov[0].iov_len == SR_INTEG_IP_HEADROOM);
+
+    out_if = sr_rtable_lookup(router->rtable, dest, &next_hop);
+    if ( ! out_if || ! out_if->enabled )
+    {
+        Debug("dropping locally generated packet with no route\n");
+        return -1;
+    }
+
+    for ( i = 1; i < iovcnt; ++i )
+    { len += iov[i].iov_len; }
+
+    eth = (struct sr_ethernet_hdr*)iov[0].iov_base;
+    iph = (struct ip*)((uint8_t*)iov[0].iov_base + SR_ETHER_HDR_LEN);
+
+    iph->ip_v   = 4;
+    iph->ip_hl  = sizeof(struct ip) / 4;
+    iph->ip_tos = 0;
+    iph->ip_len = htons(sizeof(struct ip) + len);
+    iph->ip_id  = htons(__atomic_fetch_add(&ip_id, 1, __ATOMIC_RELAXED));
+    iph->ip_off = 0;
+    iph->ip_ttl = 64;
+    iph->ip_p   = proto;
+    iph->ip_src.s_addr = src ? src : out_if->ip;
+    iph->ip_dst.s_addr = dest;
+    iph->ip_sum = 0;
+    iph->ip_sum = inet_chksum(iph, sizeof(struct ip));
+
+    eth->ether_type = htons(SR_ETHERTYPE_IP);
+    memcpy(eth->ether_shost, out_if->addr, ETHER_ADDR_LEN);
+
+    if ( sr_arp_lookup(router->arp, next_hop, eth->ether_dhost) )
+    {
+        return sr_integ_low_level_output_v(router->sr, iov, iovcnt,
+                                           out_if->name);
+    }
+
+    /* -- waiting on ARP, the queue wants it in one piece -- */
+    len += SR_INTEG_IP_HEADROOM;
+    if ( (packet = (uint8_t*)malloc(len)) )
+    {
+        for ( len = 0, i = 0; i < iovcnt; len += iov[i].iov_len, ++i )
+        { memcpy(packet + len, iov[i].iov_base, iov[i].iov_len); }
+
+        ret = sr_arp_queue(router->arp, packet, len, out_if, next_hop);
+        free(packet);
+    }
+    else
+    { fprintf(stderr, "Error: out of memory (sr_router_ip_output_v)\n"); }
+
+    return ret;
+} /* -- sr_router_ip_output_v -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: router_interface_set_enabled(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int router_interface_set_enabled( struct sr_instance* sr, const char* name, int enabled )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+    struct sr_router_if* intf;
+
+    if ( ! router || ! (intf = sr_router_if_by_name(router, name)) )
+    { return -1; }
+
+    enabled = enabled ? 1 : 0;
+    if ( intf->enabled == enabled )
+    { return 1; }
+
+    intf->enabled = enabled;
+    sr_flowcache_invalidate();
+    return 0;
+} /* -- router_interface_set_enabled -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: router_lookup_interface_via_ip(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_router_if* router_lookup_interface_via_ip( struct sr_instance* sr,
+                                                     uint32_t ip )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    return router ? sr_router_if_by_ip(router, ip) : 0;
+} /* -- router_lookup_interface_via_ip -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: router_lookup_interface_via_name(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_router_if* router_lookup_interface_via_name( struct sr_instance* sr,
+                                                       const char* name )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    return router ? sr_router_if_by_name(router, name) : 0;
+} /* -- router_lookup_interface_via_name -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: router_is_interface_enabled(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int router_is_interface_enabled( struct sr_instance* sr, void* intf )
+{
+    return intf ? ((struct sr_router_if*)intf)->enabled : 0;
+} /* -- router_is_interface_enabled -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_if_by_name(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static struct sr_router_if* sr_router_if_by_name(struct sr_router* router,
+                                                 const char* name)
+{
+    unsigned i;
+
+    if ( ! name )
+    { return 0; }
+
+    for ( i = 0; i < router->num_if; ++i )
+    {
+        if ( strncmp(router->if_list[i].name, name, SR_NAMELEN) == 0 )
+        { return &(router->if_list[i]); }
+    }
+
+    return 0;
+} /* -- sr_router_if_by_name -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_if_by_ip(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static struct sr_router_if* sr_router_if_by_ip(struct sr_router* router,
+                                               uint32_t ip /* nbo */)
+{
+    unsigned i;
+
+    for ( i = 0; i < router->num_if; ++i )
+    {
+        if ( router->if_list[i].ip == ip )
+        { return &(router->if_list[i]); }
+    }
+
+    return 0;
+} /* -- sr_router_if_by_ip -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_handle_ip(..)
+ * Scope: local
+ *
+ * Sanity check an IPv4 packet and either deliver it locally or forward it.
+ * With -c the header checksum is assumed good (e.g. checked by hardware);
+ * a bad one is then simply carried along by the incremental update.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_router_handle_ip(struct sr_router* router,
+                                uint8_t* packet /* lent */,
+                                unsigned int len,
+                                struct sr_router_if* in_if)
+{
+    struct ip* iph;
+    unsigned int hlen, ip_len;
+
+    if ( len < SR_ETHER_HDR_LEN + sizeof(struct ip) )
+    { return; }
+
+    iph    = (struct ip*)(packet + SR_ETHER_HDR_LEN);
+    hlen   = iph->ip_hl * 4;
+    ip_len = ntohs(iph->ip_len);
+
+    if ( iph->ip_v != 4 || hlen < sizeof(struct ip) || ip_len < hlen ||
+         SR_ETHER_HDR_LEN + ip_len > len )
+    {
+        Debug("dropping malformed IP packet on %s\n", in_if->name);
+        return;
+    }
+
+    if ( ! router->sr->ip_chksum_trusted && inet_chksum(iph, hlen) != 0 )
+    {
+        Debug("dropping IP packet with bad checksum on %s\n", in_if->name);
+        return;
+    }
+
+    if ( sr_router_if_by_ip(router, iph->ip_dst.s_addr) )
+    {
+        sr_router_deliver_local(router, iph, in_if);
+        return;
+    }
+
+    /* -- ignore any ethernet padding past the IP packet -- */
+    sr_router_forward(router, packet, SR_ETHER_HDR_LEN + ip_len, in_if);
+} /* -- sr_router_handle_ip -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_deliver_local(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_router_deliver_local(struct sr_router* router,
+                                    struct ip* iph,
+                                    struct sr_router_if* in_if)
+{
+    switch ( iph->ip_p )
+    {
+        case SR_IP_PROTO_TCP:
+            /* -- may keep the receive buffer, we are done with it -- */
+            sr_transport_input((uint8_t*)iph /* borrowed */);
+            break;
+
+        default:
+            Debug("not yet implemented: local delivery of IP protocol %u\n",
+                  iph->ip_p);
+            break;
+    }
+} /* -- sr_router_deliver_local -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_router_forward(..)
+ * Scope: local
+ *
+ * Route lookup, TTL decrement and hand off to the link layer.  Flows that
+ * were resolved before skip the route and ARP lookups via the flow cache.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_router_forward(struct sr_router* router,
+                              uint8_t* packet /* lent */,
+                              unsigned int len,
+                              struct sr_router_if* in_if)
+{
+    struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*)packet;
+    struct ip* iph = (struct ip*)(packet + SR_ETHER_HDR_LEN);
+    struct sr_flowcache* flows = sr_router_thread_flows;
+    const struct sr_flow_entry* flow;
+    struct sr_router_if* out_if;
+    uint32_t next_hop, gen;
+    uint16_t old_word;
+
+    if ( iph->ip_ttl <= 1 )
+    {
+        Debug("dropping IP packet whose TTL expired on %s\n", in_if->name);
+        return;
+    }
+
+    if ( ! flows )
+    { flows = router->flows; }
+
+    /* -- TTL shares a 16 bit word with the protocol, patch the sum -- */
+    old_word = htons((iph->ip_ttl << 8) | iph->ip_p);
+    iph->ip_ttl--;
+    iph->ip_sum = inet_chksum_adjust(iph->ip_sum, old_word,
+                                     htons((iph->ip_ttl << 8) | iph->ip_p));
+
+    gen = sr_flowcache_generation();
+    if ( (flow = sr_flowcache_lookup(flows, iph->ip_dst.s_addr,
+                                     in_if, gen)) )
+    {
+        memcpy(eth->ether_dhost, flow->ether_dhost, ETHER_ADDR_LEN);
+        memcpy(eth->ether_shost, flow->ether_shost, ETHER_ADDR_LEN);
+        sr_integ_low_level_output(router->sr, packet, len, flow->out_if->name);
+        return;
+    }
+
+    out_if = sr_rtable_lookup(router->rtable, iph->ip_dst.s_addr, &next_hop);
+    if ( ! out_if || ! out_if->enabled )
+    {
+        Debug("dropping IP packet with no route on %s\n", in_if->name);
+        return;
+    }
+
+    memcpy(eth->ether_shost, out_if->addr, ETHER_ADDR_LEN);
+
+    if ( sr_arp_lookup(router->arp, next_hop, eth->ether_dhost) )
+    {
+        sr_flowcache_insert(flows, iph->ip_dst.s_addr, in_if, out_if,
+                            eth, gen);
+        sr_integ_low_level_output(router->sr, packet, len, out_if->name);
+        return;
+    }
+
+    sr_arp_queue(router->arp, packet, len, out_if, next_hop);
+} /* -- sr_router_forward -- */
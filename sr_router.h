@@ -0,0 +1,139 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_router.h
+ *
+ * Description:
+ *
+ * The router subsystem hung off of sr_instance via sr_set_subsystem(..).
+ * Holds the interface list, the routing table and the ARP cache and
+ * implements the per-packet work behind sr_integ_input(..).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ROUTER_H
+#define SR_ROUTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_base_internal.h"
+#include "sr_protocol.h"
+
+/* maximum number of interfaces a router may have */
+#define SR_ROUTER_MAX_IF 16
+
+struct sr_rtable; /* -- forward declare, see sr_rtable.h -- */
+struct sr_arp;    /* -- forward declare, see sr_arp.h -- */
+struct sr_flowcache; /* -- forward declare, see sr_flowcache.h -- */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_router_if
+ *
+ * A single router interface.  Interfaces live in a fixed array inside
+ * sr_router so pointers to them stay valid for the life of the router.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_router_if
+{
+    char     name[SR_NAMELEN];
+    uint8_t  addr[ETHER_ADDR_LEN];
+    uint32_t ip;   /* nbo */
+    uint32_t mask; /* nbo */
+    uint32_t speed;
+    int      enabled;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_router
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_router
+{
+    struct sr_instance* sr;
+
+    struct sr_router_if if_list[SR_ROUTER_MAX_IF];
+    unsigned            num_if;
+
+    struct sr_rtable*   rtable;
+    struct sr_arp*      arp;
+    struct sr_flowcache* flows; /* packet thread's, workers have their own */
+};
+
+struct sr_router* sr_router_create(struct sr_instance* sr);
+void sr_router_destroy(struct sr_router* router);
+
+void sr_router_add_interface(struct sr_router* router,
+                             struct sr_vns_if* vns_if /* borrowed */);
+int  sr_router_load_rtable(struct sr_router* router, const char* filename);
+
+void sr_router_handle_packet(struct sr_router* router,
+                             uint8_t* packet /* lent */,
+                             unsigned int len,
+                             const char* interface /* borrowed */);
+
+/**
+ * Have the calling thread use flows instead of router->flows, for
+ * forwarding workers (see sr_workers.h).  flows is not thread safe.
+ */
+void sr_router_set_thread_flowcache(struct sr_flowcache* flows);
+
+uint32_t sr_router_findsrcip(struct sr_router* router, uint32_t dest /* nbo */);
+
+int sr_router_ip_output(struct sr_router* router,
+                        uint8_t* payload /* given */,
+                        uint8_t  proto,
+                        uint32_t src /* nbo */,
+                        uint32_t dest /* nbo */,
+                        unsigned int len);
+
+/**
+ * Same as sr_router_ip_output(..) for a segment in iov[1] .. iov[iovcnt - 1]
+ * with iov[0] SR_INTEG_IP_HEADROOM bytes of room for the headers.
+ */
+int sr_router_ip_output_v(struct sr_router* router,
+                          struct iovec* iov /* lent */,
+                          int iovcnt,
+                          uint8_t  proto,
+                          uint32_t src /* nbo */,
+                          uint32_t dest /* nbo */);
+
+/* ----------------------------------------------------------------------------
+ * Interface hooks used by the CLI
+ * -------------------------------------------------------------------------*/
+
+/**
+ * Enables or disables an interface on the router.
+ * @return 0 if name was enabled
+ *         -1 if it does not not exist
+ *         1 if already set to enabled
+ */
+int router_interface_set_enabled( struct sr_instance* sr, const char* name, int enabled );
+
+/**
+ * Returns a pointer to the interface which is assigned the specified IP.
+ *
+ * @return interface, or NULL if the IP does not belong to any interface
+ */
+struct sr_router_if* router_lookup_interface_via_ip( struct sr_instance* sr,
+                                                     uint32_t ip );
+
+/**
+ * Returns a pointer to the interface described by the specified name.
+ *
+ * @return interface, or NULL if the name does not match any interface
+ */
+struct sr_router_if* router_lookup_interface_via_name( struct sr_instance* sr,
+                                                       const char* name );
+
+/**
+ * Returns 1 if the specified interface is up and 0 otherwise.
+ */
+int router_is_interface_enabled( struct sr_instance* sr, void* intf );
+
+#endif  /* -- SR_ROUTER_H -- */
@@ -0,0 +1,636 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtable.c
+ *
+ * Description:
+ *
+ * Routing table of the router subsystem.  Routes are kept in a singly
+ * linked list which is only walked on the control path (CLI, loading,
+ * removal); per-packet lookups go through the FIB, either the trie in
+ * sr_fib_trie.c (default) or DIR-24-8 in sr_fib_dir24.c (-f dir24).  Both
+ * are updated incrementally as routes come and go.
+ *
+ * The table is written by CLI client threads and read by the packet thread
+ * and the transport thread (sr_integ_findsrcip).  Writers hold rtable->lock
+ * among themselves; readers only enter an epoch read section, so neither an
+ * update nor a full purge ever makes forwarding wait.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_rtable.h"
+#include "sr_fib_trie.h"
+#include "sr_fib_dir24.h"
+#include "sr_router.h"
+#include "sr_epoch.h"
+#include "sr_flowcache.h"
+
+static int  sr_mask_to_plen(uint32_t mask /* nbo */);
+static int  sr_rtable_add(struct sr_rtable* rtable, uint32_t dest,
+                          uint32_t gw, uint32_t mask,
+                          struct sr_router_if* intf, int is_static);
+static int  sr_rtable_remove(struct sr_rtable* rtable, uint32_t dest,
+                             uint32_t mask, int is_static);
+static void sr_rtable_purge(struct sr_rtable* rtable, int which);
+static struct sr_rtable_fib* sr_rtable_fib_build(int fib_type,
+                                                 struct sr_rt* routes);
+static void sr_rtable_fib_free(struct sr_rtable_fib* fib);
+static int  sr_rtable_fib_insert(struct sr_rtable_fib* fib, struct sr_rt* rt,
+                                 const struct sr_rt* old);
+static void sr_rtable_fib_remove(struct sr_rtable_fib* fib, struct sr_rt* rt,
+                                 struct sr_rt* remaining);
+static void sr_rtable_fib_reclaim(struct sr_rtable_fib* fib);
+
+/* -- values for sr_rtable_purge's which -- */
+#define SR_RT_PURGE_DYNAMIC 0
+#define SR_RT_PURGE_STATIC  1
+#define SR_RT_PURGE_ALL     2
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_create(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_rtable* sr_rtable_create(void)
+{
+    struct sr_rtable* rtable;
+
+    rtable = (struct sr_rtable*)calloc(1, sizeof(struct sr_rtable));
+    if ( ! rtable )
+    { return 0; }
+
+    rtable->fib_type = SR_FIB_TRIE;
+    if ( ! (rtable->fib = sr_rtable_fib_build(SR_FIB_TRIE, 0)) )
+    {
+        free(rtable);
+        return 0;
+    }
+
+    pthread_mutex_init(&(rtable->lock), 0);
+
+    return rtable;
+} /* -- sr_rtable_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_destroy(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_rtable_destroy(struct sr_rtable* rtable)
+{
+    struct sr_rt* rt;
+
+    if ( ! rtable )
+    { return; }
+
+    sr_rtable_fib_free(rtable->fib);
+
+    while ( (rt = rtable->routes) )
+    {
+        rtable->routes = rt->next;
+        free(rt);
+    }
+
+    pthread_mutex_destroy(&(rtable->lock));
+    free(rtable);
+} /* -- sr_rtable_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_set_fib(..)
+ * Scope: global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_rtable_set_fib(struct sr_rtable* rtable, int fib_type)
+{
+    struct sr_rtable_fib* fib;
+    struct sr_rtable_fib* old;
+
+    /* REQUIRES */
+    assert(rtable);
+
+    pthread_mutex_lock(&(rtable->lock));
+
+    if ( fib_type == rtable->fib_type )
+    {
+        pthread_mutex_unlock(&(rtable->lock));
+        return 0;
+    }
+
+    if ( ! (fib = sr_rtable_fib_build(fib_type, rtable->routes)) )
+    {
+        pthread_mutex_unlock(&(rtable->lock));
+        return -1;
+    }
+
+    old = rtable->fib;
+    rtable->fib_type = fib_type;
+    sr_rcu_assign(rtable->fib, fib);
+    sr_flowcache_invalidate();
+
+    pthread_mutex_unlock(&(rtable->lock));
+
+    sr_epoch_synchronize();
+    sr_rtable_fib_free(old);
+
+    return 0;
+} /* -- sr_rtable_set_fib -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_load(..)
+ * Scope: global
+ *
+ * Read static routes from filename.  One route per line:
+ *
+ * <dest gw mask interface>
+ *
+ * e.g.
+ *
+ * 0.0.0.0 10.0.1.1 0.0.0.0 eth0
+ *
+ * RETURN VALUES:
+ *
+ *  number of routes loaded, -1 if the file could not be read
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_rtable_load(struct sr_instance* sr, struct sr_rtable* rtable,
+                   const char* filename)
+{
+    FILE* fp;
+    char line[1024];
+    char dest[32], gw[32], mask[32], iface[32];
+    struct in_addr dest_addr, gw_addr, mask_addr;
+    struct sr_router_if* intf;
+    int count = 0;
+
+    /* REQUIRES */
+    assert(rtable);
+    assert(filename);
+
+    if ( (fp = fopen(filename, "r")) == 0 )
+    {
+        fprintf(stderr, "Error: could not open routing table file: %s\n",
+                filename);
+        return -1;
+    }
+
+    while ( fgets(line, 1024, fp) )
+    {
+        if ( sscanf(line, "%31s %31s %31s %31s", dest, gw, mask, iface) != 4 )
+        { continue; } /* -- blank or junk line -- */
+
+        if ( inet_aton(dest, &dest_addr) == 0 ||
+             inet_aton(gw,   &gw_addr)   == 0 ||
+             inet_aton(mask, &mask_addr) == 0 )
+        {
+            fprintf(stderr, "Bad formatting in routing table: %s", line);
+            continue;
+        }
+
+        if ( ! (intf = router_lookup_interface_via_name(sr, iface)) )
+        {
+            fprintf(stderr, "Routing table references unknown interface %s\n",
+                    iface);
+            continue;
+        }
+
+        if ( sr_rtable_add(rtable, dest_addr.s_addr, gw_addr.s_addr,
+                           mask_addr.s_addr, intf, 1) == 0 )
+        { count++; }
+    }
+
+    fclose(fp);
+
+    Debug(" < -- Loaded %d routes from %s -- >\n", count, filename);
+    return count;
+} /* -- sr_rtable_load -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_lookup(..)
+ * Scope: global
+ *
+ * Per-packet longest prefix match.  Everything we hand back (interface,
+ * next hop address) outlives the read section.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_router_if* sr_rtable_lookup(struct sr_rtable* rtable,
+                                      uint32_t dest /* nbo */,
+                                      uint32_t* next_hop /* nbo */)
+{
+    const struct sr_rtable_fib* fib;
+    const struct sr_dir24_nh* nh;
+    struct sr_rt* rt;
+    struct sr_router_if* intf = 0;
+
+    sr_epoch_enter();
+
+    fib = sr_rcu_deref(rtable->fib);
+    if ( fib->dir24 )
+    {
+        if ( (nh = sr_fib_dir24_lookup(fib->dir24, ntohl(dest))) )
+        {
+            intf = nh->intf;
+            *next_hop = nh->gw ? nh->gw : dest;
+        }
+    }
+    else if ( (rt = sr_fib_trie_lookup(fib->trie, ntohl(dest))) )
+    {
+        intf = rt->intf;
+        *next_hop = rt->gw ? rt->gw : dest;
+    }
+
+    sr_epoch_exit();
+
+    return intf;
+} /* -- sr_rtable_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: rtable_route_add(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void rtable_route_add( struct sr_instance* sr,
+                       uint32_t dest, uint32_t gw, uint32_t mask,
+                       void* intf,
+                       int is_static_route )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    if ( ! router )
+    { return; }
+
+    sr_rtable_add(router->rtable, dest, gw, mask,
+                  (struct sr_router_if*)intf, is_static_route);
+} /* -- rtable_route_add -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: rtable_route_remove(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int rtable_route_remove( struct sr_instance* sr,
+                         uint32_t dest, uint32_t mask,
+                         int is_static )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    if ( ! router )
+    { return 0; }
+
+    return sr_rtable_remove(router->rtable, dest, mask, is_static);
+} /* -- rtable_route_remove -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: rtable_purge_all(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void rtable_purge_all( struct sr_instance* sr )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    if ( router )
+    { sr_rtable_purge(router->rtable, SR_RT_PURGE_ALL); }
+} /* -- rtable_purge_all -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: rtable_purge(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void rtable_purge( struct sr_instance* sr, int is_static )
+{
+    struct sr_router* router = (struct sr_router*)sr_get_subsystem(sr);
+
+    if ( router )
+    {
+        sr_rtable_purge(router->rtable, is_static ? SR_RT_PURGE_STATIC
+                                                  : SR_RT_PURGE_DYNAMIC);
+    }
+} /* -- rtable_purge -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_add(..)
+ * Scope: local
+ *
+ * Add a route, replacing any route with the same destination and mask.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_rtable_add(struct sr_rtable* rtable, uint32_t dest,
+                         uint32_t gw, uint32_t mask,
+                         struct sr_router_if* intf, int is_static)
+{
+    struct sr_rt* rt;
+    struct sr_rt* old;
+    struct sr_rt** prev;
+    int plen;
+
+    if ( ! intf )
+    { return -1; }
+
+    if ( (plen = sr_mask_to_plen(mask)) < 0 )
+    {
+        fprintf(stderr, "Error: non-contiguous route mask %s\n",
+                inet_ntoa(*(struct in_addr*)&mask));
+        return -1;
+    }
+
+    if ( (rt = (struct sr_rt*)malloc(sizeof(struct sr_rt))) == 0 )
+    {
+        fprintf(stderr, "Error: out of memory (sr_rtable_add)\n");
+        return -1;
+    }
+    rt->dest      = dest & mask;
+    rt->gw        = gw;
+    rt->mask      = mask;
+    rt->plen      = plen;
+    rt->is_static = is_static ? 1 : 0;
+    rt->intf      = intf;
+
+    pthread_mutex_lock(&(rtable->lock));
+
+    for ( prev = &(rtable->routes); *prev; prev = &((*prev)->next) )
+    {
+        if ( (*prev)->dest == rt->dest && (*prev)->plen == rt->plen )
+        { break; }
+    }
+    old = *prev;
+
+    /* -- the FIB insert overwrites old's entries, so just unlink it -- */
+    if ( sr_rtable_fib_insert(rtable->fib, rt, old) )
+    {
+        pthread_mutex_unlock(&(rtable->lock));
+        free(rt);
+        return -1;
+    }
+    sr_flowcache_invalidate();
+
+    if ( old )
+    {
+        *prev = old->next;
+        rtable->num_routes--;
+
+        /* -- readers may still hold old until the grace period is over -- */
+        sr_epoch_synchronize();
+        sr_rtable_fib_reclaim(rtable->fib);
+    }
+
+    rt->next = rtable->routes;
+    rtable->routes = rt;
+    rtable->num_routes++;
+
+    pthread_mutex_unlock(&(rtable->lock));
+
+    if ( old )
+    { free(old); }
+
+    return 0;
+} /* -- sr_rtable_add -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_remove(..)
+ * Scope: local
+ *
+ * RETURN VALUES:
+ *
+ *  1 if the route was removed, 0 if there was no such route
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_rtable_remove(struct sr_rtable* rtable, uint32_t dest,
+                            uint32_t mask, int is_static)
+{
+    struct sr_rt* rt = 0;
+    struct sr_rt** prev;
+    int plen;
+
+    if ( (plen = sr_mask_to_plen(mask)) < 0 )
+    { return 0; }
+    dest &= mask;
+
+    pthread_mutex_lock(&(rtable->lock));
+
+    for ( prev = &(rtable->routes); *prev; prev = &((*prev)->next) )
+    {
+        if ( (*prev)->dest == dest && (*prev)->plen == plen &&
+             (*prev)->is_static == (is_static ? 1 : 0) )
+        {
+            rt = *prev;
+            *prev = rt->next;
+            rtable->num_routes--;
+            sr_rtable_fib_remove(rtable->fib, rt, rtable->routes);
+            sr_flowcache_invalidate();
+            sr_epoch_synchronize();
+            sr_rtable_fib_reclaim(rtable->fib);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&(rtable->lock));
+
+    if ( ! rt )
+    { return 0; }
+
+    free(rt);
+    return 1;
+} /* -- sr_rtable_remove -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_purge(..)
+ * Scope: local
+ *
+ * Removing routes one at a time costs a list walk each, so purges unlink
+ * everything that goes, build a fresh FIB from what is left and swap it in.
+ * Forwarding keeps using the old FIB meanwhile.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_rtable_purge(struct sr_rtable* rtable, int which)
+{
+    struct sr_rt* doomed = 0;
+    struct sr_rt* rt;
+    struct sr_rt** prev;
+    struct sr_rtable_fib* fib;
+    struct sr_rtable_fib* old = 0;
+
+    pthread_mutex_lock(&(rtable->lock));
+
+    prev = &(rtable->routes);
+    while ( (rt = *prev) )
+    {
+        if ( which == SR_RT_PURGE_ALL || rt->is_static == which )
+        {
+            *prev = rt->next;
+            rt->next = doomed;
+            doomed = rt;
+            rtable->num_routes--;
+        }
+        else
+        { prev = &(rt->next); }
+    }
+
+    if ( (fib = sr_rtable_fib_build(rtable->fib_type, rtable->routes)) )
+    {
+        old = rtable->fib;
+        sr_rcu_assign(rtable->fib, fib);
+    }
+    else
+    {
+        /* -- no memory for a copy, remove from the live FIB in place -- */
+        for ( rt = doomed; rt; rt = rt->next )
+        {
+            sr_rtable_fib_remove(rtable->fib, rt, rtable->routes);
+            sr_epoch_synchronize();
+            sr_rtable_fib_reclaim(rtable->fib);
+        }
+    }
+    sr_flowcache_invalidate();
+
+    pthread_mutex_unlock(&(rtable->lock));
+
+    sr_epoch_synchronize();
+    sr_rtable_fib_free(old);
+
+    while ( (rt = doomed) )
+    {
+        doomed = rt->next;
+        free(rt);
+    }
+} /* -- sr_rtable_purge -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_fib_build(..)
+ * Scope: local
+ *
+ * Build a FIB of fib_type indexing routes.  Returns 0 on failure.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_rtable_fib* sr_rtable_fib_build(int fib_type,
+                                                 struct sr_rt* routes)
+{
+    struct sr_rtable_fib* fib;
+    struct sr_rt* rt;
+
+    if ( ! (fib = (struct sr_rtable_fib*)calloc(1,
+                                        sizeof(struct sr_rtable_fib))) )
+    { return 0; }
+
+    if ( fib_type == SR_FIB_DIR24 )
+    { fib->dir24 = sr_fib_dir24_create(); }
+    else
+    { fib->trie = sr_fib_trie_create(); }
+
+    if ( ! fib->trie && ! fib->dir24 )
+    {
+        free(fib);
+        return 0;
+    }
+
+    for ( rt = routes; rt; rt = rt->next )
+    {
+        if ( sr_rtable_fib_insert(fib, rt, 0) )
+        {
+            sr_rtable_fib_free(fib);
+            return 0;
+        }
+    }
+
+    return fib;
+} /* -- sr_rtable_fib_build -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_fib_free(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_rtable_fib_free(struct sr_rtable_fib* fib)
+{
+    if ( ! fib )
+    { return; }
+
+    sr_fib_trie_destroy(fib->trie);
+    sr_fib_dir24_destroy(fib->dir24);
+    free(fib);
+} /* -- sr_rtable_fib_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_fib_insert(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int sr_rtable_fib_insert(struct sr_rtable_fib* fib, struct sr_rt* rt,
+                                const struct sr_rt* old)
+{
+    if ( fib->dir24 )
+    { return sr_fib_dir24_insert(fib->dir24, rt, old); }
+
+    return sr_fib_trie_insert(fib->trie, rt);
+} /* -- sr_rtable_fib_insert -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_fib_remove(..)
+ * Scope: local
+ *
+ * The caller must sr_epoch_synchronize() and sr_rtable_fib_reclaim(..)
+ * before the next removal.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_rtable_fib_remove(struct sr_rtable_fib* fib, struct sr_rt* rt,
+                                 struct sr_rt* remaining)
+{
+    if ( fib->dir24 )
+    { sr_fib_dir24_remove(fib->dir24, rt, remaining); }
+    else
+    { sr_fib_trie_remove(fib->trie, rt, remaining); }
+} /* -- sr_rtable_fib_remove -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rtable_fib_reclaim(..)
+ * Scope: local
+ *
+ * Release what earlier updates retired, once readers are out of the way.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_rtable_fib_reclaim(struct sr_rtable_fib* fib)
+{
+    if ( fib->dir24 )
+    { sr_fib_dir24_reclaim(fib->dir24); }
+    else
+    { sr_fib_trie_reclaim(fib->trie); }
+} /* -- sr_rtable_fib_reclaim -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mask_to_plen(..)
+ * Scope: local
+ *
+ * Returns the prefix length of mask or -1 if mask is not contiguous.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_mask_to_plen(uint32_t mask /* nbo */)
+{
+    uint32_t m = ntohl(mask);
+    int plen = 0;
+
+    while ( m & 0x80000000 )
+    {
+        m <<= 1;
+        plen++;
+    }
+
+    return m ? -1 : plen;
+} /* -- sr_mask_to_plen -- */
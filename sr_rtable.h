@@ -0,0 +1,113 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtable.h
+ *
+ * Description:
+ *
+ * Routing table for the router subsystem.  Keeps the authoritative list
+ * of routes (for the CLI and for rebuilding) and a FIB that answers the
+ * per-packet longest prefix match queries.
+ *
+ * Lookups take no lock: the FIB is read inside an epoch read section (see
+ * sr_epoch.h) while writers, serialized by rtable->lock, either update it
+ * in place one published store at a time or build a new FIB and swap the
+ * pointer.  Routes and FIB memory are only freed after a grace period.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RTABLE_H
+#define SR_RTABLE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_base_internal.h"
+
+struct sr_router_if;
+struct sr_fib_trie;
+struct sr_fib_dir24;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt
+ *
+ * A single route.  dest is stored already masked.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_rt
+{
+    struct sr_rt*        next;
+    uint32_t             dest; /* nbo */
+    uint32_t             gw;   /* nbo, 0 if directly connected */
+    uint32_t             mask; /* nbo */
+    uint8_t              plen; /* prefix length of mask */
+    uint8_t              is_static;
+    struct sr_router_if* intf;
+};
+
+struct sr_rtable_fib
+{
+    struct sr_fib_trie*  trie;     /* set if built as SR_FIB_TRIE  */
+    struct sr_fib_dir24* dir24;    /* set if built as SR_FIB_DIR24 */
+};
+
+struct sr_rtable
+{
+    pthread_mutex_t       lock;     /* serializes writers, not lookups */
+    struct sr_rt*         routes;   /* writers only */
+    unsigned              num_routes;
+    int                   fib_type; /* SR_FIB_TRIE or SR_FIB_DIR24 */
+    struct sr_rtable_fib* fib;      /* published with sr_rcu_assign */
+};
+
+struct sr_rtable* sr_rtable_create(void);
+void sr_rtable_destroy(struct sr_rtable* rtable);
+
+/**
+ * Switch the FIB behind the table to fib_type (SR_FIB_TRIE, SR_FIB_DIR24),
+ * reindexing all current routes.  Returns 0 on success, -1 on failure in
+ * which case the old FIB stays in place.
+ */
+int  sr_rtable_set_fib(struct sr_rtable* rtable, int fib_type);
+
+int  sr_rtable_load(struct sr_instance* sr, struct sr_rtable* rtable,
+                    const char* filename);
+
+/**
+ * Longest prefix match on dest.  On a hit returns the outgoing interface and
+ * sets *next_hop to the gateway (or to dest if the route is directly
+ * connected).  Returns NULL if there is no route.  Does not allocate and
+ * never blocks.
+ */
+struct sr_router_if* sr_rtable_lookup(struct sr_rtable* rtable,
+                                      uint32_t dest /* nbo */,
+                                      uint32_t* next_hop /* nbo */);
+
+/* ----------------------------------------------------------------------------
+ * Routing table hooks used by the CLI
+ * -------------------------------------------------------------------------*/
+
+/** Adds a route to the appropriate routing table. */
+void rtable_route_add( struct sr_instance* sr,
+                       uint32_t dest, uint32_t gw, uint32_t mask,
+                       void* intf,
+                       int is_static_route );
+
+/** Removes the specified route from the routing table, if present. */
+int rtable_route_remove( struct sr_instance* sr,
+                         uint32_t dest, uint32_t mask,
+                         int is_static );
+
+/** Remove all routes from the router. */
+void rtable_purge_all( struct sr_instance* sr );
+
+/** Remove all routes of a specific type from the router. */
+void rtable_purge( struct sr_instance* sr, int is_static );
+
+#endif  /* -- SR_RTABLE_H -- */
@@ -0,0 +1,296 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rxbuf.c
+ *
+ * Description:
+ *
+ * Receive buffers, see sr_rxbuf.h.
+ *
+ * Buffers come from a few size classes carved out of the packet arena (see
+ * sr_arena.h), or cache aligned heap memory if it has no room, when the
+ * first buffer is asked for.  Each class keeps its free buffers on
+ * a mutex protected stack; buffers go back to it from whichever thread drops
+ * the last reference.  A request that finds its class empty tries the
+ * larger classes and, if those are empty too, falls back to malloc(..).
+ * Every fallback is counted.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sr_rxbuf.h"
+#include "sr_arena.h"
+
+#define SR_RXBUF_ALIGN SR_ARENA_ALIGN  /* cache line */
+
+#define SR_RXBUF_ROUND(x) (((x) + SR_RXBUF_ALIGN - 1) & ~(SR_RXBUF_ALIGN - 1))
+
+struct sr_rxbuf_class
+{
+    unsigned          size;   /* data bytes per buffer */
+    unsigned          count;  /* buffers in the arena  */
+    uint8_t*          arena;
+    struct sr_rxbuf*  free;
+    pthread_mutex_t   lock;
+    struct sr_rxbuf_class_stats stats;
+};
+
+static struct sr_rxbuf_class sr_rxbuf_classes[SR_RXBUF_NUM_CLASSES] =
+{
+    { 256,              256  },  /* ARP, bare TCP segments */
+    { 2048,             1024 },  /* full sized ethernet frames */
+    { SR_RXBUF_MAX_LEN, 64   },  /* anything else the VNS may send */
+    { SR_RXBUF_CHUNK_LEN, 8  },  /* VNS read buffers */
+};
+
+static pthread_once_t sr_rxbuf_once = PTHREAD_ONCE_INIT;
+static unsigned long  sr_rxbuf_malloced = 0;
+
+static __thread struct sr_rxbuf* sr_rxbuf_current = 0;
+
+static void sr_rxbuf_init(void);
+static struct sr_rxbuf* sr_rxbuf_class_get(struct sr_rxbuf_class* c);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_alloc(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_rxbuf* sr_rxbuf_alloc(unsigned len)
+{
+    struct sr_rxbuf* b;
+    int i, first = -1;
+
+    pthread_once(&sr_rxbuf_once, sr_rxbuf_init);
+
+    for ( i = 0; i < SR_RXBUF_NUM_CLASSES; ++i )
+    {
+        if ( sr_rxbuf_classes[i].size < len )
+        { continue; }
+
+        if ( first < 0 )
+        { first = i; }
+
+        if ( (b = sr_rxbuf_class_get(&sr_rxbuf_classes[i])) )
+        {
+            b->refs = 1;
+            return b;
+        }
+    }
+
+    /* -- every class that fits is empty (or none does) -- */
+    if ( first >= 0 &&
+         __atomic_add_fetch(&sr_rxbuf_classes[first].stats.exhausted, 1,
+                            __ATOMIC_RELAXED) == 1 )
+    {
+        fprintf(stderr, "Warning: out of %u byte receive buffers, "
+                "falling back to malloc\n", sr_rxbuf_classes[first].size);
+    }
+
+    if ( ! (b = (struct sr_rxbuf*)malloc(sizeof(struct sr_rxbuf) + len)) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_rxbuf_alloc)\n");
+        return 0;
+    }
+    __atomic_add_fetch(&sr_rxbuf_malloced, 1, __ATOMIC_RELAXED);
+
+    b->refs = 1;
+    b->size = len;
+    b->cls  = -1;
+    b->next = 0;
+
+    return b;
+} /* -- sr_rxbuf_alloc -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_hold(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_rxbuf_hold(struct sr_rxbuf* b)
+{
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+} /* -- sr_rxbuf_hold -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_put(..)
+ * Scope: global
+ *
+ * The last reference recycles the buffer; acq_rel so every holder's use of
+ * the data happens before that.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_rxbuf_put(struct sr_rxbuf* b)
+{
+    struct sr_rxbuf_class* c;
+
+    if ( __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0 )
+    { return; }
+
+    if ( b->cls < 0 )
+    {
+        free(b);
+        return;
+    }
+
+    c = &sr_rxbuf_classes[b->cls];
+
+    if ( pthread_mutex_lock(&c->lock) )
+    { assert(0); }
+    b->next = c->free;
+    c->free = b;
+    if ( pthread_mutex_unlock(&c->lock) )
+    { assert(0); }
+} /* -- sr_rxbuf_put -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_set_current(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_rxbuf_set_current(struct sr_rxbuf* b)
+{
+    sr_rxbuf_current = b;
+} /* -- sr_rxbuf_set_current -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_claim(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_rxbuf* sr_rxbuf_claim(const uint8_t* data, unsigned len)
+{
+    struct sr_rxbuf* b = sr_rxbuf_current;
+
+    if ( ! b || data < b->data || data + len > b->data + b->size )
+    { return 0; }
+
+    sr_rxbuf_hold(b);
+    return b;
+} /* -- sr_rxbuf_claim -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_claim_long(..)
+ * Scope: global
+ *
+ * Read chunks are told apart by size so malloc'd ones are refused too.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_rxbuf* sr_rxbuf_claim_long(const uint8_t* data, unsigned len)
+{
+    struct sr_rxbuf* b = sr_rxbuf_current;
+
+    if ( b && b->size >= SR_RXBUF_CHUNK_LEN )
+    { return 0; }
+
+    return sr_rxbuf_claim(data, len);
+} /* -- sr_rxbuf_claim_long -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_get_stats(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_rxbuf_get_stats(struct sr_rxbuf_class_stats stats[SR_RXBUF_NUM_CLASSES],
+                        unsigned long* malloced)
+{
+    int i;
+
+    for ( i = 0; i < SR_RXBUF_NUM_CLASSES; ++i )
+    {
+        stats[i].size   = sr_rxbuf_classes[i].size;
+        stats[i].allocs = __atomic_load_n(&sr_rxbuf_classes[i].stats.allocs,
+                                          __ATOMIC_RELAXED);
+        stats[i].exhausted =
+            __atomic_load_n(&sr_rxbuf_classes[i].stats.exhausted,
+                            __ATOMIC_RELAXED);
+    }
+    *malloced = __atomic_load_n(&sr_rxbuf_malloced, __ATOMIC_RELAXED);
+} /* -- sr_rxbuf_get_stats -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_arena_size(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+size_t sr_rxbuf_arena_size(void)
+{
+    size_t size = 0;
+    int k;
+
+    for ( k = 0; k < SR_RXBUF_NUM_CLASSES; ++k )
+    {
+        size += (size_t)SR_RXBUF_ROUND(sizeof(struct sr_rxbuf) +
+                                       sr_rxbuf_classes[k].size) *
+                sr_rxbuf_classes[k].count;
+    }
+    return size;
+} /* -- sr_rxbuf_arena_size -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_init(..)
+ * Scope: local
+ *
+ * Carve each class' arena into buffers.  A class whose arena cannot be
+ * allocated stays empty and its requests go to the next class or malloc.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_rxbuf_init(void)
+{
+    struct sr_rxbuf_class* c;
+    struct sr_rxbuf* b;
+    unsigned stride, i;
+    int k;
+    void* mem;
+
+    for ( k = 0; k < SR_RXBUF_NUM_CLASSES; ++k )
+    {
+        c = &sr_rxbuf_classes[k];
+        pthread_mutex_init(&c->lock, 0);
+
+        stride = SR_RXBUF_ROUND(sizeof(struct sr_rxbuf) + c->size);
+        if ( ! (mem = sr_arena_carve((size_t)stride * c->count)) &&
+             posix_memalign(&mem, SR_RXBUF_ALIGN, (size_t)stride * c->count) )
+        {
+            fprintf(stderr, "Error: out of memory (sr_rxbuf_init)\n");
+            continue;
+        }
+        c->arena = (uint8_t*)mem;
+
+        for ( i = c->count; i-- > 0; )
+        {
+            b = (struct sr_rxbuf*)(c->arena + (size_t)stride * i);
+            b->size = c->size;
+            b->cls  = k;
+            b->next = c->free;
+            c->free = b;
+        }
+    }
+} /* -- sr_rxbuf_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rxbuf_class_get(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static struct sr_rxbuf* sr_rxbuf_class_get(struct sr_rxbuf_class* c)
+{
+    struct sr_rxbuf* b;
+
+    if ( pthread_mutex_lock(&c->lock) )
+    { assert(0); }
+    if ( (b = c->free) )
+    {
+        c->free = b->next;
+        c->stats.allocs++;
+    }
+    if ( pthread_mutex_unlock(&c->lock) )
+    { assert(0); }
+
+    return b;
+} /* -- sr_rxbuf_class_get -- */
@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rxbuf.h
+ *
+ * Description:
+ *
+ * Reference counted receive buffers.  The reader that fills a buffer owns
+ * the first reference and drops it once sr_integ_input(..) returns.  While
+ * the packet is being handled, code further up the stack may keep the
+ * buffer past that point with sr_rxbuf_claim(..) instead of copying the
+ * packet out; it drops its reference with sr_rxbuf_put(..) from whatever
+ * thread finishes with it.
+ *
+ * Buffers are recycled through fixed pools of a few size classes, see
+ * sr_rxbuf.c.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RXBUF_H
+#define SR_RXBUF_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+/* -- largest command the VNS reader accepts -- */
+#define SR_RXBUF_MAX_LEN     10000
+/* -- what the VNS reader reads a burst of commands into -- */
+#define SR_RXBUF_CHUNK_LEN   (256 * 1024)
+#define SR_RXBUF_NUM_CLASSES 4
+
+struct sr_rxbuf
+{
+    uint32_t         refs;
+    unsigned         size;  /* bytes in data */
+    int              cls;   /* size class, -1 if malloc'd */
+    struct sr_rxbuf* next;  /* free list */
+    uint8_t          data[];
+};
+
+struct sr_rxbuf_class_stats
+{
+    unsigned      size;      /* data bytes per buffer of this class     */
+    unsigned long allocs;    /* buffers handed out from this class      */
+    unsigned long exhausted; /* requests that had to go to malloc       */
+};
+
+/** A buffer of at least len bytes holding one reference, NULL if out of memory */
+struct sr_rxbuf* sr_rxbuf_alloc(unsigned len);
+
+void sr_rxbuf_hold(struct sr_rxbuf* b);
+void sr_rxbuf_put(struct sr_rxbuf* b);
+
+/**
+ * Marks b as the buffer whose contents the calling thread is dispatching
+ * (NULL when done), so sr_rxbuf_claim(..) can find it.
+ */
+void sr_rxbuf_set_current(struct sr_rxbuf* b);
+
+/**
+ * If [data, data + len) lies in the buffer the calling thread is
+ * dispatching, take a reference on that buffer and return it.  Returns
+ * NULL otherwise, in which case the caller has to copy.
+ */
+struct sr_rxbuf* sr_rxbuf_claim(const uint8_t* data, unsigned len);
+
+/**
+ * As sr_rxbuf_claim(..) for holders that may keep the buffer for as long as
+ * an application takes to read it (e.g. lwip's receive queues).  Refuses
+ * the VNS read chunks, a frame pinning one would pin everything read with
+ * it and leave the reader to malloc(..) new chunks.
+ */
+struct sr_rxbuf* sr_rxbuf_claim_long(const uint8_t* data, unsigned len);
+
+/** Bytes of packet arena all the size classes take, see sr_arena.h */
+size_t sr_rxbuf_arena_size(void);
+
+/** Counters of each size class and the number of malloc'd buffers */
+void sr_rxbuf_get_stats(struct sr_rxbuf_class_stats stats[SR_RXBUF_NUM_CLASSES],
+                        unsigned long* malloced);
+
+#endif  /* -- SR_RXBUF_H -- */
@@ -0,0 +1,291 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txring.c
+ *
+ * Description:
+ *
+ * Transmit ring, see sr_txring.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "sr_txring.h"
+
+#define SR_TXRING_MASK (SR_TXRING_SIZE - 1)
+
+static int sr_txring_ready(struct sr_txring* ring, uint32_t pos);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_create(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_txring* sr_txring_create(void)
+{
+    struct sr_txring* ring;
+    void* mem;
+    unsigned i;
+
+    if ( posix_memalign(&mem, SR_TXRING_ALIGN, sizeof(struct sr_txring)) )
+    { return 0; }
+    ring = (struct sr_txring*)mem;
+    memset(ring, 0, sizeof(struct sr_txring));
+
+    if ( posix_memalign(&mem, SR_TXRING_ALIGN,
+                        SR_TXRING_SIZE * sizeof(struct sr_txring_slot)) )
+    {
+        fprintf(stderr, "Error: out of memory (sr_txring_create)\n");
+        free(ring);
+        return 0;
+    }
+    ring->slots = (struct sr_txring_slot*)mem;
+
+    for ( i = 0; i < SR_TXRING_SIZE; ++i )
+    {
+        ring->slots[i].seq = i;
+        ring->slots[i].big = 0;
+    }
+
+    pthread_mutex_init(&ring->lock, 0);
+    pthread_cond_init(&ring->wake, 0);
+
+    return ring;
+} /* -- sr_txring_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_destroy(..)
+ * Scope: global
+ *
+ * No producer or writer may be using the ring any more.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_txring_destroy(struct sr_txring* ring)
+{
+    unsigned i;
+
+    if ( ! ring )
+    { return; }
+
+    for ( i = 0; i < SR_TXRING_SIZE; ++i )
+    { free(ring->slots[i].big); }
+
+    pthread_cond_destroy(&ring->wake);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->slots);
+    free(ring);
+} /* -- sr_txring_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_put(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int sr_txring_put(struct sr_txring* ring,
+                  const void* hdr, unsigned hlen,
+                  const void* frame, unsigned len)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void*)frame;
+    iov.iov_len  = len;
+
+    return sr_txring_putv(ring, hdr, hlen, &iov, 1);
+} /* -- sr_txring_put -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_putv(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+int sr_txring_putv(struct sr_txring* ring,
+                   const void* hdr, unsigned hlen,
+                   const struct iovec* iov, int iovcnt)
+{
+    struct sr_txring_slot* slot;
+    uint32_t pos, seq;
+    uint8_t* dst;
+    unsigned len = 0;
+    int32_t diff;
+    int i;
+
+    for ( i = 0; i < iovcnt; ++i )
+    { len += iov[i].iov_len; }
+
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    while ( 1 )
+    {
+        slot = &ring->slots[pos & SR_TXRING_MASK];
+        seq  = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (int32_t)(seq - pos);
+
+        if ( diff == 0 )
+        {
+            if ( __atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+            { break; }
+        }
+        else if ( diff < 0 )
+        {
+            /* -- writer hasn't released this slot yet, ring is full -- */
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        else
+        { pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED); }
+    }
+
+    /* -- slot is ours until published, nobody else looks at it -- */
+    dst = slot->data;
+    if ( hlen + len > SR_TXRING_SLOT_DATA &&
+         ! (dst = slot->big = (uint8_t*)malloc(hlen + len)) )
+    {
+        /* -- can't give the slot back, send it as an empty frame -- */
+        fprintf(stderr, "Error: out of memory (sr_txring_putv)\n");
+        hlen = len = 0;
+        iovcnt = 0;
+        dst  = slot->data;
+    }
+    memcpy(dst, hdr, hlen);
+    slot->len = hlen + len;
+    for ( dst += hlen, i = 0; i < iovcnt; dst += iov[i].iov_len, ++i )
+    { memcpy(dst, iov[i].iov_base, iov[i].iov_len); }
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ring->queued, 1, __ATOMIC_RELAXED);
+
+    /* -- pairs with the fence in sr_txring_wait(..) -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( __atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) &&
+         __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_RELAXED) )
+    {
+        if ( pthread_mutex_lock(&ring->lock) )
+        { assert(0); }
+        pthread_cond_signal(&ring->wake);
+        if ( pthread_mutex_unlock(&ring->lock) )
+        { assert(0); }
+    }
+
+    return hlen + len ? 0 : -1;
+} /* -- sr_txring_putv -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_stop(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_txring_stop(struct sr_txring* ring)
+{
+    if ( pthread_mutex_lock(&ring->lock) )
+    { assert(0); }
+    __atomic_store_n(&ring->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&ring->wake);
+    if ( pthread_mutex_unlock(&ring->lock) )
+    { assert(0); }
+} /* -- sr_txring_stop -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_wait(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_txring_wait(struct sr_txring* ring, unsigned timeout_ms)
+{
+    struct timeval  now;
+    struct timespec until;
+
+    if ( sr_txring_ready(ring, ring->head) )
+    { return; }
+
+    gettimeofday(&now, 0);
+    until.tv_sec  = now.tv_sec + timeout_ms / 1000;
+    until.tv_nsec = now.tv_usec * 1000 + (timeout_ms % 1000) * 1000000L;
+    if ( until.tv_nsec >= 1000000000L )
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    if ( pthread_mutex_lock(&ring->lock) )
+    { assert(0); }
+    while ( 1 )
+    {
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if ( sr_txring_ready(ring, ring->head) ||
+             __atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE) )
+        { break; }
+        if ( pthread_cond_timedwait(&ring->wake, &ring->lock, &until) ==
+             ETIMEDOUT )
+        { break; }
+    }
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    if ( pthread_mutex_unlock(&ring->lock) )
+    { assert(0); }
+} /* -- sr_txring_wait -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_peek(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+unsigned sr_txring_peek(struct sr_txring* ring, unsigned skip,
+                        struct iovec* iov, unsigned max, size_t* bytes)
+{
+    struct sr_txring_slot* slot;
+    uint32_t pos = ring->head + skip;
+    unsigned n;
+
+    for ( n = 0; n < max && sr_txring_ready(ring, pos); ++n, ++pos )
+    {
+        slot = &ring->slots[pos & SR_TXRING_MASK];
+        iov[n].iov_base = slot->big ? slot->big : slot->data;
+        iov[n].iov_len  = slot->len;
+        *bytes += slot->len;
+    }
+
+    return n;
+} /* -- sr_txring_peek -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_release(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_txring_release(struct sr_txring* ring, unsigned n)
+{
+    struct sr_txring_slot* slot;
+    uint32_t pos = ring->head;
+    unsigned i;
+
+    for ( i = 0; i < n; ++i, ++pos )
+    {
+        slot = &ring->slots[pos & SR_TXRING_MASK];
+        if ( slot->big )
+        {
+            free(slot->big);
+            slot->big = 0;
+        }
+        __atomic_store_n(&slot->seq, pos + SR_TXRING_SIZE, __ATOMIC_RELEASE);
+    }
+    ring->head = pos;
+
+    ring->batches++;
+    ring->sent += n;
+} /* -- sr_txring_release -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txring_ready(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int sr_txring_ready(struct sr_txring* ring, uint32_t pos)
+{
+    return __atomic_load_n(&ring->slots[pos & SR_TXRING_MASK].seq,
+                           __ATOMIC_ACQUIRE) == pos + 1;
+} /* -- sr_txring_ready -- */
@@ -0,0 +1,106 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_txring.h
+ *
+ * Description:
+ *
+ * Bounded multi producer, single consumer ring of outgoing frames.  Any
+ * thread may put a frame (a header plus the frame itself, which may be
+ * gathered from several pieces, all copied into the slot) without taking a
+ * lock; a single writer thread picks up runs of ready frames as iovecs,
+ * writes them out in one go and releases them.
+ *
+ * Producers claim slots with a compare and swap on the tail and publish
+ * them through a per slot sequence number (D. Vyukov's bounded queue), so
+ * a producer that is slow to fill its slot only holds up the frames behind
+ * it.  The writer sleeps on a condition variable when the ring is empty;
+ * producers only touch the mutex when they find the writer asleep.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TXRING_H
+#define SR_TXRING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define SR_TXRING_BITS      10
+#define SR_TXRING_SIZE      (1 << SR_TXRING_BITS)
+#define SR_TXRING_SLOT_DATA 2048 /* header + frame held inline */
+#define SR_TXRING_ALIGN     64
+
+struct sr_txring_slot
+{
+    uint32_t seq;   /* == position + 1 once the frame is ready */
+    unsigned len;   /* header + frame */
+    uint8_t* big;   /* malloc'd copy if it didn't fit in data, else NULL */
+    uint8_t  data[SR_TXRING_SLOT_DATA];
+} __attribute__ ((aligned (SR_TXRING_ALIGN))) ;
+
+struct sr_txring
+{
+    struct sr_txring_slot* slots; /* SR_TXRING_SIZE */
+
+    uint32_t tail __attribute__ ((aligned (SR_TXRING_ALIGN))); /* producers */
+    uint32_t head __attribute__ ((aligned (SR_TXRING_ALIGN))); /* writer    */
+
+    int             waiting; /* bool : writer is (about to be) asleep */
+    int             stop;    /* bool : writer is to drain and exit      */
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    /* -- stats -- */
+    unsigned long queued;  /* frames put                         */
+    unsigned long dropped; /* frames refused, ring full          */
+    unsigned long batches; /* runs handed to the writer          */
+    unsigned long sent;    /* frames released by the writer      */
+};
+
+struct sr_txring* sr_txring_create(void);
+void sr_txring_destroy(struct sr_txring* ring);
+
+/**
+ * Queue hdr followed by frame.  Any thread, never blocks.
+ * @return 0 on success, -1 if the ring is full or out of memory
+ */
+int sr_txring_put(struct sr_txring* ring,
+                  const void* hdr, unsigned hlen,
+                  const void* frame, unsigned len);
+
+/** As sr_txring_put(..) with the frame gathered from iov */
+int sr_txring_putv(struct sr_txring* ring,
+                   const void* hdr, unsigned hlen,
+                   const struct iovec* iov, int iovcnt);
+
+/**
+ * Ask the writer to send what is ready and exit, waking it if it sleeps.
+ * Any thread; frames put after this are never sent.
+ */
+void sr_txring_stop(struct sr_txring* ring);
+
+/* ----------------------------------------------------------------------------
+ * Writer side, a single thread only
+ * -------------------------------------------------------------------------*/
+
+/** Sleep until at least one frame is ready or stop is set, at most timeout_ms */
+void sr_txring_wait(struct sr_txring* ring, unsigned timeout_ms);
+
+/**
+ * Fill iov with the frames that are ready after the first skip ready ones
+ * (at most max of them) and add their length to *bytes.
+ * @return number of frames added
+ */
+unsigned sr_txring_peek(struct sr_txring* ring, unsigned skip,
+                        struct iovec* iov, unsigned max, size_t* bytes);
+
+/** Give the first n ready frames back to the producers */
+void sr_txring_release(struct sr_txring* ring, unsigned n);
+
+#endif  /* -- SR_TXRING_H -- */
@@ -22,10 +22,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include "sha1.h"
 #include "sr_vns.h"
 #include "sr_dumper.h"
+#include "sr_rxbuf.h"
+#include "sr_txring.h"
 
 #include "sr_base_internal.h"
 
@@ -52,6 +55,16 @@ void sr_vns_init_log(struct sr_instance* sr, char* logfile)
 
 #ifndef _CPUMODE_
 
+/* -- the writer sends once it has this much or nothing more is ready -- */
+#define SR_VNS_TX_FLUSH_BYTES (64 * 1024)
+#define SR_VNS_TX_MAX_IOV     256
+
+static void  sr_vns_start_tx(struct sr_instance* sr);
+static void* sr_vns_tx_thread(void* arg);
+static int sr_vns_next_command(struct sr_instance* sr);
+static int sr_vns_make_room(struct sr_instance* sr);
+static int sr_vns_writev_all(int fd, struct iovec* iov, int iovcnt);
+
 /*-----------------------------------------------------------------------------
  * Method: sr_close_instance(..)
  * Scope: Global
@@ -59,11 +72,18 @@ void sr_vns_init_log(struct sr_instance* sr, char* logfile)
  *----------------------------------------------------------------------------*/
 void sr_close_instance(struct sr_instance* sr)
 {
+    /* -- the writer must be done with the socket before it goes -- */
+    sr_vns_stop_tx(sr);
     close(sr->sockfd);
 
     if(sr->logfile)
     { sr_dump_close(sr->logfile); }
 
+    /* -- anything still buffered belonged to this session -- */
+    if(sr->rx_chunk)
+    { sr_rxbuf_put(sr->rx_chunk); sr->rx_chunk = 0; }
+    sr->rx_pos = sr->rx_fill = 0;
+
     sr->hw_init = 0;
 } /* -- sr_close_instance -- */
 
@@ -190,6 +210,8 @@ int sr_vns_connect_to_server(struct sr_instance* sr,unsigned short port,
         if(sr_read_from_server_expect(sr, VNS_RTABLE) != 1)
             return -1; /* needed to get the rtable */
 
+    sr_vns_start_tx(sr);
+
     return 0;
 } /* -- sr_connect_to_server -- */
 
@@ -356,84 +378,52 @@ int sr_vns_read_from_server(struct sr_instance* sr /* borrowed */)
     return sr_read_from_server_expect(sr, 0);
 }/* -- sr_vns_read_from_server -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_handle_input(..)
+ * Scope: Global
+ *
+ * Called from the event loop when the socket is readable: one recv(..)
+ * and then whatever complete commands it brought in.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_handle_input(struct sr_instance* sr /* borrowed */)
+{
+    int ret;
+
+    do
+    {
+        ret = sr_read_from_server_expect(sr, 0);
+    } while ( ret == 1 && sr_vns_have_command(sr) );
+
+    return ret;
+} /* -- sr_vns_handle_input -- */
+
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
     int command, len;
     unsigned char *buf = 0;
     c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    int ret = 0;
 
     /* REQUIRES */
     assert(sr);
 
     /*---------------------------------------------------------------------------
-      Read a command from the server
+      Read a command from the server (under load it is usually buffered already)
       -------------------------------------------------------------------------*/
 
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
-    }
-
-    len = ntohl(len);
-
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
-
-    if((buf = malloc(len)) == 0)
-    {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
-    }
-
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
-
-    bytes_read = 0;
+    if ( (len = sr_vns_next_command(sr)) < 0 )
+    { return -1; }
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
+    buf = sr->rx_chunk->data + sr->rx_pos;
+    sr->rx_pos += len;
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    /* -- convert the type in place; commands are packed back to back in
+     *    the read buffer so buf need not be aligned -- */
+    memcpy(&command, buf + 4, 4);
+    command = ntohl(command);
+    memcpy(buf + 4, &command, 4);
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -456,10 +446,12 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
                     ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
 
             /* -- pass to router, student's code should take over here -- */
+            sr_rxbuf_set_current(sr->rx_chunk);
             sr_integ_input(sr,
                     (buf+sizeof(c_packet_header)), /* lent */
                     len - sizeof(c_packet_header),
                     (const char*)buf + sizeof(c_base)); /* lent */
+            sr_rxbuf_set_current(0);
 
             break;
 
@@ -469,9 +461,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_close_instance(sr); /* closes the VNS socket and logfile */
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -491,7 +480,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNS_RTABLE:
             fprintf(stderr, "not yet setup to handle VNS_RTABLE message\n");
             sr_close_instance(sr);
-            if(buf) { free(buf); }
             return 0;
             break;
 
@@ -513,11 +501,143 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
 }/* -- sr_read_from_server -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_next_command(..)
+ * Scope: local
+ *
+ * Make sure the read buffer holds a complete command at rx_pos and return
+ * its length.  Each recv(..) takes whatever the socket has ready, so under
+ * load one call brings in a whole burst of commands which are then handled
+ * without going back to the kernel.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_next_command(struct sr_instance* sr)
+{
+    uint32_t len_nbo;
+    unsigned avail;
+    int len, ret;
+
+    while ( 1 )
+    {
+        avail = sr->rx_fill - sr->rx_pos;
+
+        if ( avail >= 4 )
+        {
+            memcpy(&len_nbo, sr->rx_chunk->data + sr->rx_pos, 4);
+            len = ntohl(len_nbo);
+
+            if ( len > SR_RXBUF_MAX_LEN || len < (int)sizeof(c_base) )
+            {
+                fprintf(stderr,"Error: bad command length %d\n",len);
+                close(sr->sockfd);
+                return -1;
+            }
+            if ( avail >= (unsigned)len )
+            { return len; }
+        }
+
+        if ( sr_vns_make_room(sr) )
+        { return -1; }
+
+        do
+        { /* -- just in case SIGALRM breaks recv -- */
+            errno = 0; /* -- hacky glibc workaround -- */
+            ret = recv(sr->sockfd, sr->rx_chunk->data + sr->rx_fill,
+                       sr->rx_chunk->size - sr->rx_fill, 0);
+        } while ( ret == -1 && errno == EINTR ); /* be mindful of signals */
+
+        if ( ret == -1 )
+        {
+            perror("recv(..):sr_client.c::sr_read_from_server");
+            return -1;
+        }
+        if ( ret == 0 )
+        {
+            fprintf(stderr,"Error: VNS server closed the connection\n");
+            return -1;
+        }
+
+        sr->rx_fill += ret;
+    }
+} /* -- sr_vns_next_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_have_command(..)
+ * Scope: Global
+ *
+ * True if a complete command is buffered at rx_pos.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_have_command(struct sr_instance* sr)
+{
+    unsigned avail = sr->rx_fill - sr->rx_pos;
+    uint32_t len_nbo;
+
+    if ( ! sr->rx_chunk || avail < 4 )
+    { return 0; }
+
+    memcpy(&len_nbo, sr->rx_chunk->data + sr->rx_pos, 4);
+    return avail >= ntohl(len_nbo);
+} /* -- sr_vns_have_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_make_room(..)
+ * Scope: local
+ *
+ * Leave room for at least one more maximum sized command after rx_fill.
+ * The partial command at the end is slid to the front of the buffer, or,
+ * if the transport still holds packets in the buffer, copied into a fresh
+ * one.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_make_room(struct sr_instance* sr)
+{
+    struct sr_rxbuf* chunk = sr->rx_chunk;
+    struct sr_rxbuf* fresh;
+    unsigned avail = sr->rx_fill - sr->rx_pos;
+    int alone;
+
+    /* -- only the reader takes references, so 1 stays 1 -- */
+    alone = chunk && __atomic_load_n(&chunk->refs, __ATOMIC_ACQUIRE) == 1;
+
+    if ( alone && avail == 0 )
+    {
+        sr->rx_pos = sr->rx_fill = 0;
+        return 0;
+    }
+
+    if ( chunk && chunk->size - sr->rx_fill >= SR_RXBUF_MAX_LEN )
+    { return 0; }
+
+    if ( alone )
+    { memmove(chunk->data, chunk->data + sr->rx_pos, avail); }
+    else
+    {
+        if ( (fresh = sr_rxbuf_alloc(SR_RXBUF_CHUNK_LEN)) == 0 )
+        {
+            fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+            return -1;
+        }
+        if ( chunk )
+        {
+            memcpy(fresh->data, chunk->data + sr->rx_pos, avail);
+            sr_rxbuf_put(chunk);
+        }
+        sr->rx_chunk = fresh;
+    }
+
+    sr->rx_pos  = 0;
+    sr->rx_fill = avail;
+
+    return 0;
+} /* -- sr_vns_make_room -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
@@ -527,6 +647,9 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
  *
  * Note: buf is expected to be an IP packet!!
  *
+ * Once the writer thread runs the packet is copied onto its transmit ring
+ * and sent with whatever else is queued; a full ring drops the packet.
+ *
  *---------------------------------------------------------------------------*/
 
 int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
@@ -534,14 +657,55 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
                        unsigned int len,
                        const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct iovec iov;
 
     /* REQUIRES */
-    assert(sr);
     assert(buf);
+
+    iov.iov_base = buf;
+    iov.iov_len  = len;
+
+    return sr_vns_send_packet_v(sr, &iov, 1, iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_packet_v(..)
+ * Scope: Global
+ *
+ * As sr_vns_send_packet(..) with the frame gathered from iov, so callers
+ * that build a frame in pieces (e.g. headers in front of a chain of lwip
+ * pbufs) never have to flatten it.  The pieces are only read before this
+ * returns.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_send_packet_v(struct sr_instance* sr /* borrowed */,
+                         const struct iovec* iov /* borrowed */,
+                         int iovcnt,
+                         const char* iface /* borrowed */)
+{
+    c_packet_header sr_pkt;
+    struct iovec out[SR_INTEG_MAX_IOV + 1];
+    uint8_t dump[SR_PACKET_DUMP_SIZE];
+    unsigned int len = 0;
+    unsigned int size;
+    int ret = 0;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(iov);
     assert(iface);
 
+    if ( iovcnt > SR_INTEG_MAX_IOV )
+    {
+        fprintf(stderr , "** Error: packet in too many pieces \n");
+        return -1;
+    }
+
+    for ( i = 0; i < iovcnt; ++i )
+    { len += iov[i].iov_len; }
+
     /* don't waste my time ... */
     if ( len < 14 /* sizeof ethernet header */ )
     {
@@ -549,35 +713,192 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(total_len);
+    /* -- header on the stack, frame straight from the caller -- */
+    sr_pkt.mLen  = htonl(len + sizeof(c_packet_header));
+    sr_pkt.mType = htonl(VNSPACKET);
+    strncpy(sr_pkt.mInterfaceName,iface,16);
 
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    out[0].iov_base = &sr_pkt;
+    out[0].iov_len  = sizeof(c_packet_header);
+    memcpy(out + 1, iov, iovcnt * sizeof(struct iovec));
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    /* -- log packet, only the dump needs it in one piece -- */
+    if ( sr->logfile )
+    {
+        if ( iovcnt == 1 )
+        { sr_log_packet(sr, (uint8_t*)iov[0].iov_base, len); }
+        else
+        {
+            for ( size = 0, i = 0; i < iovcnt && size < sizeof(dump); ++i )
+            {
+                unsigned int n = min(iov[i].iov_len, sizeof(dump) - size);
+                memcpy(dump + size, iov[i].iov_base, n);
+                size += n;
+            }
+            sr_log_packet(sr, dump, size);
+        }
+    }
+
+    if ( sr->tx_ring )
+    {
+        if ( sr_txring_putv(sr->tx_ring, &sr_pkt, sizeof(c_packet_header),
+                            iov, iovcnt) )
+        {
+            Debug("dropping packet to %s, transmit ring full\n", iface);
+            return -1;
+        }
+        return 0;
+    }
 
     if ( pthread_mutex_lock(&(sr->send_lock)) )
     { assert (0); }
-    if( write(sr->sockfd, sr_pkt, total_len) < (signed int)total_len )
+    if ( sr_vns_writev_all(sr->sockfd, out, iovcnt + 1) )
     {
         fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        if ( pthread_mutex_unlock(&(sr->send_lock)) )
-        { assert (0); }
-        return -1;
+        ret = -1;
     }
     if ( pthread_mutex_unlock(&(sr->send_lock)) )
     { assert (0); }
 
-    free(sr_pkt);
+    return ret;
+} /* -- sr_vns_send_packet_v -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_start_tx(..)
+ * Scope: local
+ *
+ * Start the writer thread once per instance.  Without it packets are
+ * written directly by the sending thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_vns_start_tx(struct sr_instance* sr)
+{
+    struct sr_txring* ring;
+
+    if ( sr->tx_ring )
+    { return; }
+
+    if ( (ring = sr_txring_create()) == 0 )
+    {
+        fprintf(stderr, "Warning: no transmit ring, sending directly\n");
+        return;
+    }
+
+    sr->tx_ring = ring;
+    if ( pthread_create(&(sr->tx_thread), 0, sr_vns_tx_thread, sr) )
+    {
+        perror("pthread_create");
+        sr->tx_ring = 0;
+        sr_txring_destroy(ring);
+        return;
+    }
+} /* -- sr_vns_start_tx -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_stop_tx(..)
+ * Scope: global
+ *
+ * Have the writer thread send what is queued and wait for it to exit.
+ * The ring stays until sr_destroy_instance(..) since other threads may
+ * still be putting frames on it; those are dropped once it fills up.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_vns_stop_tx(struct sr_instance* sr)
+{
+    if ( ! sr->tx_ring || __atomic_load_n(&sr->tx_ring->stop, __ATOMIC_ACQUIRE) )
+    { return; }
+
+    sr_txring_stop(sr->tx_ring);
+    if ( pthread_join(sr->tx_thread, 0) )
+    { perror("pthread_join"); }
+} /* -- sr_vns_stop_tx -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_thread(..)
+ * Scope: local
+ *
+ * Drain the transmit ring, many frames per writev(..).  Once a frame is
+ * ready the writer picks up whatever else is ready by then, up to
+ * SR_VNS_TX_FLUSH_BYTES, and sends without waiting for more: a burst goes
+ * out together and a lone frame goes out at once.  Exits, having sent
+ * what is ready, once sr_txring_stop(..) is called.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_vns_tx_thread(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_txring* ring = sr->tx_ring;
+    struct iovec iov[SR_VNS_TX_MAX_IOV];
+    size_t bytes;
+    unsigned n, more;
+
+    while ( 1 )
+    {
+        sr_txring_wait(ring, 1000);
+
+        bytes = 0;
+        if ( (n = sr_txring_peek(ring, 0, iov, SR_VNS_TX_MAX_IOV, &bytes)) == 0 )
+        {
+            if ( __atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE) )
+            { break; }
+            continue;
+        }
+
+        /* -- frames that were put while the first ones were collected -- */
+        while ( bytes < SR_VNS_TX_FLUSH_BYTES && n < SR_VNS_TX_MAX_IOV &&
+                (more = sr_txring_peek(ring, n, iov + n,
+                                       SR_VNS_TX_MAX_IOV - n, &bytes)) )
+        { n += more; }
+
+        if ( sr_vns_writev_all(sr->sockfd, iov, n) )
+        { fprintf(stderr, "Error writing %u packets\n", n); }
+
+        sr_txring_release(ring, n);
+    }
 
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_tx_thread -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_writev_all(..)
+ * Scope: local
+ *
+ * writev(..) until all of iov is out, picking up after short writes and
+ * signals.  iov is consumed.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_writev_all(int fd, struct iovec* iov, int iovcnt)
+{
+    ssize_t ret;
+
+    while ( iovcnt > 0 )
+    {
+        if ( (ret = writev(fd, iov, iovcnt)) < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            return -1;
+        }
+
+        /* -- skip what went out, partially written entries last -- */
+        while ( iovcnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+} /* -- sr_vns_writev_all -- */
 
 #endif /* _CPUMODE_ */
@@ -27,6 +27,8 @@
 #include <inttypes.h>
 #endif /* _SOLARIS_ */
 
+#include <sys/uio.h>
+
 struct sr_instance* sr; /* -- forward declare -- */
 
 void sr_vns_init_log(struct sr_instance* sr, char* logfile);
@@ -36,16 +38,36 @@ void sr_vns_init_log(struct sr_instance* sr, char* logfile);
 int  sr_vns_read_from_server(struct sr_instance* );
 int sr_read_from_server_expect(struct sr_instance*, int);
 
+/**
+ * Handle all commands the socket has ready without blocking for more than
+ * the rest of a partly received command.  Same return values as
+ * sr_vns_read_from_server(..).
+ */
+int  sr_vns_handle_input(struct sr_instance* );
+
+/** True if a whole command was read from the socket but not handled yet */
+int  sr_vns_have_command(struct sr_instance* );
+
 int  sr_vns_connected_to_server(struct sr_instance* );
 
 int  sr_vns_connect_to_server(struct sr_instance* ,unsigned short , char* );
 
+/** Stop the transmit writer thread (if running) and wait for it to exit */
+void sr_vns_stop_tx(struct sr_instance* );
+
 /**
  * Returns 0 on success or -1 on error.  Will print an error message to stderr
  * if -1 is returned.
  */
 int  sr_vns_send_packet(struct sr_instance* ,uint8_t* , unsigned int , const char*);
 
+/**
+ * Same as sr_vns_send_packet(..) with the frame gathered from at most
+ * SR_INTEG_MAX_IOV pieces.
+ */
+int  sr_vns_send_packet_v(struct sr_instance* , const struct iovec* , int ,
+                          const char*);
+
 #endif /* _CPUMODE */
 
 #endif  /* -- SR_VNS_H -- */
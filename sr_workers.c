@@ -0,0 +1,392 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_workers.c
+ *
+ * Description:
+ *
+ * Forwarding workers, see sr_workers.h.
+ *
+ * The rings are plain Lamport queues: the packet thread owns tail, the
+ * worker owns head, each only reads the other's index (the packet thread
+ * through a cached copy it refreshes when the ring looks full).  A worker
+ * that finds its ring empty sleeps on a condition variable; the packet
+ * thread only takes the mutex when it sees the worker asleep, the same
+ * handshake as the transmit ring (sr_txring.c).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define  __USE_BSD 1
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+
+#include "sr_workers.h"
+#include "sr_rxbuf.h"
+#include "sr_router.h"
+#include "sr_flowcache.h"
+#include "sr_protocol.h"
+#include "sr_integration.h"
+
+#define SR_WORKER_RING_MASK (SR_WORKER_RING_SIZE - 1)
+
+static void*    sr_worker_main(void* arg);
+static void     sr_worker_sleep(struct sr_worker* w);
+static void     sr_worker_wake(struct sr_worker* w);
+static void     sr_worker_pin(struct sr_worker* w);
+static uint32_t sr_workers_hash(const uint8_t* packet, unsigned int len);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_create(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+struct sr_workers* sr_workers_create(struct sr_instance* sr, unsigned n)
+{
+    struct sr_workers* pool;
+    struct sr_worker* w;
+    long ncpu;
+    void* mem;
+    unsigned i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ( n == 0 || n > SR_WORKERS_MAX )
+    {
+        fprintf(stderr, "Error: number of workers must be 1 .. %d\n",
+                SR_WORKERS_MAX);
+        return 0;
+    }
+
+    if ( ! (pool = (struct sr_workers*)calloc(1, sizeof(struct sr_workers))) )
+    { return 0; }
+    if ( posix_memalign(&mem, SR_WORKER_ALIGN, n * sizeof(struct sr_worker)) )
+    {
+        free(pool);
+        return 0;
+    }
+    memset(mem, 0, n * sizeof(struct sr_worker));
+    pool->sr      = sr;
+    pool->workers = (struct sr_worker*)mem;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( ncpu < 1 )
+    { ncpu = 1; }
+
+    for ( i = 0; i < n; ++i )
+    {
+        w = &(pool->workers[i]);
+        w->pool  = pool;
+        w->id    = i;
+        w->cpu   = ncpu > 1 ? (int)((i + 1) % ncpu) : -1;
+        w->slots = (struct sr_worker_slot*)calloc(SR_WORKER_RING_SIZE,
+                                                  sizeof(struct sr_worker_slot));
+        w->flows = sr_flowcache_create();
+        pthread_mutex_init(&(w->lock), 0);
+        pthread_cond_init(&(w->wake), 0);
+
+        if ( ! w->slots || ! w->flows ||
+             pthread_create(&(w->thread), 0, sr_worker_main, w) )
+        {
+            fprintf(stderr, "Error: could not start worker %u\n", i);
+            free(w->slots);
+            sr_flowcache_destroy(w->flows);
+            pthread_cond_destroy(&(w->wake));
+            pthread_mutex_destroy(&(w->lock));
+            sr_workers_destroy(pool);
+            return 0;
+        }
+        pool->num++;
+    }
+
+    return pool;
+} /* -- sr_workers_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_destroy(..)
+ * Scope: global
+ *
+ * Must be called from the packet thread (or with it stopped).
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_workers_destroy(struct sr_workers* pool)
+{
+    struct sr_worker* w;
+    uint32_t pos;
+    unsigned i;
+
+    if ( ! pool )
+    { return; }
+
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+    for ( i = 0; i < pool->num; ++i )
+    {
+        w = &(pool->workers[i]);
+        sr_worker_wake(w);
+        pthread_join(w->thread, 0);
+    }
+
+    for ( i = 0; i < pool->num; ++i )
+    {
+        w = &(pool->workers[i]);
+        Debug("worker %u (cpu %d): %lu packets, %lu bytes, %lu sleeps, "
+              "%lu drops\n", i, w->cpu, w->stats.packets, w->stats.bytes,
+              w->stats.sleeps, w->drops);
+
+        for ( pos = w->head; pos != w->tail; ++pos )
+        { sr_rxbuf_put(w->slots[pos & SR_WORKER_RING_MASK].buf); }
+
+        free(w->slots);
+        sr_flowcache_destroy(w->flows);
+        pthread_cond_destroy(&(w->wake));
+        pthread_mutex_destroy(&(w->lock));
+    }
+
+    free(pool->workers);
+    free(pool);
+} /* -- sr_workers_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_dispatch(..)
+ * Scope: global
+ *---------------------------------------------------------------------------*/
+
+void sr_workers_dispatch(struct sr_workers* pool,
+                         uint8_t* packet /* lent */,
+                         unsigned int len,
+                         const char* interface /* borrowed */)
+{
+    struct sr_worker* w;
+    struct sr_worker_slot* slot;
+    struct sr_rxbuf* buf;
+    uint32_t tail;
+
+    w = &(pool->workers[((uint64_t)sr_workers_hash(packet, len) * pool->num)
+                        >> 32]);
+
+    tail = w->tail;
+    if ( tail - w->head_cache == SR_WORKER_RING_SIZE )
+    {
+        w->head_cache = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        if ( tail - w->head_cache == SR_WORKER_RING_SIZE )
+        {
+            __atomic_add_fetch(&w->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    /* -- keep a per-frame receive buffer, copy out of a read chunk -- */
+    if ( ! (buf = sr_rxbuf_claim_long(packet, len)) )
+    {
+        if ( ! (buf = sr_rxbuf_alloc(len)) )
+        {
+            __atomic_add_fetch(&w->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        memcpy(buf->data, packet, len);
+        packet = buf->data;
+    }
+
+    slot = &(w->slots[tail & SR_WORKER_RING_MASK]);
+    slot->buf    = buf;
+    slot->packet = packet;
+    slot->len    = len;
+    strncpy(slot->iface, interface, SR_NAMELEN);
+    slot->iface[SR_NAMELEN - 1] = 0;
+
+    __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* -- pairs with the fence in sr_worker_sleep(..) -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( __atomic_load_n(&w->waiting, __ATOMIC_RELAXED) )
+    { sr_worker_wake(w); }
+} /* -- sr_workers_dispatch -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_get_stats(..)
+ * Scope: global
+ *
+ * Counters are read without synchronization, good enough for display.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_workers_get_stats(struct sr_workers* pool, unsigned i,
+                          struct sr_worker_stats* stats)
+{
+    struct sr_worker* w;
+
+    /* REQUIRES */
+    assert(i < pool->num);
+
+    w = &(pool->workers[i]);
+    stats->packets = __atomic_load_n(&w->stats.packets, __ATOMIC_RELAXED);
+    stats->bytes   = __atomic_load_n(&w->stats.bytes, __ATOMIC_RELAXED);
+    stats->sleeps  = __atomic_load_n(&w->stats.sleeps, __ATOMIC_RELAXED);
+    stats->drops   = __atomic_load_n(&w->drops, __ATOMIC_RELAXED);
+} /* -- sr_workers_get_stats -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_worker_main(..)
+ * Scope: local
+ *
+ * Handle up to SR_WORKER_BATCH frames, then hand the slots back with one
+ * store to head.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_worker_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_router* router =
+        (struct sr_router*)sr_get_subsystem(w->pool->sr);
+    struct sr_worker_slot* slot;
+    uint32_t head, tail, end;
+    unsigned long bytes;
+
+    sr_worker_pin(w);
+    sr_router_set_thread_flowcache(w->flows);
+
+    head = w->head;
+    while ( ! __atomic_load_n(&w->pool->stop, __ATOMIC_RELAXED) )
+    {
+        tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+        if ( head == tail )
+        {
+            sr_worker_sleep(w);
+            continue;
+        }
+
+        end = tail - head > SR_WORKER_BATCH ? head + SR_WORKER_BATCH : tail;
+        bytes = 0;
+        __atomic_add_fetch(&w->stats.packets, end - head, __ATOMIC_RELAXED);
+        for ( ; head != end; ++head )
+        {
+            slot = &(w->slots[head & SR_WORKER_RING_MASK]);
+
+            sr_rxbuf_set_current(slot->buf);
+            sr_router_handle_packet(router, slot->packet, slot->len,
+                                    slot->iface);
+            sr_rxbuf_set_current(0);
+            sr_rxbuf_put(slot->buf);
+
+            bytes += slot->len;
+        }
+
+        __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&w->stats.bytes, bytes, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+} /* -- sr_worker_main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_worker_sleep(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_worker_sleep(struct sr_worker* w)
+{
+    if ( pthread_mutex_lock(&(w->lock)) )
+    { assert(0); }
+
+    __atomic_store_n(&w->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == w->head &&
+         ! __atomic_load_n(&w->pool->stop, __ATOMIC_RELAXED) )
+    {
+        __atomic_add_fetch(&w->stats.sleeps, 1, __ATOMIC_RELAXED);
+        pthread_cond_wait(&(w->wake), &(w->lock));
+    }
+    __atomic_store_n(&w->waiting, 0, __ATOMIC_RELAXED);
+
+    if ( pthread_mutex_unlock(&(w->lock)) )
+    { assert(0); }
+} /* -- sr_worker_sleep -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_worker_wake(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_worker_wake(struct sr_worker* w)
+{
+    if ( pthread_mutex_lock(&(w->lock)) )
+    { assert(0); }
+    pthread_cond_signal(&(w->wake));
+    if ( pthread_mutex_unlock(&(w->lock)) )
+    { assert(0); }
+} /* -- sr_worker_wake -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_worker_pin(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void sr_worker_pin(struct sr_worker* w)
+{
+#ifdef _LINUX_
+    cpu_set_t set;
+
+    if ( w->cpu < 0 )
+    { return; }
+
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if ( pthread_setaffinity_np(pthread_self(), sizeof(set), &set) )
+    {
+        fprintf(stderr, "Warning: could not pin worker %u to cpu %d\n",
+                w->id, w->cpu);
+        w->cpu = -1;
+    }
+#else
+    w->cpu = -1;
+#endif /* _LINUX_ */
+} /* -- sr_worker_pin -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_hash(..)
+ * Scope: local
+ *
+ * Hash of the 5-tuple of an IPv4 TCP or UDP packet.  Fragments and other
+ * protocols hash on addresses and protocol only, anything that isn't IP
+ * (ARP) goes to worker 0.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint32_t sr_workers_hash(const uint8_t* packet, unsigned int len)
+{
+    const struct sr_ethernet_hdr* eth = (const struct sr_ethernet_hdr*)packet;
+    const struct ip* iph;
+    const uint8_t* l4;
+    uint32_t h, ports = 0;
+    unsigned int hlen;
+
+    if ( len < SR_ETHER_HDR_LEN + sizeof(struct ip) ||
+         eth->ether_type != htons(SR_ETHERTYPE_IP) )
+    { return 0; }
+
+    iph  = (const struct ip*)(packet + SR_ETHER_HDR_LEN);
+    hlen = iph->ip_hl * 4;
+    if ( (iph->ip_p == SR_IP_PROTO_TCP || iph->ip_p == SR_IP_PROTO_UDP) &&
+         ! (iph->ip_off & htons(IP_MF | IP_OFFMASK)) &&
+         SR_ETHER_HDR_LEN + hlen + 4 <= len )
+    {
+        l4 = packet + SR_ETHER_HDR_LEN + hlen;
+        memcpy(&ports, l4, 4);
+    }
+
+    h = iph->ip_src.s_addr;
+    h = (h ^ iph->ip_dst.s_addr) * 0x9e3779b1;
+    h = (h ^ ports) * 0x9e3779b1;
+    h ^= iph->ip_p;
+    h ^= h >> 16;
+    return h * 0x9e3779b1;
+} /* -- sr_workers_hash -- */
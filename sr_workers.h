@@ -0,0 +1,118 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_workers.h
+ *
+ * Description:
+ *
+ * Forwarding workers.  With -w N the packet thread only reads: every
+ * frame it gets is handed to one of N worker threads, each pinned to its
+ * own core, which run it through the router.  A frame goes to the worker
+ * picked by a hash of its 5-tuple (addresses only for fragments, which
+ * carry no ports past the first), so the frames of one flow are always
+ * handled by the same worker, in the order they arrived.
+ *
+ * Each worker has a single producer, single consumer ring fed only by the
+ * packet thread.  The slot holds a reference on a receive buffer of its
+ * own; frames read in a VNS chunk are copied out into a pooled one, a
+ * lagging worker must not pin the whole chunk (see sr_rxbuf_claim_long).  The
+ * routing table and ARP cache are shared, workers only read them on the
+ * forwarding path (see sr_epoch.h); each has its own flow cache and its
+ * own counters.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_WORKERS_H
+#define SR_WORKERS_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_base_internal.h"
+
+#define SR_WORKERS_MAX      64
+#define SR_WORKER_RING_BITS 10
+#define SR_WORKER_RING_SIZE (1 << SR_WORKER_RING_BITS)
+#define SR_WORKER_BATCH     32  /* frames handled between head updates */
+#define SR_WORKER_ALIGN     64
+
+struct sr_rxbuf;     /* -- forward declare, see sr_rxbuf.h -- */
+struct sr_flowcache; /* -- forward declare, see sr_flowcache.h -- */
+
+struct sr_worker_slot
+{
+    struct sr_rxbuf* buf;    /* holds a reference, frame lies inside */
+    uint8_t*         packet;
+    unsigned int     len;
+    char             iface[SR_NAMELEN];
+};
+
+struct sr_worker_stats
+{
+    unsigned long packets; /* frames handled        */
+    unsigned long bytes;
+    unsigned long sleeps;  /* times the ring ran dry */
+    unsigned long drops;   /* frames refused, ring full or out of buffers */
+};
+
+struct sr_worker
+{
+    struct sr_workers*     pool;
+    unsigned               id;
+    int                    cpu;     /* pinned to, -1 if not pinned */
+    pthread_t              thread;
+    struct sr_flowcache*   flows;
+
+    struct sr_worker_slot* slots;   /* SR_WORKER_RING_SIZE */
+
+    /* -- packet thread -- */
+    uint32_t tail __attribute__ ((aligned (SR_WORKER_ALIGN)));
+    uint32_t head_cache;            /* last head seen */
+    unsigned long drops;
+
+    /* -- worker -- */
+    uint32_t head __attribute__ ((aligned (SR_WORKER_ALIGN)));
+    struct sr_worker_stats stats;   /* drops unused, see above */
+
+    int             waiting __attribute__ ((aligned (SR_WORKER_ALIGN)));
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+} __attribute__ ((aligned (SR_WORKER_ALIGN))) ;
+
+struct sr_workers
+{
+    struct sr_instance* sr;
+    unsigned            num;
+    int                 stop;
+    struct sr_worker*   workers; /* num of them */
+};
+
+/**
+ * Start n workers pinned to cores 1 .. n (wrapping around the cores there
+ * are), core 0 is left to the packet thread.  Returns NULL on error.
+ */
+struct sr_workers* sr_workers_create(struct sr_instance* sr, unsigned n);
+
+/** Stop the workers, dropping whatever they haven't handled yet */
+void sr_workers_destroy(struct sr_workers* pool);
+
+/**
+ * Hand a frame read by the packet thread to its worker, called instead of
+ * the router from sr_integ_input(..).  Never blocks, the frame is dropped
+ * (and counted) if that worker is too far behind.
+ */
+void sr_workers_dispatch(struct sr_workers* pool,
+                         uint8_t* packet /* lent */,
+                         unsigned int len,
+                         const char* interface /* borrowed */);
+
+/** Counters of worker i, drops included */
+void sr_workers_get_stats(struct sr_workers* pool, unsigned i,
+                          struct sr_worker_stats* stats);
+
+#endif  /* -- SR_WORKERS_H -- */